@@ -0,0 +1,189 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bvh.hpp"
+#include "obj-loader.hpp"
+#include "rng.hpp"
+
+// 経過時間をミリ秒で返す
+double elapsedMilliseconds(
+    const std::chrono::steady_clock::time_point& startTime) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+// メッシュと, それを参照するPolygon
+struct Scene {
+  ObjMesh mesh;
+  Polygon polygon;
+
+  explicit Scene(ObjMesh mesh)
+      : mesh(std::move(mesh)), polygon(this->mesh.polygon()) {}
+};
+
+// 頂点をscale倍したメッシュのPolygonを作る
+// NOTE: Polygonが参照する配列も一緒に生存するようにaliasing constructorを使う
+std::shared_ptr<const Polygon> makeScaledPolygon(const ObjMesh& mesh,
+                                                 float scale) {
+  ObjMesh scaled = mesh;
+  for (float& v : scaled.vertices) {
+    v *= scale;
+  }
+  const auto scene = std::make_shared<Scene>(std::move(scaled));
+  return std::shared_ptr<const Polygon>(scene, &scene->polygon);
+}
+
+// 複数のスレッドでレイをまとめてtraverseし続けながら, 別のスレッドで
+// BVHをnRebuilds回再構築する
+// queryはレイの配列を受け取りtraverseする関数, rebuildはscaleを受け取り
+// 再構築する関数. 各まとまりの処理時間(ms)を返す
+template <typename Query, typename Rebuild>
+std::vector<double> measureLatency(const std::vector<Ray>& rays,
+                                   int nThreads, int nRebuilds,
+                                   const Query& query,
+                                   const Rebuild& rebuild) {
+  constexpr size_t batchSize = 1000;
+  std::atomic<bool> finished{false};
+  std::vector<std::vector<double>> latencies(nThreads);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      size_t offset = batchSize * t;
+      while (!finished.load()) {
+        const auto startTime = std::chrono::steady_clock::now();
+        query(rays.data() + offset, batchSize);
+        latencies[t].push_back(elapsedMilliseconds(startTime));
+        offset = (offset + batchSize * nThreads) % (rays.size() - batchSize);
+      }
+    });
+  }
+
+  for (int i = 0; i < nRebuilds; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    rebuild(1.0f + 0.01f * (i % 2));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  finished.store(true);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<double> ret;
+  for (const auto& l : latencies) {
+    ret.insert(ret.end(), l.begin(), l.end());
+  }
+  return ret;
+}
+
+// 処理時間の統計を表示する
+void printLatency(const std::string& name, std::vector<double> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  const auto percentile = [&](double p) {
+    return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+  };
+  std::cout << name << std::endl;
+  std::cout << "  batches: " << latencies.size() << std::endl;
+  std::cout << "  median: " << percentile(0.5) << "ms" << std::endl;
+  std::cout << "  99%: " << percentile(0.99) << "ms" << std::endl;
+  std::cout << "  max: " << latencies.back() << "ms" << std::endl;
+}
+
+int main() {
+  const std::string filename = "dragon.obj";
+  const int nRays = 1000000;
+  const int nRebuilds = 5;
+  const int nThreads =
+      std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 1);
+
+  ObjMesh mesh;
+
+  if (!loadObj(filename, mesh)) {
+    std::exit(EXIT_FAILURE);
+  }
+
+  const auto polygon = makeScaledPolygon(mesh, 1.0f);
+  std::cout << "faces: " << polygon->nFaces() << std::endl;
+  std::cout << "threads: " << nThreads << std::endl;
+
+  // バウンディングボックスの中心に向かうレイを生成
+  OptimizedBVH bvh(*polygon);
+  bvh.buildBVH();
+  const AABB bbox = bvh.rootAABB();
+  const Vec3 center = bbox.center();
+  const float radius = 0.5f * length(bbox.bounds[1] - bbox.bounds[0]);
+  RNG rng;
+  std::vector<Ray> rays;
+  rays.reserve(nRays);
+  for (int i = 0; i < nRays; ++i) {
+    const Vec3 dir = normalize(
+        Vec3(rng.getNext() - 0.5f, rng.getNext() - 0.5f, rng.getNext() - 0.5f));
+    rays.emplace_back(center + 2.0f * radius * dir, -dir);
+  }
+
+  const auto trace = [](const OptimizedBVH& bvh, const Ray* batch,
+                        size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      Ray ray = batch[i];
+      IntersectInfo info;
+      bvh.intersect(ray, info);
+    }
+  };
+
+  // 排他ロックを取って同期的に再構築する場合
+  {
+    auto current = std::make_unique<OptimizedBVH>(*polygon);
+    current->buildBVH();
+    std::shared_ptr<const Polygon> currentPolygon = polygon;
+    std::shared_mutex mutex;
+
+    const auto latencies = measureLatency(
+        rays, nThreads, nRebuilds,
+        [&](const Ray* batch, size_t size) {
+          std::shared_lock<std::shared_mutex> lock(mutex);
+          trace(*current, batch, size);
+        },
+        [&](float scale) {
+          auto newPolygon = makeScaledPolygon(mesh, scale);
+          std::unique_lock<std::shared_mutex> lock(mutex);
+          currentPolygon = std::move(newPolygon);
+          current = std::make_unique<OptimizedBVH>(*currentPolygon);
+          current->buildBVH();
+        });
+    printLatency("blocking rebuild", latencies);
+  }
+
+  // AsyncBVHでバックグラウンドで再構築する場合
+  {
+    AsyncBVH<OptimizedBVH> asyncBVH(polygon);
+
+    double rebuildTime = 0;
+    const auto latencies = measureLatency(
+        rays, nThreads, nRebuilds,
+        [&](const Ray* batch, size_t size) {
+          asyncBVH.query(
+              [&](const OptimizedBVH& bvh) { trace(bvh, batch, size); });
+        },
+        [&](float scale) {
+          const auto startTime = std::chrono::steady_clock::now();
+          asyncBVH.rebuild(makeScaledPolygon(mesh, scale));
+          asyncBVH.wait();
+          rebuildTime += elapsedMilliseconds(startTime);
+        });
+    printLatency("async rebuild", latencies);
+    std::cout << "  rebuild: " << rebuildTime / nRebuilds << "ms"
+              << std::endl;
+    std::cout << "  version: " << asyncBVH.version() << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,296 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "bvh.hpp"
+#include "core/perf-counters.hpp"
+#include "obj-loader.hpp"
+#include "rng.hpp"
+
+// 経過時間をミリ秒で返す
+double elapsedMilliseconds(
+    const std::chrono::steady_clock::time_point& startTime) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+// 構築, traverse, 破棄にかかる時間を計測する
+// 構築とtraverseのハードウェアカウンタはprofilerに加える
+// argsはBVHのコンストラクタに渡す引数
+template <typename BVH, typename... Args>
+void benchmark(const std::string& name, const std::vector<Ray>& rays,
+               PerfProfiler& profiler, const Args&... args) {
+  auto startTime = std::chrono::steady_clock::now();
+  std::unique_ptr<BVH> bvh;
+  {
+    const PerfProfiler::Phase phase(profiler, name + " build");
+    bvh = std::make_unique<BVH>(args...);
+    bvh->buildBVH();
+  }
+  const double buildTime = elapsedMilliseconds(startTime);
+
+  startTime = std::chrono::steady_clock::now();
+  int nHits = 0;
+  {
+    const PerfProfiler::Phase phase(profiler, name + " trace");
+    for (const Ray& ray : rays) {
+      Ray r = ray;
+      IntersectInfo info;
+      if (bvh->intersect(r, info)) {
+        nHits++;
+      }
+    }
+  }
+  const double traceTime = elapsedMilliseconds(startTime);
+
+  const size_t memoryUsage = bvh->memoryUsage();
+  startTime = std::chrono::steady_clock::now();
+  bvh.reset();
+  const double destroyTime = elapsedMilliseconds(startTime);
+
+  std::cout << name << std::endl;
+  std::cout << "  build: " << buildTime << "ms" << std::endl;
+  std::cout << "  trace: " << traceTime << "ms (" << nHits << " hits)"
+            << std::endl;
+  std::cout << "  destroy: " << destroyTime << "ms" << std::endl;
+  std::cout << "  memory: " << memoryUsage / 1024 << "KB" << std::endl;
+}
+
+// SoA形式のレイをまとめてtraverseする時間を計測する
+void benchmarkBatch(const std::string& name, const std::vector<Ray>& rays,
+                    const Polygon& polygon) {
+  OptimizedBVH bvh(polygon);
+  bvh.buildBVH();
+
+  // レイをSoA形式に変換する
+  std::vector<float> origins[3], directions[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    origins[axis].resize(rays.size());
+    directions[axis].resize(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i) {
+      origins[axis][i] = rays[i].origin[axis];
+      directions[axis][i] = rays[i].direction[axis];
+    }
+  }
+  RayBatch batch;
+  batch.size = rays.size();
+  for (int axis = 0; axis < 3; ++axis) {
+    batch.origin[axis] = origins[axis].data();
+    batch.direction[axis] = directions[axis].data();
+  }
+
+  std::vector<float> t(rays.size());
+  std::vector<int> primID(rays.size());
+  HitBatch hits;
+  hits.t = t.data();
+  hits.primID = primID.data();
+
+  const auto startTime = std::chrono::steady_clock::now();
+  bvh.intersect(batch, hits);
+  const double traceTime = elapsedMilliseconds(startTime);
+  const int nHits = std::count_if(primID.begin(), primID.end(),
+                                  [](int id) { return id >= 0; });
+
+  std::cout << name << std::endl;
+  std::cout << "  trace: " << traceTime << "ms (" << nHits << " hits, "
+            << std::thread::hardware_concurrency() << " threads)" << std::endl;
+}
+
+// 点から最も近い三角形上の点を求める時間を計測する
+void benchmarkClosestPoint(const std::string& name,
+                           const std::vector<Vec3>& points,
+                           const Polygon& polygon) {
+  OptimizedBVH bvh(polygon);
+  bvh.buildBVH();
+
+  auto startTime = std::chrono::steady_clock::now();
+  float sumDistance = 0;
+  for (const Vec3& p : points) {
+    sumDistance += bvh.distance(p);
+  }
+  const double queryTime = elapsedMilliseconds(startTime);
+
+  // 点をSoA形式に変換してまとめて求める
+  std::vector<float> positions[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    positions[axis].resize(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      positions[axis][i] = points[i][axis];
+    }
+  }
+  PointBatch batch;
+  batch.size = points.size();
+  for (int axis = 0; axis < 3; ++axis) {
+    batch.position[axis] = positions[axis].data();
+  }
+  std::vector<float> distance(points.size());
+  ClosestPointBatch results;
+  results.distance = distance.data();
+
+  startTime = std::chrono::steady_clock::now();
+  bvh.closestPoint(batch, results);
+  const double batchTime = elapsedMilliseconds(startTime);
+
+  std::cout << name << std::endl;
+  std::cout << "  query: " << queryTime << "ms (mean distance "
+            << sumDistance / points.size() << ")" << std::endl;
+  std::cout << "  query (batch): " << batchTime << "ms ("
+            << std::thread::hardware_concurrency() << " threads)" << std::endl;
+}
+
+// 球と重なる三角形を求める時間を計測する
+void benchmarkOverlap(const std::string& name, const std::vector<Vec3>& points,
+                      float radius, const Polygon& polygon) {
+  OptimizedBVH bvh(polygon);
+  bvh.buildBVH();
+
+  auto startTime = std::chrono::steady_clock::now();
+  size_t nOverlaps = 0;
+  for (const Vec3& p : points) {
+    bvh.overlap(Sphere(p, radius), [&](uint32_t) {
+      nOverlaps++;
+      return true;
+    });
+  }
+  const double queryTime = elapsedMilliseconds(startTime);
+
+  // 複数のスレッドから同時にクエリを投げる
+  std::atomic<size_t> nOverlapsParallel{0};
+  startTime = std::chrono::steady_clock::now();
+  parallelFor(0, points.size(), 256, [&](size_t begin, size_t end) {
+    uint32_t primIDs[256];
+    for (size_t i = begin; i < end; ++i) {
+      nOverlapsParallel += bvh.overlap(Sphere(points[i], radius), primIDs, 256);
+    }
+  });
+  const double parallelTime = elapsedMilliseconds(startTime);
+
+  std::cout << name << std::endl;
+  std::cout << "  query: " << queryTime << "ms (" << nOverlaps << " overlaps)"
+            << std::endl;
+  std::cout << "  query (parallel): " << parallelTime << "ms ("
+            << nOverlapsParallel << " overlaps, "
+            << std::thread::hardware_concurrency() << " threads)" << std::endl;
+}
+
+// 回転, 平行移動した同じメッシュとの交差判定, 最短距離の計算時間を計測する
+void benchmarkCollision(const std::string& name, const Polygon& polygon) {
+  OptimizedBVH bvh(polygon);
+  bvh.buildBVH();
+  const AABB bbox = bvh.rootAABB();
+  const Vec3 size = bbox.bounds[1] - bbox.bounds[0];
+  const Vec3 axis = normalize(Vec3(1, 1, 0));
+
+  // 一部が重なるように配置する
+  const Transform overlapping(axis, 0.5f, 0.3f * size);
+  auto startTime = std::chrono::steady_clock::now();
+  size_t nPairs = 0;
+  bvh.collide(bvh, overlapping, [&](uint32_t, uint32_t) {
+    nPairs++;
+    return true;
+  });
+  const double collideTime = elapsedMilliseconds(startTime);
+
+  std::vector<std::pair<uint32_t, uint32_t>> pairs;
+  startTime = std::chrono::steady_clock::now();
+  bvh.collide(bvh, overlapping, pairs);
+  const double collideParallelTime = elapsedMilliseconds(startTime);
+
+  // 重ならないように配置する
+  const Transform separated(axis, 0.5f, 1.2f * size);
+  ProximityInfo info;
+  startTime = std::chrono::steady_clock::now();
+  bvh.minDistance(bvh, separated, info,
+                  std::numeric_limits<float>::infinity(), 1);
+  const double distanceTime = elapsedMilliseconds(startTime);
+
+  startTime = std::chrono::steady_clock::now();
+  bvh.minDistance(bvh, separated, info);
+  const double distanceParallelTime = elapsedMilliseconds(startTime);
+
+  std::cout << name << std::endl;
+  std::cout << "  collide: " << collideTime << "ms (" << nPairs << " pairs)"
+            << std::endl;
+  std::cout << "  collide (parallel): " << collideParallelTime << "ms ("
+            << pairs.size() << " pairs, "
+            << std::thread::hardware_concurrency() << " threads)" << std::endl;
+  std::cout << "  min distance: " << distanceTime << "ms (" << info.distance
+            << ")" << std::endl;
+  std::cout << "  min distance (parallel): " << distanceParallelTime << "ms ("
+            << std::thread::hardware_concurrency() << " threads)" << std::endl;
+}
+
+int main() {
+  const std::string filename = "dragon.obj";
+  const int nRays = 1000000;
+  const int nPoints = 100000;
+
+  ObjMesh mesh;
+
+  if (!loadObj(filename, mesh)) {
+    std::exit(EXIT_FAILURE);
+  }
+
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
+  std::cout << "vertices: " << polygon->nVertices << std::endl;
+  std::cout << "faces: " << polygon->nFaces() << std::endl;
+
+  // バウンディングボックスの外側から中心付近に向かうレイを生成する
+  OptimizedBVH bvh(*polygon);
+  bvh.buildBVH();
+  const AABB bbox = bvh.rootAABB();
+  const Vec3 center = bbox.center();
+  const float radius = length(bbox.bounds[1] - bbox.bounds[0]);
+
+  RNG rng;
+  std::vector<Ray> rays;
+  rays.reserve(nRays);
+  for (int i = 0; i < nRays; ++i) {
+    const Vec3 origin =
+        center + radius * normalize(Vec3(rng.getNext() - 0.5f,
+                                         rng.getNext() - 0.5f,
+                                         rng.getNext() - 0.5f));
+    const Vec3 target =
+        center + 0.5f * (bbox.bounds[1] - bbox.bounds[0]) *
+                     Vec3(rng.getNext() - 0.5f, rng.getNext() - 0.5f,
+                          rng.getNext() - 0.5f);
+    rays.emplace_back(origin, normalize(target - origin));
+  }
+
+  // BVH_USE_PERF_COUNTERSが定義されている場合はハードウェアカウンタも表示する
+  PerfProfiler profiler;
+  benchmark<SimpleBVH>("SimpleBVH", rays, profiler, *polygon);
+  benchmark<GenericBVH<TrianglePrimitives>>("GenericBVH (triangles)", rays,
+                                            profiler,
+                                            TrianglePrimitives(*polygon));
+  benchmark<OptimizedBVH>("OptimizedBVH", rays, profiler, *polygon);
+  benchmark<OptimizedBVH>("OptimizedBVH (Triangle4)", rays, profiler,
+                          *polygon, OptimizedBVH::LeafIntersector::TRIANGLE4);
+  benchmark<OptimizedBVH>("OptimizedBVH (van Emde Boas)", rays, profiler,
+                          *polygon, OptimizedBVH::LeafIntersector::TRIANGLE,
+                          OptimizedBVH::NodeLayout::VAN_EMDE_BOAS);
+  benchmarkBatch("OptimizedBVH (batch)", rays, *polygon);
+
+  // バウンディングボックスの周辺の点を生成する
+  std::vector<Vec3> points;
+  points.reserve(nPoints);
+  for (int i = 0; i < nPoints; ++i) {
+    points.push_back(center + (bbox.bounds[1] - bbox.bounds[0]) *
+                                  Vec3(rng.getNext() - 0.5f,
+                                       rng.getNext() - 0.5f,
+                                       rng.getNext() - 0.5f));
+  }
+  benchmarkClosestPoint("OptimizedBVH (closest point)", points, *polygon);
+  benchmarkOverlap("OptimizedBVH (overlap)", points, 0.01f * radius, *polygon);
+  benchmarkCollision("OptimizedBVH (collision)", *polygon);
+
+  profiler.report(std::cout);
+
+  return 0;
+}
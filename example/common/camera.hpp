@@ -1,31 +1,251 @@
 #ifndef _CAMERA_H
 #define _CAMERA_H
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "core/ray-batch.hpp"
 #include "core/ray.hpp"
+#include "core/simd.hpp"
 #include "core/vec3.hpp"
 
+// SoA形式のレイのバッファ
+// Camera::generateRaysで書き込み, batchでtraverseに渡す
+struct RayBuffer {
+  std::vector<float> origin[3];     // 始点の各軸
+  std::vector<float> direction[3];  // 方向の各軸
+
+  // n本のレイを書き込めるようにする
+  void resize(size_t n) {
+    for (int axis = 0; axis < 3; ++axis) {
+      origin[axis].resize(n);
+      direction[axis].resize(n);
+    }
+  }
+
+  // レイの数を返す
+  size_t size() const { return origin[0].size(); }
+
+  // i番目のレイを返す
+  Ray ray(size_t i) const {
+    return Ray(Vec3(origin[0][i], origin[1][i], origin[2][i]),
+               Vec3(direction[0][i], direction[1][i], direction[2][i]));
+  }
+
+  // traverseに渡すRayBatchを返す
+  RayBatch batch() const {
+    RayBatch ret;
+    ret.size = size();
+    for (int axis = 0; axis < 3; ++axis) {
+      ret.origin[axis] = origin[axis].data();
+      ret.direction[axis] = direction[axis].data();
+    }
+    return ret;
+  }
+};
+
+// カメラ
+// lensRadiusが0の場合はピンホールカメラ, それ以外の場合は薄レンズで
+// focusDistanceの距離にピントが合う(被写界深度)
 class Camera {
  private:
   Vec3 camPos;
   Vec3 camForward;
   Vec3 camRight;
   Vec3 camUp;
+  float lensRadius{0.0f};     // レンズの半径
+  float focusDistance{1.0f};  // レンズからピントが合う面までの距離
+
+  // [0, 1)^2の値を半径1の円板上の点に移す(concentric mapping)
+  // Shirley, Chiu, A Low Distortion Map Between Disk and Square, 1997
+  static void sampleDisk(float u, float v, float& x, float& y) {
+    const float a = 2.0f * u - 1.0f;
+    const float b = 2.0f * v - 1.0f;
+    if (a == 0.0f && b == 0.0f) {
+      x = y = 0.0f;
+      return;
+    }
+    constexpr float PI_OVER_4 = 0.785398163f;
+    if (std::abs(a) > std::abs(b)) {
+      const float phi = PI_OVER_4 * (b / a);
+      x = a * std::cos(phi);
+      y = a * std::sin(phi);
+    } else {
+      const float phi = PI_OVER_4 * (a / b);
+      x = b * std::sin(phi);
+      y = b * std::cos(phi);
+    }
+  }
+
+  // sampleDiskを4つまとめて行う
+  // NOTE: 角度は[-π/4, π/4]なので, sin, cosはTaylor展開で近似する
+  static void sampleDisk(const Float4& u, const Float4& v, Float4& x,
+                         Float4& y) {
+    const Float4 a = Float4(2.0f) * u - Float4(1.0f);
+    const Float4 b = Float4(2.0f) * v - Float4(1.0f);
+    const Bool4 aIsLarger = abs(a) > abs(b);
+    const Float4 r = select(aIsLarger, a, b);
+    const Float4 q = select(aIsLarger, b, a);
+    // r = 0の場合はa = b = 0なので, 角度を0にする
+    const Float4 phi = select(r == Float4(0.0f), Float4(0.0f),
+                              Float4(0.785398163f) * q / r);
+    const Float4 phi2 = phi * phi;
+    const Float4 sinPhi =
+        phi * (Float4(1.0f) +
+               phi2 * (Float4(-1.0f / 6.0f) +
+                       phi2 * (Float4(1.0f / 120.0f) +
+                               phi2 * Float4(-1.0f / 5040.0f))));
+    const Float4 cosPhi =
+        Float4(1.0f) +
+        phi2 * (Float4(-0.5f) +
+                phi2 * (Float4(1.0f / 24.0f) +
+                        phi2 * (Float4(-1.0f / 720.0f) +
+                                phi2 * Float4(1.0f / 40320.0f))));
+    x = r * select(aIsLarger, cosPhi, sinPhi);
+    y = r * select(aIsLarger, sinPhi, cosPhi);
+  }
 
  public:
   Camera(const Vec3& camPos, const Vec3& camForward)
       : camPos(camPos), camForward(camForward) {
     camRight = normalize(cross(camForward, Vec3(0, 1, 0)));
     camUp = normalize(cross(camRight, camForward));
+  }
 
-    std::cout << "camPos: " << camPos << std::endl;
-    std::cout << "camForward: " << camForward << std::endl;
-    std::cout << "camRight: " << camRight << std::endl;
-    std::cout << "camUp: " << camUp << std::endl;
+  // 薄レンズの半径とピントが合う距離をセットする
+  void setThinLens(float lensRadius, float focusDistance) {
+    this->lensRadius = lensRadius;
+    this->focusDistance = focusDistance;
   }
 
-  Ray sampleRay(float u, float v) const {
+  // 画像上の位置(u, v)のレイを返す
+  // lensU, lensVはレンズ上の位置を決める[0, 1)の値(0.5ならレンズの中心)
+  Ray sampleRay(float u, float v, float lensU = 0.5f,
+                float lensV = 0.5f) const {
     const Vec3 pinholePos = camPos + camForward;
     const Vec3 sensorPos = camPos + u * camRight + v * camUp;
-    return Ray(camPos, normalize(pinholePos - sensorPos));
+    const Vec3 direction = normalize(pinholePos - sensorPos);
+    if (lensRadius == 0.0f) {
+      return Ray(camPos, direction);
+    }
+
+    // レンズの中心を通るレイがピントの合う面と交わる点に向ける
+    float lensX, lensY;
+    sampleDisk(lensU, lensV, lensX, lensY);
+    const Vec3 origin =
+        camPos + lensRadius * (lensX * camRight + lensY * camUp);
+    const Vec3 focusPos =
+        camPos + (focusDistance * length(camForward) /
+                  dot(direction, camForward)) *
+                     direction;
+    return Ray(origin, normalize(focusPos - origin));
+  }
+
+  // width x heightの画像のうち, (x0, y0)から始まるtileWidth x tileHeightの
+  // タイルのレイを, ピクセル(i, j)についてrays[(j - y0) * tileWidth + (i - x0)]
+  // に書き込む. 画像上の位置はsampleRayと同じく
+  // u = (2 * (i + jitter) - width) / height
+  // jitter[0], jitter[1]はピクセル内の位置, lens[0], lens[1]はレンズ上の位置で,
+  // それぞれタイル内の順番で並べた[0, 1)の値. nullptrの場合はjitterは0,
+  // lensはレンズの中心にする
+  // NOTE: 4本ずつFloat4で計算する
+  void generateRays(int width, int height, int x0, int y0, int tileWidth,
+                    int tileHeight, RayBuffer& rays,
+                    const float* const jitter[2] = nullptr,
+                    const float* const lens[2] = nullptr) const {
+    rays.resize(static_cast<size_t>(tileWidth) * tileHeight);
+
+    const Float4 widthF(static_cast<float>(width));
+    const Float4 heightF(static_cast<float>(height));
+    const Float4 pos[3] = {Float4(camPos[0]), Float4(camPos[1]),
+                           Float4(camPos[2])};
+    const Float4 right[3] = {Float4(camRight[0]), Float4(camRight[1]),
+                             Float4(camRight[2])};
+    const Float4 up[3] = {Float4(camUp[0]), Float4(camUp[1]),
+                          Float4(camUp[2])};
+    const Float4 forward[3] = {Float4(camForward[0]), Float4(camForward[1]),
+                               Float4(camForward[2])};
+    const Float4 focus(focusDistance * length(camForward));
+    const bool thinLens = lensRadius != 0.0f;
+
+    for (int j = 0; j < tileHeight; ++j) {
+      for (int i = 0; i < tileWidth; i += 4) {
+        // タイル内の番号. 行の端で4本に満たない分は一時的な配列に書き込む
+        const size_t index = static_cast<size_t>(j) * tileWidth + i;
+        const int n = std::min(4, tileWidth - i);
+        const auto load = [&](const float* p, float defaultValue) {
+          if (!p) return Float4(defaultValue);
+          if (n == 4) return Float4::load(p + index);
+          float tmp[4] = {defaultValue, defaultValue, defaultValue,
+                          defaultValue};
+          for (int k = 0; k < n; ++k) tmp[k] = p[index + k];
+          return Float4::load(tmp);
+        };
+
+        // 画像上の位置
+        const float x = static_cast<float>(x0 + i);
+        const float y = static_cast<float>(y0 + j);
+        const Float4 u =
+            (Float4(2.0f) * (Float4(x, x + 1.0f, x + 2.0f, x + 3.0f) +
+                             load(jitter ? jitter[0] : nullptr, 0.0f)) -
+             widthF) /
+            heightF;
+        const Float4 v =
+            (Float4(2.0f) *
+                 (Float4(y) + load(jitter ? jitter[1] : nullptr, 0.0f)) -
+             heightF) /
+            heightF;
+
+        // ピンホールを通る方向(sampleRayと同じ順番で計算する)
+        Float4 d[3];
+        for (int axis = 0; axis < 3; ++axis) {
+          const Float4 pinholePos = pos[axis] + forward[axis];
+          const Float4 sensorPos = pos[axis] + u * right[axis] + v * up[axis];
+          d[axis] = pinholePos - sensorPos;
+        }
+        Float4 len = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        for (int axis = 0; axis < 3; ++axis) {
+          d[axis] = d[axis] / len;
+        }
+
+        Float4 o[3] = {pos[0], pos[1], pos[2]};
+        if (thinLens) {
+          Float4 lensX, lensY;
+          sampleDisk(load(lens ? lens[0] : nullptr, 0.5f),
+                     load(lens ? lens[1] : nullptr, 0.5f), lensX, lensY);
+          lensX = Float4(lensRadius) * lensX;
+          lensY = Float4(lensRadius) * lensY;
+          const Float4 t =
+              focus / (d[0] * forward[0] + d[1] * forward[1] +
+                       d[2] * forward[2]);
+          for (int axis = 0; axis < 3; ++axis) {
+            const Float4 focusPos = o[axis] + t * d[axis];
+            o[axis] = o[axis] + lensX * right[axis] + lensY * up[axis];
+            d[axis] = focusPos - o[axis];
+          }
+          len = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+          for (int axis = 0; axis < 3; ++axis) {
+            d[axis] = d[axis] / len;
+          }
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+          if (n == 4) {
+            o[axis].store(&rays.origin[axis][index]);
+            d[axis].store(&rays.direction[axis][index]);
+          } else {
+            float tmpO[4], tmpD[4];
+            o[axis].store(tmpO);
+            d[axis].store(tmpD);
+            for (int k = 0; k < n; ++k) {
+              rays.origin[axis][index + k] = tmpO[k];
+              rays.direction[axis][index + k] = tmpD[k];
+            }
+          }
+        }
+      }
+    }
   }
 };
 
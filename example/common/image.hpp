@@ -1,9 +1,14 @@
 #ifndef _IMAGE_H
 #define _IMAGE_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "core/parallel.hpp"
 #include "core/vec3.hpp"
 
 class Image {
@@ -40,40 +45,123 @@ class Image {
     pixels[3 * i + 3 * width * j + 2] = c[2];
   }
 
+  // バイナリ形式(P6)のPPMで書き出す
+  // NOTE: ヘッダと画素をまとめてから1回で書き込む
   void writePPM(const std::string& filename) const {
-    std::ofstream file(filename);
-    if (!file) {
-      std::cerr << "failed to open " << filename << std::endl;
-      std::exit(EXIT_FAILURE);
+    const std::string header =
+        "P6\n" + std::to_string(width) + " " + std::to_string(height) +
+        "\n255\n";
+    std::vector<uint8_t> buffer(header.size() + 3 * width * height);
+    std::memcpy(buffer.data(), header.data(), header.size());
+    uint8_t* data = buffer.data() + header.size();
+    for (int k = 0; k < 3 * width * height; ++k) {
+      const float c = std::clamp(255.0f * pixels[k], 0.0f, 255.0f);
+      data[k] = static_cast<uint8_t>(c);
     }
 
-    file << "P3" << std::endl;
-    file << width << " " << height << std::endl;
-    file << "255" << std::endl;
+    writeFile(filename, buffer.data(), buffer.size());
+  }
+
+  // リニアな値のままPFM(32bit浮動小数点)で書き出す
+  // NOTE: PFMは下の行から並べるので, jが大きい行から書き込む
+  void writePFM(const std::string& filename) const {
+    // スケールの符号が負の場合はリトルエンディアン
+    const uint32_t one = 1;
+    uint8_t endian;
+    std::memcpy(&endian, &one, 1);
+    const std::string header = "PF\n" + std::to_string(width) + " " +
+                               std::to_string(height) +
+                               (endian ? "\n-1.0\n" : "\n1.0\n");
+    const size_t rowSize = sizeof(float) * 3 * width;
+    std::vector<uint8_t> buffer(header.size() + rowSize * height);
+    std::memcpy(buffer.data(), header.data(), header.size());
     for (int j = 0; j < height; ++j) {
-      for (int i = 0; i < width; ++i) {
-        const Vec3 c = getPixel(i, j);
-        const int R = std::clamp(static_cast<int>(255.0f * c[0]), 0, 255);
-        const int G = std::clamp(static_cast<int>(255.0f * c[1]), 0, 255);
-        const int B = std::clamp(static_cast<int>(255.0f * c[2]), 0, 255);
-        file << R << " " << G << " " << B << std::endl;
-      }
+      std::memcpy(buffer.data() + header.size() + rowSize * (height - 1 - j),
+                  pixels + 3 * width * j, rowSize);
     }
 
-    file.close();
+    writeFile(filename, buffer.data(), buffer.size());
   }
 
-  void gammaCorrection() {
-    for (int j = 0; j < height; ++j) {
-      for (int i = 0; i < width; ++i) {
-        Vec3 c = getPixel(i, j);
-        c[0] = std::pow(c[0], 1 / 2.2f);
-        c[1] = std::pow(c[1], 1 / 2.2f);
-        c[2] = std::pow(c[2], 1 / 2.2f);
-        setPixel(i, j, c);
-      }
+  // 全ての画素に露出を掛けた後, ガンマ補正をする
+  // NOTE: 画素の配列を区間に分けて複数のスレッドで処理する.
+  // powは自動ベクトル化できる近似(相対誤差1e-6程度)を使う
+  void tonemap(float exposure, float gamma = 2.2f, unsigned int nThreads = 0) {
+    // NOTE: 書き込みとエイリアスしないように値でキャプチャする
+    const float invGamma = 1.0f / gamma;
+    float* data = pixels;
+    parallelFor(
+        0, 3 * width * height, 1 << 16,
+        [data, exposure, invGamma](size_t begin, size_t end) {
+          for (size_t k = begin; k < end; ++k) {
+            data[k] = fastPow(exposure * data[k], invGamma);
+          }
+        },
+        nThreads);
+  }
+
+  // 全ての画素をガンマ補正する
+  void gammaCorrection(float gamma = 2.2f, unsigned int nThreads = 0) {
+    tonemap(1.0f, gamma, nThreads);
+  }
+
+ private:
+  // sizeバイトのdataをfilenameに1回で書き込む
+  static void writeFile(const std::string& filename, const uint8_t* data,
+                        size_t size) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+      std::cerr << "failed to open " << filename << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+
+    file.write(reinterpret_cast<const char*>(data), size);
+    if (!file) {
+      std::cerr << "failed to write " << filename << std::endl;
+      std::exit(EXIT_FAILURE);
     }
   }
+
+  // x^y(x > 0)の近似. x <= 0の場合は0を返す
+  // 指数部と仮数部に分けて log2(x)とexp2(y * log2(x))を多項式で近似する
+  // NOTE: 浮動小数点数の比較で分岐させると自動ベクトル化されないので,
+  // 範囲の制限とx <= 0の場合の処理は整数の演算で行う
+  static float fastPow(float x, float y) {
+    // log2(x) = 指数部 + log2(仮数部)
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(float));
+    const float e = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+    const uint32_t mantissaBits = (bits & 0x007fffffu) | 0x3f800000u;
+    float m;
+    std::memcpy(&m, &mantissaBits, sizeof(float));
+    const float t = m - 1.0f;
+    const float log2m =
+        t * (1.44253478f +
+             t * (-0.718033587f +
+                  t * (0.457158104f +
+                       t * (-0.277341612f +
+                            t * (0.121472918f + t * -0.025792335f)))));
+
+    // exp2(z) = 2^整数部 * exp2(小数部)
+    const float z = y * (e + log2m);
+    int zi = static_cast<int>(z);
+    zi -= z < static_cast<float>(zi) ? 1 : 0;  // 負の場合も切り捨てる
+    const float f = z - static_cast<float>(zi);
+    zi = std::min(std::max(zi, -126), 127);
+    const float exp2Frac =
+        0.999999896f +
+        f * (0.69315462f +
+             f * (0.240140771f +
+                  f * (0.0558632803f +
+                       f * (0.00894621726f + f * 0.00189510628f))));
+    uint32_t retBits;
+    std::memcpy(&retBits, &exp2Frac, sizeof(float));
+    retBits += static_cast<uint32_t>(zi) << 23;
+    retBits &= 0u - static_cast<uint32_t>(x > 0.0f);  // x <= 0なら0にする
+    float ret;
+    std::memcpy(&ret, &retBits, sizeof(float));
+    return ret;
+  }
 };
 
 #endif
\ No newline at end of file
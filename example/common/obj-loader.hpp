@@ -0,0 +1,109 @@
+#ifndef _OBJ_LOADER_H
+#define _OBJ_LOADER_H
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "core/page-allocator.hpp"
+#include "core/polygon.hpp"
+#include "tiny_obj_loader.h"
+
+// objファイルから読み込んだメッシュ
+struct ObjMesh {
+  std::vector<float> vertices;              // 頂点座標の配列
+  std::vector<unsigned int> indices;        // verticesへのインデックス配列
+  std::vector<float> normals;               // 法線の配列
+  std::vector<float> uvs;                   // UV座標の配列
+  std::vector<unsigned int> normalIndices;  // normalsへのインデックス配列
+  std::vector<unsigned int> uvIndices;      // uvsへのインデックス配列
+  std::vector<int> geomIDs;                 // 面ごとのshapeのインデックス
+
+  // 配列を参照するPolygonを返す
+  // NOTE: 空の配列はnullptrとして渡す
+  Polygon polygon() {
+    const auto ptr = [](auto& v) { return v.empty() ? nullptr : v.data(); };
+    return Polygon(indices.size(), ptr(vertices), ptr(indices), ptr(normals),
+                   ptr(uvs), ptr(geomIDs), ptr(normalIndices),
+                   ptr(uvIndices));
+  }
+
+  // 全ての配列にメモリ配置の方針(Huge Page, NUMAノード)を適用する
+  void applyMemoryPolicy(int numaNode = NUMA_INTERLEAVE) const {
+    const auto apply = [&](const auto& v) {
+      ::applyMemoryPolicy(v.data(), sizeof(v[0]) * v.size(), numaNode);
+    };
+    apply(vertices);
+    apply(indices);
+    apply(normals);
+    apply(uvs);
+    apply(normalIndices);
+    apply(uvIndices);
+    apply(geomIDs);
+  }
+};
+
+inline bool loadObj(const std::string& filename, ObjMesh& mesh) {
+  tinyobj::ObjReader reader;
+
+  if (!reader.ParseFromFile(filename)) {
+    if (!reader.Error().empty()) {
+      std::cerr << reader.Error();
+    }
+    return false;
+  }
+
+  if (!reader.Warning().empty()) {
+    std::cout << reader.Warning();
+  }
+
+  const auto& attrib = reader.GetAttrib();
+  const auto& shapes = reader.GetShapes();
+
+  mesh.vertices = attrib.vertices;
+
+  // 全ての頂点が法線, UVを持つ場合のみ使用する
+  bool hasNormals = !attrib.normals.empty();
+  bool hasUVs = !attrib.texcoords.empty();
+  // インデックスがverticesへのインデックスと一致するか
+  bool sameNormalIndices = true;
+  bool sameUVIndices = true;
+
+  for (size_t s = 0; s < shapes.size(); ++s) {
+    for (const auto& idx : shapes[s].mesh.indices) {
+      mesh.indices.push_back(idx.vertex_index);
+      mesh.normalIndices.push_back(idx.normal_index);
+      mesh.uvIndices.push_back(idx.texcoord_index);
+
+      hasNormals &= idx.normal_index >= 0;
+      hasUVs &= idx.texcoord_index >= 0;
+      sameNormalIndices &= idx.normal_index == idx.vertex_index;
+      sameUVIndices &= idx.texcoord_index == idx.vertex_index;
+    }
+    mesh.geomIDs.insert(mesh.geomIDs.end(),
+                        shapes[s].mesh.indices.size() / 3, s);
+  }
+
+  if (hasNormals) {
+    mesh.normals = attrib.normals;
+  }
+  if (hasUVs) {
+    mesh.uvs = attrib.texcoords;
+  }
+
+  // verticesと同じインデックスで参照できる場合はインデックス配列を持たない
+  if (!hasNormals || sameNormalIndices) {
+    mesh.normalIndices.clear();
+  }
+  if (!hasUVs || sameUVIndices) {
+    mesh.uvIndices.clear();
+  }
+
+  // shapeが一つしかない場合はジオメトリIDを持たない
+  if (shapes.size() <= 1) {
+    mesh.geomIDs.clear();
+  }
+
+  return true;
+}
+
+#endif
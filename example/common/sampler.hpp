@@ -0,0 +1,264 @@
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+#include <cstddef>
+#include <cstdint>
+
+// サンプラー
+// ピクセル, サンプル番号, 次元の組から[0, 1)の値を返す.
+// 状態を持たないので, 同じ組からは呼ぶ順番やスレッドに関係なく同じ値になる
+//   RandomSampler: カウンタベースの乱数(Philox4x32-10)
+//   SobolSampler:  Owen scramblingをしたSobol列(4次元ごとに別の列を使う)
+//   HaltonSampler: Owen scramblingをしたHalton列
+// NOTE: RNGは呼ぶたびに状態を更新するので1つずつしか生成できないが,
+// サンプラーはgenerateSamplesで複数のピクセル(レイ)の分をまとめて生成できる
+
+// 32bitの値のハッシュ(MurmurHash3のfinalizer)
+inline uint32_t hashUint32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x85ebca6bu;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35u;
+  x ^= x >> 16;
+  return x;
+}
+
+// seedとvを混ぜたハッシュ
+inline uint32_t hashCombine(uint32_t seed, uint32_t v) {
+  return hashUint32(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// 32bitの値を[0, 1)のfloatに変換する
+// NOTE: 上位24bitだけを使うので1にはならない
+inline float uintToUnitFloat(uint32_t x) {
+  return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// カウンタベースの乱数生成器Philox4x32-10
+// counterとkeyから4つの32bitの乱数を返す
+// Salmon et al., Parallel Random Numbers: As Easy as 1, 2, 3, SC 2011
+// NOTE: 32bit * 32bit -> 64bitの乗算だけなので, ループが自動ベクトル化される
+struct Philox4x32 {
+  uint32_t values[4];
+
+  Philox4x32(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0,
+             uint32_t k1) {
+    for (int round = 0; round < 10; ++round) {
+      const uint64_t p0 = static_cast<uint64_t>(0xd2511f53u) * c0;
+      const uint64_t p1 = static_cast<uint64_t>(0xcd9e8d57u) * c2;
+      const uint32_t hi0 = static_cast<uint32_t>(p0 >> 32);
+      const uint32_t hi1 = static_cast<uint32_t>(p1 >> 32);
+      c0 = hi1 ^ c1 ^ k0;
+      c1 = static_cast<uint32_t>(p1);
+      c2 = hi0 ^ c3 ^ k1;
+      c3 = static_cast<uint32_t>(p0);
+      k0 += 0x9e3779b9u;
+      k1 += 0xbb67ae85u;
+    }
+    values[0] = c0;
+    values[1] = c1;
+    values[2] = c2;
+    values[3] = c3;
+  }
+};
+
+// カウンタベースの乱数によるサンプラー
+// keyを(seed, pixel), カウンタを(sampleIndex, dim)にしてPhiloxで生成する
+// NOTE: ピクセルごとに別の系列になるので, 隣のピクセルと相関しない
+class RandomSampler {
+ private:
+  uint32_t seed;
+
+ public:
+  explicit RandomSampler(uint32_t seed = 0) : seed(seed) {}
+
+  // ピクセルpixelのsampleIndex番目のサンプルのdim次元目の値を返す
+  float get(uint32_t pixel, uint32_t sampleIndex, uint32_t dim) const {
+    return uintToUnitFloat(
+        Philox4x32(sampleIndex, dim, 0, 0, seed, pixel).values[0]);
+  }
+};
+
+// SobolSamplerで使う4次元分のSobol列の生成行列(Joe, Kuoの方向数)
+struct SobolDirectionNumbers {
+  uint32_t v[4][32];
+
+  constexpr SobolDirectionNumbers() : v() {
+    // 各次元の原始多項式の次数, 係数, 最初の方向数
+    // 1次元目はvan der Corput列
+    constexpr uint32_t degrees[4] = {0, 1, 2, 3};
+    constexpr uint32_t coefficients[4] = {0, 0, 1, 1};
+    constexpr uint32_t initialNumbers[4][3] = {
+        {0, 0, 0}, {1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+    for (int k = 0; k < 32; ++k) {
+      v[0][k] = 1u << (31 - k);
+    }
+    for (int d = 1; d < 4; ++d) {
+      const uint32_t s = degrees[d];
+      for (uint32_t k = 0; k < 32; ++k) {
+        if (k < s) {
+          v[d][k] = initialNumbers[d][k] << (31 - k);
+          continue;
+        }
+        v[d][k] = v[d][k - s] ^ (v[d][k - s] >> s);
+        for (uint32_t j = 1; j < s; ++j) {
+          if ((coefficients[d] >> (s - 1 - j)) & 1) {
+            v[d][k] ^= v[d][k - j];
+          }
+        }
+      }
+    }
+  }
+};
+
+inline constexpr SobolDirectionNumbers SOBOL_DIRECTIONS{};
+
+// Owen scramblingをしたSobol列によるサンプラー
+// 4次元のSobol列をピクセルごとに別のシードでscramblingし, サンプル番号も
+// scramblingで並べ替える. 5次元目以降は4次元ごとに別のシードを使う
+// Burley, Practical Hash-based Owen Scrambling, JCGT 2020
+// NOTE: 2のべき乗のサンプル数で誤差が最も小さくなる
+class SobolSampler {
+ private:
+  uint32_t seed;
+
+  // ビットの並びを逆にする
+  static uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+  }
+
+  // 各ビットを, それより上位のビットで決まるかどうかで反転する
+  // (Owen scrambling). ビットを逆にして, 下位のビットが上位のビットに
+  // 影響しないハッシュ(Laine-Karras permutation)をかける
+  static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+  }
+
+  // index番目の点のdim(< 4)次元目の上位24bit(floatに変換する分)
+  // NOTE: indexのkビット目は結果の(31 - k)ビット目以下にしか影響しないので,
+  // 下位24bitだけを使う. scramblingしたindexは上位のビットも立っているので,
+  // 分岐せずに全てのビットについて計算する
+  static uint32_t sobol(uint32_t index, uint32_t dim) {
+    uint32_t x = 0;
+    for (int k = 0; k < 24; ++k) {
+      x ^= SOBOL_DIRECTIONS.v[dim][k] & (0u - ((index >> k) & 1));
+    }
+    return x;
+  }
+
+ public:
+  explicit SobolSampler(uint32_t seed = 0) : seed(seed) {}
+
+  // ピクセルpixelのsampleIndex番目のサンプルのdim次元目の値を返す
+  float get(uint32_t pixel, uint32_t sampleIndex, uint32_t dim) const {
+    // 4次元ごとのシード
+    const uint32_t groupSeed = hashCombine(hashCombine(seed, pixel), dim / 4);
+    const uint32_t index = nestedUniformScramble(sampleIndex, groupSeed);
+    return uintToUnitFloat(nestedUniformScramble(
+        sobol(index, dim % 4), hashCombine(groupSeed, dim % 4)));
+  }
+};
+
+// Owen scramblingをしたHalton列によるサンプラー
+// dim次元目は(dim + 1)番目の素数を基数とする radical inverseで, 各桁を
+// それより上の桁とシードで決まる量だけずらす. 素数表を超える次元は乱数にする
+// NOTE: 基数が大きい次元ほど一様になるのに多くのサンプルが必要になる
+class HaltonSampler {
+ public:
+  // Halton列を使う次元の数
+  static constexpr uint32_t N_DIMENSIONS = 32;
+
+ private:
+  uint32_t seed;
+  RandomSampler fallback;  // N_DIMENSIONS以降の次元に使う
+
+  static constexpr uint32_t PRIMES[N_DIMENSIONS] = {
+      2,  3,  5,  7,  11, 13, 17, 19, 23,  29,  31,  37,  41,  43,  47,  53,
+      59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131};
+
+  // baseを基数とするindexのradical inverse. 各桁をハッシュでずらす
+  static float scrambledRadicalInverse(uint32_t base, uint32_t index,
+                                       uint32_t hash) {
+    uint64_t baseN = 1;           // base^(処理した桁数)
+    uint64_t reversedDigits = 0;  // ずらした後の上位の桁
+    // floatの精度(24bit)がなくなるまで, indexの桁がなくなった後の0の桁もずらす
+    while (baseN < (1u << 24)) {
+      const uint32_t next = index / base;
+      uint32_t digit = index - next * base;
+      // 上位の桁が同じでも桁数が違う場合は別のずらし方になるように,
+      // 先頭に1を付けた値をハッシュにする
+      const uint32_t digitHash =
+          hashUint32(hash ^ static_cast<uint32_t>(baseN + reversedDigits));
+      digit = (digit + digitHash % base) % base;
+      reversedDigits = reversedDigits * base + digit;
+      baseN *= base;
+      index = next;
+    }
+    const float ret =
+        static_cast<float>(reversedDigits) / static_cast<float>(baseN);
+    return ret < 1.0f ? ret : 0x1.fffffep-1f;
+  }
+
+ public:
+  explicit HaltonSampler(uint32_t seed = 0) : seed(seed), fallback(seed) {}
+
+  // ピクセルpixelのsampleIndex番目のサンプルのdim次元目の値を返す
+  float get(uint32_t pixel, uint32_t sampleIndex, uint32_t dim) const {
+    if (dim >= N_DIMENSIONS) {
+      return fallback.get(pixel, sampleIndex, dim);
+    }
+    return scrambledRadicalInverse(
+        PRIMES[dim], sampleIndex,
+        hashCombine(hashCombine(seed, pixel), dim));
+  }
+};
+
+// n個のピクセルpixels[k]のsampleIndex番目のサンプルのdim次元目の値を
+// まとめてout[k]に書き込む(パケットのレイ生成などに使う)
+// NOTE: RandomSamplerの場合はループが自動ベクトル化される
+template <typename Sampler>
+void generateSamples(const Sampler& sampler, const uint32_t* pixels, size_t n,
+                     uint32_t sampleIndex, uint32_t dim, float* out) {
+  for (size_t k = 0; k < n; ++k) {
+    out[k] = sampler.get(pixels[k], sampleIndex, dim);
+  }
+}
+
+// 1つのピクセルの1つのサンプルについて, 次元を順に進めながら値を返す
+// RNGのgetNextと同じように使える
+// NOTE: get2Dは2次元の組が同じSobol列の組になるように偶数の次元から始める
+template <typename Sampler>
+class PixelSampler {
+ private:
+  const Sampler& sampler;
+  uint32_t pixel;
+  uint32_t sampleIndex;
+  uint32_t dim;  // 次に使う次元
+
+ public:
+  // dimは最初に使う次元(generateSamplesで先に使った次元を飛ばす場合など)
+  PixelSampler(const Sampler& sampler, uint32_t pixel, uint32_t sampleIndex,
+               uint32_t dim = 0)
+      : sampler(sampler), pixel(pixel), sampleIndex(sampleIndex), dim(dim) {}
+
+  // 1次元の値を返す
+  float getNext() { return sampler.get(pixel, sampleIndex, dim++); }
+
+  // 2次元の値を返す
+  void get2D(float& u, float& v) {
+    dim += dim & 1;
+    u = getNext();
+    v = getNext();
+  }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef _SAMPLING_H
+#define _SAMPLING_H
+#include <algorithm>
+#include <cmath>
+
+#include "core/vec3.hpp"
+
+constexpr float PI = 3.14159265359f;
+constexpr float INV_PI = 1.0f / PI;
+
+// 接空間の基底(lx, ly, lz)で表したベクトルvをワールド座標に変換する
+inline Vec3 localToWorld(const Vec3& v, const Vec3& lx, const Vec3& ly,
+                         const Vec3& lz) {
+  return Vec3(v[0] * lx[0] + v[1] * ly[0] + v[2] * lz[0],
+              v[0] * lx[1] + v[1] * ly[1] + v[2] * lz[1],
+              v[0] * lx[2] + v[1] * ly[2] + v[2] * lz[2]);
+}
+
+// 法線nに直交する2つの単位ベクトルt, bを求める
+inline void tangentSpaceBasis(const Vec3& n, Vec3& t, Vec3& b) {
+  if (std::abs(n[1]) < 0.9f) {
+    t = normalize(cross(n, Vec3(0, 1, 0)));
+  } else {
+    t = normalize(cross(n, Vec3(0, 0, -1)));
+  }
+  b = normalize(cross(t, n));
+}
+
+// [0, 1)の乱数u, vから, y軸を法線とする半球上の方向をcosθに比例する確率で
+// サンプリングし, その確率密度をpdfにセットする
+inline Vec3 sampleCosineHemisphere(float u, float v, float& pdf) {
+  const float theta =
+      0.5f * std::acos(std::clamp(1.0f - 2.0f * u, -1.0f, 1.0f));
+  const float phi = 2.0f * PI * v;
+
+  const float cosTheta = std::cos(theta);
+  pdf = cosTheta * INV_PI;
+  return Vec3(std::cos(phi) * std::sin(theta), cosTheta,
+              std::sin(phi) * std::sin(theta));
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <chrono>
+#include <string>
+
+#include "io/binary-mesh.hpp"
+#include "obj-loader.hpp"
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " input.obj output.bmesh"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string inputFilename = argv[1];
+  const std::string outputFilename = argv[2];
+
+  ObjMesh objMesh;
+
+  // objファイルの読み込み
+  auto startTime = std::chrono::system_clock::now();
+  if (!loadObj(inputFilename, objMesh)) {
+    std::exit(EXIT_FAILURE);
+  }
+  std::cout << "obj loading: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now() - startTime)
+                   .count()
+            << "ms" << std::endl;
+  std::cout << "vertices: " << objMesh.vertices.size() / 3 << std::endl;
+  std::cout << "faces: " << objMesh.indices.size() / 3 << std::endl;
+
+  // バイナリメッシュの書き出し
+  if (!writeBinaryMesh(outputFilename, objMesh.vertices, objMesh.indices,
+                       objMesh.normals, objMesh.uvs, objMesh.normalIndices,
+                       objMesh.uvIndices, objMesh.geomIDs)) {
+    std::exit(EXIT_FAILURE);
+  }
+
+  // 書き出したファイルを読み込んで確認する
+  startTime = std::chrono::system_clock::now();
+  BinaryMesh mesh;
+  if (!mesh.load(outputFilename)) {
+    std::exit(EXIT_FAILURE);
+  }
+  const Polygon polygon = mesh.polygon();
+  std::cout << "binary mesh loading: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now() - startTime)
+                   .count()
+            << "μs" << std::endl;
+
+  if (polygon.nFaces() != objMesh.indices.size() / 3 ||
+      mesh.nVertices() != objMesh.vertices.size() / 3) {
+    std::cerr << "failed to verify " << outputFilename << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  return 0;
+}
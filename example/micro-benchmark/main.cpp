@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "core/perf-counters.hpp"
+#include "rng.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
+
+// 各カーネルに渡す入力の数
+constexpr size_t N_INPUTS = 1 << 16;
+// 入力全体を処理する回数(1回の計測あたり)
+constexpr int N_ITERATIONS = 64;
+// 計測の回数. 最も速かったものを結果とする
+constexpr int N_TRIALS = 5;
+
+// 経過時間をナノ秒で返す
+double elapsedNanoseconds(
+    const std::chrono::steady_clock::time_point& startTime) {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+// 最適化で計算が消されないように, 結果をまとめる値
+// NOTE: 同じ入力なら同じ値になるので, 実装を変えた時の確認にも使える
+struct Checksum {
+  double value{0};
+
+  void add(float v) { value += v; }
+  void add(bool v) { value += v ? 1.0 : 0.0; }
+  void add(const Vec3& v) { value += v[0] + v[1] + v[2]; }
+  void add(const AABB& bbox) {
+    add(bbox.bounds[0]);
+    add(bbox.bounds[1]);
+  }
+};
+
+// kernel(i, checksum)をi = 0, ..., N_INPUTS - 1について呼ぶ時間を計測し,
+// 1回あたりの時間を表の1行として表示する
+template <typename Kernel>
+void benchmark(const std::string& name, PerfProfiler& profiler,
+               const Kernel& kernel) {
+  double bestTime = std::numeric_limits<double>::max();
+  Checksum checksum;
+  for (int trial = 0; trial < N_TRIALS; ++trial) {
+    const PerfProfiler::Phase phase(profiler, name);
+    checksum = Checksum();
+    const auto startTime = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < N_ITERATIONS; ++iteration) {
+      for (size_t i = 0; i < N_INPUTS; ++i) {
+        kernel(i, checksum);
+      }
+    }
+    bestTime = std::min(bestTime, elapsedNanoseconds(startTime));
+  }
+
+  const double nsPerOp = bestTime / (N_INPUTS * N_ITERATIONS);
+  std::cout << "|" << name << "|" << std::fixed << std::setprecision(3)
+            << nsPerOp << "|" << std::setprecision(1) << 1e3 / nsPerOp << "|"
+            << std::defaultfloat << std::setprecision(10) << checksum.value
+            << "|" << std::endl;
+}
+
+int main() {
+  // 入力は固定のシードで生成するので, 毎回同じになる
+  RNG rng(1);
+  const auto random = [&](float min, float max) {
+    return min + (max - min) * rng.getNext();
+  };
+  const auto randomVec3 = [&](float min, float max) {
+    return Vec3(random(min, max), random(min, max), random(min, max));
+  };
+
+  // [-1, 1]^3の中のレイ
+  std::vector<Ray> rays;
+  std::vector<PrecomputedRay> rayData;
+  rays.reserve(N_INPUTS);
+  rayData.reserve(N_INPUTS);
+  for (size_t i = 0; i < N_INPUTS; ++i) {
+    rays.emplace_back(randomVec3(-1.0f, 1.0f),
+                      normalize(randomVec3(-1.0f, 1.0f)));
+    rayData.emplace_back(rays.back());
+  }
+
+  // [-1, 1]^3の中の大きさ0.5までのAABB
+  std::vector<AABB> boxes;
+  boxes.reserve(N_INPUTS);
+  for (size_t i = 0; i < N_INPUTS; ++i) {
+    const Vec3 pMin = randomVec3(-1.0f, 1.0f);
+    boxes.emplace_back(pMin, pMin + randomVec3(0.0f, 0.5f));
+  }
+
+  // [-1, 1]^3の中の三角形
+  std::vector<float> vertices;
+  std::vector<unsigned int> indices;
+  vertices.reserve(9 * N_INPUTS);
+  indices.reserve(3 * N_INPUTS);
+  for (size_t i = 0; i < 3 * N_INPUTS; ++i) {
+    const Vec3 v = randomVec3(-1.0f, 1.0f);
+    vertices.insert(vertices.end(), {v[0], v[1], v[2]});
+    indices.push_back(i);
+  }
+  const Polygon polygon(indices.size(), vertices.data(), indices.data());
+
+  // sampleCosineHemisphereに渡す乱数
+  std::vector<float> samples(2 * N_INPUTS);
+  for (float& sample : samples) {
+    sample = rng.getNext();
+  }
+
+  std::cout << "inputs: " << N_INPUTS << ", iterations: " << N_ITERATIONS
+            << ", trials: " << N_TRIALS << std::endl;
+  std::cout << "|Kernel|ns/op|Mop/s|Checksum|" << std::endl;
+  std::cout << "|:--|--:|--:|--:|" << std::endl;
+
+  PerfProfiler profiler;
+
+  benchmark("AABB::intersect", profiler, [&](size_t i, Checksum& checksum) {
+    checksum.add(boxes[i].intersect(rays[i], rayData[i]));
+  });
+
+  benchmark("mergeAABB", profiler, [&](size_t i, Checksum& checksum) {
+    checksum.add(mergeAABB(boxes[i], boxes[(i + 1) % N_INPUTS]));
+  });
+
+  benchmark("Triangle::intersect", profiler,
+            [&](size_t i, Checksum& checksum) {
+              IntersectInfo info;
+              checksum.add(Triangle(&polygon, i).intersect(rays[i], info));
+            });
+
+  benchmark("Triangle::calcAABB", profiler,
+            [&](size_t i, Checksum& checksum) {
+              checksum.add(Triangle(&polygon, i).calcAABB());
+            });
+
+  RNG benchmarkRNG(1);
+  benchmark("RNG::getNext", profiler, [&](size_t, Checksum& checksum) {
+    checksum.add(benchmarkRNG.getNext());
+  });
+
+  // ピクセルiの0番目のサンプルの次元(i % 8)
+  const RandomSampler randomSampler(1);
+  benchmark("RandomSampler::get", profiler, [&](size_t i, Checksum& checksum) {
+    checksum.add(randomSampler.get(i, 0, i % 8));
+  });
+
+  const SobolSampler sobolSampler(1);
+  benchmark("SobolSampler::get", profiler, [&](size_t i, Checksum& checksum) {
+    checksum.add(sobolSampler.get(i, 0, i % 8));
+  });
+
+  const HaltonSampler haltonSampler(1);
+  benchmark("HaltonSampler::get", profiler, [&](size_t i, Checksum& checksum) {
+    checksum.add(haltonSampler.get(i, 0, i % 8));
+  });
+
+  // 256ピクセル分ずつまとめて生成する
+  constexpr size_t BATCH_SIZE = 256;
+  std::vector<uint32_t> pixels(N_INPUTS);
+  std::iota(pixels.begin(), pixels.end(), 0);
+  std::vector<float> batchSamples(N_INPUTS);
+  benchmark("generateSamples(RandomSampler)", profiler,
+            [&](size_t i, Checksum& checksum) {
+              if (i % BATCH_SIZE == 0) {
+                generateSamples(randomSampler, &pixels[i], BATCH_SIZE, 0, 0,
+                                &batchSamples[i]);
+              }
+              checksum.add(batchSamples[i]);
+            });
+
+  // IMAGE_SIZE x IMAGE_SIZEの画像の各ピクセルのカメラレイ
+  // 薄レンズの場合はsamplesをレンズ上の位置に使う
+  constexpr int IMAGE_SIZE = 512;
+  Camera pinholeCamera(Vec3(0, 1, 2), Vec3(0, 0, -1));
+  Camera thinLensCamera(Vec3(0, 1, 2), Vec3(0, 0, -1));
+  thinLensCamera.setThinLens(0.1f, 2.0f);
+  for (const Camera* camera : {&pinholeCamera, &thinLensCamera}) {
+    const bool thinLens = camera == &thinLensCamera;
+    const std::string suffix = thinLens ? "(thin lens)" : "";
+    benchmark("Camera::sampleRay" + suffix, profiler,
+              [&](size_t i, Checksum& checksum) {
+                const int x = i % IMAGE_SIZE;
+                const int y = (i / IMAGE_SIZE) % IMAGE_SIZE;
+                const float u = (2.0f * x - IMAGE_SIZE) / IMAGE_SIZE;
+                const float v = (2.0f * y - IMAGE_SIZE) / IMAGE_SIZE;
+                const Ray ray =
+                    camera->sampleRay(u, v, samples[2 * x], samples[2 * x + 1]);
+                checksum.add(ray.origin);
+                checksum.add(ray.direction);
+              });
+
+    // 1行分ずつまとめて生成する
+    std::vector<float> lens[2];
+    for (int x = 0; x < IMAGE_SIZE; ++x) {
+      lens[0].push_back(samples[2 * x]);
+      lens[1].push_back(samples[2 * x + 1]);
+    }
+    const float* const lensData[2] = {lens[0].data(), lens[1].data()};
+    RayBuffer rays;
+    benchmark("Camera::generateRays" + suffix, profiler,
+              [&](size_t i, Checksum& checksum) {
+                const int x = i % IMAGE_SIZE;
+                if (x == 0) {
+                  const int y = (i / IMAGE_SIZE) % IMAGE_SIZE;
+                  camera->generateRays(IMAGE_SIZE, IMAGE_SIZE, 0, y,
+                                       IMAGE_SIZE, 1, rays, nullptr,
+                                       lensData);
+                }
+                const Ray ray = rays.ray(x);
+                checksum.add(ray.origin);
+                checksum.add(ray.direction);
+              });
+  }
+
+  benchmark("sampleCosineHemisphere", profiler,
+            [&](size_t i, Checksum& checksum) {
+              float pdf;
+              checksum.add(sampleCosineHemisphere(samples[2 * i],
+                                                  samples[2 * i + 1], pdf));
+              checksum.add(pdf);
+            });
+
+  profiler.report(std::cout);
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "image.hpp"
+#include "obj-loader.hpp"
+#include "rng.hpp"
+
+// 経過時間をミリ秒で返す
+double elapsedMilliseconds(
+    const std::chrono::steady_clock::time_point& startTime) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+// 高さheightにある, 中心が原点で半径radiusの水平な円板の集合を作る
+// ユーザー定義のPrimitiveの例
+UserPrimitives makeDisk(float height, float radius) {
+  return UserPrimitives(
+      1,
+      [=](uint32_t) {
+        return AABB(Vec3(-radius, height, -radius),
+                    Vec3(radius, height, radius));
+      },
+      [=](uint32_t prim, const Ray& ray, IntersectInfo& info) {
+        if (ray.direction[1] == 0.0f) return false;
+        const float t = (height - ray.origin[1]) / ray.direction[1];
+        if (t < ray.tmin || t > ray.tmax) return false;
+        const Vec3 p = ray(t);
+        if (p[0] * p[0] + p[2] * p[2] > radius * radius) return false;
+
+        info.t = t;
+        info.barycentric[0] = 0.0f;
+        info.barycentric[1] = 0.0f;
+        info.primID = prim;
+        return true;
+      },
+      [=](const Ray& ray, IntersectInfo& info) {
+        info.hitPos = ray(info.t);
+        info.hitNormal = Vec3(0, 1, 0);
+        info.geomNormal = info.hitNormal;
+        info.uv[0] = 0.5f + 0.5f * info.hitPos[0] / radius;
+        info.uv[1] = 0.5f + 0.5f * info.hitPos[2] / radius;
+        info.geomID = 0;
+      });
+}
+
+int main() {
+  const std::string filename = "bunny.obj";
+  const int width = 512;
+  const int height = 512;
+  const int nSpheres = 10000;
+  const Vec3 camPos(0, 1, 2);
+  const Vec3 camForward(0, 0, -1);
+
+  ObjMesh mesh;
+
+  if (!loadObj(filename, mesh)) {
+    std::exit(EXIT_FAILURE);
+  }
+
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
+  std::cout << "faces: " << polygon->nFaces() << std::endl;
+
+  // メッシュのAABBの中にランダムに球(パーティクル)を置く
+  OptimizedBVH meshBVH(*polygon);
+  meshBVH.buildBVH();
+  const AABB meshAABB = meshBVH.rootAABB();
+  const Vec3 extent = meshAABB.bounds[1] - meshAABB.bounds[0];
+
+  RNG rng;
+  std::vector<float> centers(3 * nSpheres);
+  std::vector<float> radii(nSpheres);
+  for (int i = 0; i < nSpheres; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      centers[3 * i + axis] = meshAABB.bounds[0][axis] +
+                              (2.0f * rng.getNext() - 0.5f) * extent[axis];
+    }
+    radii[i] = 0.003f + 0.007f * rng.getNext();
+  }
+  std::cout << "spheres: " << nSpheres << std::endl;
+
+  // 三角形, 球, 床の円板を1つのBVHにまとめる
+  using Primitives =
+      CompositePrimitives<TrianglePrimitives, SpherePrimitives, UserPrimitives>;
+  const Primitives primitives(
+      TrianglePrimitives(*polygon),
+      SpherePrimitives(nSpheres, centers.data(), radii.data()),
+      makeDisk(meshAABB.bounds[0][1], 2.0f * length(extent)));
+
+  const auto startTime = std::chrono::steady_clock::now();
+  GenericBVH<Primitives> bvh(primitives);
+  bvh.buildBVH();
+  std::cout << "build: " << elapsedMilliseconds(startTime) << "ms"
+            << std::endl;
+  std::cout << "nodes: " << bvh.nNodes() << std::endl;
+  std::cout << "bbox: " << bvh.rootAABB() << std::endl;
+
+  Image img(width, height);
+  Camera camera(camPos, camForward);
+
+  const auto renderStartTime = std::chrono::steady_clock::now();
+  for (int j = 0; j < height; ++j) {
+    for (int i = 0; i < width; ++i) {
+      const float u = (2.0f * i - width) / height;
+      const float v = (2.0f * j - height) / height;
+      const Ray ray = camera.sampleRay(u, v);
+
+      IntersectInfo info;
+      if (bvh.intersect(ray, info)) {
+        img.setPixel(i, j, 0.5f * (info.hitNormal + Vec3(1.0f)));
+      } else {
+        img.setPixel(i, j, Vec3(0));
+      }
+    }
+  }
+  std::cout << "render: " << elapsedMilliseconds(renderStartTime) << "ms"
+            << std::endl;
+
+  img.writePPM("output.ppm");
+
+  return 0;
+}
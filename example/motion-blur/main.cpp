@@ -0,0 +1,127 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "image.hpp"
+#include "obj-loader.hpp"
+#include "rng.hpp"
+
+// 経過時間をミリ秒で返す
+double elapsedMilliseconds(
+    const std::chrono::steady_clock::time_point& startTime) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+// 頂点座標をy軸周りに回転させながらx軸方向に移動させたキーフレームを作る
+// 返り値はnKeyframes個のキーフレームの頂点座標を並べた配列
+std::vector<float> makeKeyframes(const std::vector<float>& vertices,
+                                 unsigned int nKeyframes, float maxAngle,
+                                 float maxOffset) {
+  std::vector<float> ret;
+  ret.reserve(nKeyframes * vertices.size());
+  for (unsigned int k = 0; k < nKeyframes; ++k) {
+    const float time = nKeyframes > 1 ? float(k) / (nKeyframes - 1) : 0.0f;
+    const float c = std::cos(maxAngle * time);
+    const float s = std::sin(maxAngle * time);
+    for (size_t i = 0; i < vertices.size(); i += 3) {
+      const float x = vertices[i];
+      const float z = vertices[i + 2];
+      ret.push_back(c * x + s * z + maxOffset * time);
+      ret.push_back(vertices[i + 1]);
+      ret.push_back(-s * x + c * z);
+    }
+  }
+  return ret;
+}
+
+// 各画素でランダムな時刻のレイを飛ばし, 法線を平均した画像を描画する
+// NOTE: 乱数のシードが同じなので, MotionBoundsが違っても同じ画像になる
+template <typename BVH>
+void render(const std::string& name, const BVH& bvh, const Camera& camera,
+            int width, int height, int nSamples, Image& img) {
+  RNG rng;
+
+  const auto startTime = std::chrono::steady_clock::now();
+  for (int j = 0; j < height; ++j) {
+    for (int i = 0; i < width; ++i) {
+      Vec3 color(0);
+      for (int k = 0; k < nSamples; ++k) {
+        const float u = (2.0f * (i + rng.getNext()) - width) / height;
+        const float v = (2.0f * (j + rng.getNext()) - height) / height;
+        Ray ray = camera.sampleRay(u, v);
+        ray.time = rng.getNext();
+
+        IntersectInfo info;
+        if (bvh.intersect(ray, info)) {
+          color += 0.5f * (info.hitNormal + Vec3(1.0f));
+        }
+      }
+      img.setPixel(i, j, color / float(nSamples));
+    }
+  }
+  std::cout << name << ": " << elapsedMilliseconds(startTime) << "ms"
+            << std::endl;
+}
+
+int main() {
+  const std::string filename = "bunny.obj";
+  const int width = 512;
+  const int height = 512;
+  const int nSamples = 16;
+  const Vec3 camPos(0, 1, 2);
+  const Vec3 camForward(0, 0, -1);
+
+  // キーフレームの数と, 時刻1での回転角度と移動量
+  const unsigned int nKeyframes = 3;
+  const float maxAngle = 0.5f;
+  const float maxOffset = 0.3f;
+
+  ObjMesh mesh;
+
+  if (!loadObj(filename, mesh)) {
+    std::exit(EXIT_FAILURE);
+  }
+
+  // 頂点座標をキーフレームを並べたものに置き換える
+  const size_t stride = mesh.vertices.size();
+  mesh.vertices = makeKeyframes(mesh.vertices, nKeyframes, maxAngle, maxOffset);
+
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
+  polygon->setKeyframes(nKeyframes, stride);
+  std::cout << "vertices: " << polygon->nVertices << std::endl;
+  std::cout << "faces: " << polygon->nFaces() << std::endl;
+  std::cout << "keyframes: " << polygon->nKeyframes << std::endl;
+
+  Camera camera(camPos, camForward);
+  Image img(width, height);
+
+  // キーフレームごとのAABBを補間する場合と全時刻を含むAABBの場合を比較する
+  for (const auto motionBounds : {MotionBVH::MotionBounds::INTERPOLATED,
+                                  MotionBVH::MotionBounds::UNION}) {
+    const std::string name =
+        motionBounds == MotionBVH::MotionBounds::INTERPOLATED ? "interpolated"
+                                                              : "union";
+
+    const auto startTime = std::chrono::steady_clock::now();
+    MotionBVH bvh(*polygon, motionBounds);
+    bvh.buildBVH();
+    std::cout << name << " build: " << elapsedMilliseconds(startTime) << "ms"
+              << std::endl;
+    std::cout << name << " nodes: " << bvh.nNodes() << std::endl;
+    std::cout << name << " memory: " << bvh.memoryUsage() / 1024 << "KB"
+              << std::endl;
+
+    render(name + " render", bvh, camera, width, height, nSamples, img);
+  }
+
+  img.writePPM("output.ppm");
+
+  return 0;
+}
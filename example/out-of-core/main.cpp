@@ -0,0 +1,194 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "bvh/out-of-core-bvh.hpp"
+#include "obj-loader.hpp"
+#include "rng.hpp"
+
+// 経過時間をミリ秒で返す
+double elapsedMilliseconds(
+    const std::chrono::steady_clock::time_point& startTime) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+// SoA形式のレイと交差結果
+struct Rays {
+  std::vector<float> origins[3];
+  std::vector<float> directions[3];
+  std::vector<float> t;
+  std::vector<int> primID;
+
+  explicit Rays(const std::vector<Ray>& rays) {
+    for (int axis = 0; axis < 3; ++axis) {
+      origins[axis].resize(rays.size());
+      directions[axis].resize(rays.size());
+      for (size_t i = 0; i < rays.size(); ++i) {
+        origins[axis][i] = rays[i].origin[axis];
+        directions[axis][i] = rays[i].direction[axis];
+      }
+    }
+    t.resize(rays.size());
+    primID.resize(rays.size());
+  }
+
+  RayBatch batch() const {
+    RayBatch ret;
+    ret.size = t.size();
+    for (int axis = 0; axis < 3; ++axis) {
+      ret.origin[axis] = origins[axis].data();
+      ret.direction[axis] = directions[axis].data();
+    }
+    return ret;
+  }
+
+  HitBatch hits() {
+    HitBatch ret;
+    ret.t = t.data();
+    ret.primID = primID.data();
+    return ret;
+  }
+};
+
+// 交差の有無かtが基準と異なるレイの数を返す
+size_t countMismatches(const Rays& result, const Rays& reference) {
+  size_t ret = 0;
+  for (size_t i = 0; i < result.t.size(); ++i) {
+    if ((result.primID[i] >= 0) != (reference.primID[i] >= 0) ||
+        (result.primID[i] >= 0 && result.t[i] != reference.t[i])) {
+      ret++;
+    }
+  }
+  return ret;
+}
+
+// 読み込みの統計情報を表示する
+void printChunkStatistics(const OutOfCoreBVH& bvh) {
+  std::cout << "  chunk loads: " << bvh.nChunkLoads()
+            << ", evictions: " << bvh.nChunkEvictions()
+            << ", peak resident: " << bvh.peakResidentBytes() / 1024 << "KB"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  const std::string filename = argc > 1 ? argv[1] : "dragon.obj";
+  const std::string bvhFilename = argc > 2 ? argv[2] : "dragon.oocbvh";
+  const int nRays = 1000000;
+  const uint32_t maxChunkFaces = 16384;
+
+  ObjMesh mesh;
+
+  if (!loadObj(filename, mesh)) {
+    std::exit(EXIT_FAILURE);
+  }
+
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
+  std::cout << "vertices: " << polygon->nVertices << std::endl;
+  std::cout << "faces: " << polygon->nFaces() << std::endl;
+
+  // チャンクに分けたBVHを書き出す
+  auto startTime = std::chrono::steady_clock::now();
+  if (!writeOutOfCoreBVH(bvhFilename, *polygon, maxChunkFaces)) {
+    std::exit(EXIT_FAILURE);
+  }
+  std::cout << "write: " << elapsedMilliseconds(startTime) << "ms"
+            << std::endl;
+
+  // 基準にするメモリ上のBVH
+  OptimizedBVH reference(*polygon);
+  reference.buildBVH();
+  const AABB bbox = reference.rootAABB();
+  const Vec3 center = bbox.center();
+  const float radius = length(bbox.bounds[1] - bbox.bounds[0]);
+
+  // バウンディングボックスの外側から中心付近に向かうレイを生成する
+  RNG rng;
+  std::vector<Ray> rays;
+  rays.reserve(nRays);
+  for (int i = 0; i < nRays; ++i) {
+    const Vec3 origin =
+        center + radius * normalize(Vec3(rng.getNext() - 0.5f,
+                                         rng.getNext() - 0.5f,
+                                         rng.getNext() - 0.5f));
+    const Vec3 target =
+        center + 0.5f * (bbox.bounds[1] - bbox.bounds[0]) *
+                     Vec3(rng.getNext() - 0.5f, rng.getNext() - 0.5f,
+                          rng.getNext() - 0.5f);
+    rays.emplace_back(origin, normalize(target - origin));
+  }
+
+  Rays referenceResult(rays);
+  HitBatch referenceHits = referenceResult.hits();
+  startTime = std::chrono::steady_clock::now();
+  reference.intersect(referenceResult.batch(), referenceHits);
+  std::cout << "OptimizedBVH (batch)" << std::endl;
+  std::cout << "  trace: " << elapsedMilliseconds(startTime) << "ms"
+            << std::endl;
+
+  // チャンクの合計の1/8までしかマップしない場合と, 上限が無い場合
+  uint64_t totalChunkBytes;
+  {
+    OutOfCoreBVH bvh;
+    if (!bvh.load(bvhFilename)) {
+      std::exit(EXIT_FAILURE);
+    }
+    totalChunkBytes = bvh.totalChunkBytes();
+    std::cout << "top nodes: " << bvh.nTopNodes() << std::endl;
+    std::cout << "chunks: " << bvh.nChunks() << " ("
+              << totalChunkBytes / 1024 << "KB)" << std::endl;
+  }
+  for (const uint64_t maxResidentBytes :
+       {std::numeric_limits<uint64_t>::max(), totalChunkBytes / 8}) {
+    const std::string budget =
+        maxResidentBytes == std::numeric_limits<uint64_t>::max()
+            ? "unlimited"
+            : std::to_string(maxResidentBytes / 1024) + "KB";
+
+    // レイをチャンクごとのキューに入れてまとめてtraverseする
+    {
+      OutOfCoreBVH bvh;
+      if (!bvh.load(bvhFilename, maxResidentBytes)) {
+        std::exit(EXIT_FAILURE);
+      }
+      Rays result(rays);
+      HitBatch hits = result.hits();
+      startTime = std::chrono::steady_clock::now();
+      bvh.intersect(result.batch(), hits);
+      std::cout << "OutOfCoreBVH (batch, " << budget << ")" << std::endl;
+      std::cout << "  trace: " << elapsedMilliseconds(startTime) << "ms ("
+                << countMismatches(result, referenceResult)
+                << " mismatches)" << std::endl;
+      printChunkStatistics(bvh);
+    }
+
+    // 1本ずつtraverseする
+    {
+      OutOfCoreBVH bvh;
+      if (!bvh.load(bvhFilename, maxResidentBytes)) {
+        std::exit(EXIT_FAILURE);
+      }
+      Rays result(rays);
+      startTime = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < rays.size(); ++i) {
+        IntersectInfo info;
+        const bool hit = bvh.intersect(rays[i], info);
+        result.primID[i] = hit ? info.primID : -1;
+        if (hit) result.t[i] = info.t;
+      }
+      std::cout << "OutOfCoreBVH (single ray, " << budget << ")"
+                << std::endl;
+      std::cout << "  trace: " << elapsedMilliseconds(startTime) << "ms ("
+                << countMismatches(result, referenceResult)
+                << " mismatches)" << std::endl;
+      printChunkStatistics(bvh);
+    }
+  }
+
+  return 0;
+}
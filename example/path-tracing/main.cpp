@@ -3,45 +3,21 @@
 
 #include <chrono>
 #include <memory>
+#include <numeric>
 #include <string>
+#include <vector>
 
 #include "bvh.hpp"
 #include "camera.hpp"
+#include "core/perf-counters.hpp"
 #include "image.hpp"
-#include "rng.hpp"
-#include "tiny_obj_loader.h"
+#include "obj-loader.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
 
-constexpr float PI = 3.14159265359f;
-constexpr float INV_PI = 1.0f / PI;
-
-Vec3 localToWorld(const Vec3& v, const Vec3& lx, const Vec3& ly,
-                  const Vec3& lz) {
-  return Vec3(v[0] * lx[0] + v[1] * ly[0] + v[2] * lz[0],
-              v[0] * lx[1] + v[1] * ly[1] + v[2] * lz[1],
-              v[0] * lx[2] + v[1] * ly[2] + v[2] * lz[2]);
-}
-
-void tangentSpaceBasis(const Vec3& n, Vec3& t, Vec3& b) {
-  if (std::abs(n[1]) < 0.9f) {
-    t = normalize(cross(n, Vec3(0, 1, 0)));
-  } else {
-    t = normalize(cross(n, Vec3(0, 0, -1)));
-  }
-  b = normalize(cross(t, n));
-}
-
-Vec3 sampleCosineHemisphere(float u, float v, float& pdf) {
-  const float theta =
-      0.5f * std::acos(std::clamp(1.0f - 2.0f * u, -1.0f, 1.0f));
-  const float phi = 2.0f * PI * v;
-
-  const float cosTheta = std::cos(theta);
-  pdf = cosTheta * INV_PI;
-  return Vec3(std::cos(phi) * std::sin(theta), cosTheta,
-              std::sin(phi) * std::sin(theta));
-}
-
-Vec3 pathTracing(const Ray& ray_in, const OptimizedBVH& scene, RNG& rng) {
+template <typename Sampler>
+Vec3 pathTracing(const Ray& ray_in, const OptimizedBVH& scene,
+                 PixelSampler<Sampler>& sampler) {
   constexpr int maxDepth = 100;
   const Vec3 rho{0.9f, 0.9f, 0.9f};
 
@@ -51,7 +27,7 @@ Vec3 pathTracing(const Ray& ray_in, const OptimizedBVH& scene, RNG& rng) {
   for (int i = 0; i < maxDepth; ++i) {
     const float russianRouletteProb =
         std::max(std::max(throughput[0], throughput[1]), throughput[2]);
-    if (rng.getNext() > russianRouletteProb) {
+    if (sampler.getNext() > russianRouletteProb) {
       break;
     }
     throughput /= russianRouletteProb;
@@ -68,9 +44,9 @@ Vec3 pathTracing(const Ray& ray_in, const OptimizedBVH& scene, RNG& rng) {
 
     Vec3 t, b;
     tangentSpaceBasis(info.hitNormal, t, b);
-    float pdf;
-    const Vec3 directionTangent =
-        sampleCosineHemisphere(rng.getNext(), rng.getNext(), pdf);
+    float u, v, pdf;
+    sampler.get2D(u, v);
+    const Vec3 directionTangent = sampleCosineHemisphere(u, v, pdf);
     const Vec3 direction = localToWorld(directionTangent, t, info.hitNormal, b);
 
     const Vec3 brdf = rho * INV_PI;
@@ -78,48 +54,17 @@ Vec3 pathTracing(const Ray& ray_in, const OptimizedBVH& scene, RNG& rng) {
 
     throughput *= brdf * cos / pdf;
 
-    ray = Ray(info.hitPos, direction);
+    // 同じ面と交差しないように始点を面から離す
+    // NOTE: 補間した法線ではなく, レイが出ていく側を向いた面法線の方向にずらす
+    const Vec3 offsetNormal =
+        dot(direction, info.geomNormal) < 0 ? -info.geomNormal
+                                            : info.geomNormal;
+    ray = Ray(offsetRayOrigin(info.hitPos, offsetNormal), direction);
   }
 
   return radiance;
 }
 
-bool loadObj(const std::string& filename, std::vector<float>& vertices,
-             std::vector<unsigned int>& indices, std::vector<float>& normals,
-             std::vector<float>& uvs) {
-  tinyobj::ObjReader reader;
-
-  if (!reader.ParseFromFile(filename)) {
-    if (!reader.Error().empty()) {
-      std::cerr << reader.Error();
-    }
-    return false;
-  }
-
-  if (!reader.Warning().empty()) {
-    std::cout << reader.Warning();
-  }
-
-  const auto& attrib = reader.GetAttrib();
-  const auto& shapes = reader.GetShapes();
-
-  vertices = attrib.vertices;
-  if (attrib.normals.size() == attrib.vertices.size()) {
-    normals = attrib.normals;
-  }
-  if (attrib.texcoords.size() == (attrib.vertices.size() / 3) * 2) {
-    uvs = attrib.texcoords;
-  }
-
-  for (size_t s = 0; s < shapes.size(); ++s) {
-    for (const auto& idx : shapes[s].mesh.indices) {
-      indices.push_back(idx.vertex_index);
-    }
-  }
-
-  return true;
-}
-
 int main() {
   const std::string filename = "sponza.obj";
   const int width = 512;
@@ -128,23 +73,28 @@ int main() {
   const Vec3 camPos(-10, 7, 0);
   const Vec3 camForward(1, 0, 0);
 
-  std::vector<float> vertices;
-  std::vector<unsigned int> indices;
-  std::vector<float> normals;
-  std::vector<float> uvs;
+  ObjMesh mesh;
 
-  if (!loadObj(filename, vertices, indices, normals, uvs)) {
+  if (!loadObj(filename, mesh)) {
     std::exit(EXIT_FAILURE);
   }
 
-  const auto polygon =
-      std::make_shared<Polygon>(indices.size(), vertices.data(), indices.data(),
-                                normals.data(), uvs.data());
+  // 各スレッドから読むので, メッシュを全てのNUMAノードに分散させる
+  mesh.applyMemoryPolicy();
+
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
   std::cout << "vertices: " << polygon->nVertices << std::endl;
   std::cout << "faces: " << polygon->nFaces() << std::endl;
 
+  // BVH_USE_PERF_COUNTERSが定義されている場合はハードウェアカウンタも表示する
+  PerfProfiler profiler;
+
   OptimizedBVH bvh(*polygon);
-  bvh.buildBVH();
+  {
+    const PerfProfiler::Phase phase(profiler, "build");
+    bvh.buildBVH();
+  }
+  bvh.replicateToNumaNodes();
   std::cout << "nodes: " << bvh.nNodes() << std::endl;
   std::cout << "internal nodes: " << bvh.nInternalNodes() << std::endl;
   std::cout << "leaf nodes: " << bvh.nLeafNodes() << std::endl;
@@ -152,30 +102,48 @@ int main() {
 
   Image img(width, height);
   Camera camera(camPos, camForward);
+  // ピクセルごとにscramblingしたSobol列を使う
+  const SobolSampler sampler;
 
   const auto startTime = std::chrono::system_clock::now();
 #pragma omp parallel for schedule(dynamic, 1)
   for (int j = 0; j < height; ++j) {
-    for (int i = 0; i < width; ++i) {
-      RNG rng(i + width * j);
-
-      Vec3 color{0, 0, 0};
-      for (int k = 0; k < samples; ++k) {
-        const float u = (2.0f * (i + rng.getNext()) - width) / height;
-        const float v = (2.0f * (j + rng.getNext()) - height) / height;
-        const Ray ray = camera.sampleRay(u, v);
-        color += pathTracing(ray, bvh, rng);
+    const PerfProfiler::Phase phase(profiler, "render");
+
+    // 1行分のカメラレイをまとめて生成する
+    // ピクセル内の位置はサンプラーの0, 1次元目を使う
+    std::vector<uint32_t> pixels(width);
+    std::iota(pixels.begin(), pixels.end(), width * j);
+    std::vector<float> jitter[2];
+    jitter[0].resize(width);
+    jitter[1].resize(width);
+    const float* const jitterData[2] = {jitter[0].data(), jitter[1].data()};
+    RayBuffer rays;
+
+    std::vector<Vec3> colors(width, Vec3(0));
+    for (int k = 0; k < samples; ++k) {
+      generateSamples(sampler, pixels.data(), width, k, 0, jitter[0].data());
+      generateSamples(sampler, pixels.data(), width, k, 1, jitter[1].data());
+      camera.generateRays(width, height, 0, j, width, 1, rays, jitterData);
+
+      for (int i = 0; i < width; ++i) {
+        PixelSampler pixelSampler(sampler, pixels[i], k, 2);
+        colors[i] += pathTracing(rays.ray(i), bvh, pixelSampler);
       }
-      color /= Vec3(samples);
+    }
 
-      img.setPixel(i, j, color);
+    for (int i = 0; i < width; ++i) {
+      img.setPixel(i, j, colors[i] / Vec3(samples));
     }
   }
   std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(
                    std::chrono::system_clock::now() - startTime)
                    .count()
             << "ms" << std::endl;
+  profiler.report(std::cout);
 
+  // 後から露出などを変えられるように, リニアな値もPFMで書き出す
+  img.writePFM("output.pfm");
   img.writePPM("output.ppm");
 
   return 0;
@@ -4,59 +4,18 @@
 #include <string>
 
 #include "bvh.hpp"
-#include "tiny_obj_loader.h"
-
-bool loadObj(const std::string& filename, std::vector<float>& vertices,
-             std::vector<unsigned int>& indices, std::vector<float>& normals,
-             std::vector<float>& uvs) {
-  tinyobj::ObjReader reader;
-
-  if (!reader.ParseFromFile(filename)) {
-    if (!reader.Error().empty()) {
-      std::cerr << reader.Error();
-    }
-    return false;
-  }
-
-  if (!reader.Warning().empty()) {
-    std::cout << reader.Warning();
-  }
-
-  const auto& attrib = reader.GetAttrib();
-  const auto& shapes = reader.GetShapes();
-
-  vertices = attrib.vertices;
-  if (attrib.normals.size() == attrib.vertices.size()) {
-    normals = attrib.normals;
-  }
-  if (attrib.texcoords.size() == (attrib.vertices.size() / 3) * 2) {
-    uvs = attrib.texcoords;
-  }
-
-  for (size_t s = 0; s < shapes.size(); ++s) {
-    for (const auto& idx : shapes[s].mesh.indices) {
-      indices.push_back(idx.vertex_index);
-    }
-  }
-
-  return true;
-}
+#include "obj-loader.hpp"
 
 int main() {
   std::string filename = "dragon.obj";
 
-  std::vector<float> vertices;
-  std::vector<unsigned int> indices;
-  std::vector<float> normals;
-  std::vector<float> uvs;
+  ObjMesh mesh;
 
-  if (!loadObj(filename, vertices, indices, normals, uvs)) {
+  if (!loadObj(filename, mesh)) {
     std::exit(EXIT_FAILURE);
   }
 
-  const auto polygon =
-      std::make_shared<Polygon>(indices.size(), vertices.data(), indices.data(),
-                                normals.data(), uvs.data());
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
 
   std::cout << "vertices: " << polygon->nVertices << std::endl;
   std::cout << "faces: " << polygon->nFaces() << std::endl;
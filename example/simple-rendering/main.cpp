@@ -2,47 +2,12 @@
 #include <chrono>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "bvh.hpp"
 #include "camera.hpp"
 #include "image.hpp"
-#include "tiny_obj_loader.h"
-
-bool loadObj(const std::string& filename, std::vector<float>& vertices,
-             std::vector<unsigned int>& indices, std::vector<float>& normals,
-             std::vector<float>& uvs) {
-  tinyobj::ObjReader reader;
-
-  if (!reader.ParseFromFile(filename)) {
-    if (!reader.Error().empty()) {
-      std::cerr << reader.Error();
-    }
-    return false;
-  }
-
-  if (!reader.Warning().empty()) {
-    std::cout << reader.Warning();
-  }
-
-  const auto& attrib = reader.GetAttrib();
-  const auto& shapes = reader.GetShapes();
-
-  vertices = attrib.vertices;
-  if (attrib.normals.size() == attrib.vertices.size()) {
-    normals = attrib.normals;
-  }
-  if (attrib.texcoords.size() == (attrib.vertices.size() / 3) * 2) {
-    uvs = attrib.texcoords;
-  }
-
-  for (size_t s = 0; s < shapes.size(); ++s) {
-    for (const auto& idx : shapes[s].mesh.indices) {
-      indices.push_back(idx.vertex_index);
-    }
-  }
-
-  return true;
-}
+#include "obj-loader.hpp"
 
 int main() {
   const std::string filename = "bunny.obj";
@@ -51,18 +16,13 @@ int main() {
   const Vec3 camPos(0, 1, 2);
   const Vec3 camForward(0, 0, -1);
 
-  std::vector<float> vertices;
-  std::vector<unsigned int> indices;
-  std::vector<float> normals;
-  std::vector<float> uvs;
+  ObjMesh mesh;
 
-  if (!loadObj(filename, vertices, indices, normals, uvs)) {
+  if (!loadObj(filename, mesh)) {
     std::exit(EXIT_FAILURE);
   }
 
-  const auto polygon =
-      std::make_shared<Polygon>(indices.size(), vertices.data(), indices.data(),
-                                normals.data(), uvs.data());
+  const auto polygon = std::make_shared<Polygon>(mesh.polygon());
   std::cout << "vertices: " << polygon->nVertices << std::endl;
   std::cout << "faces: " << polygon->nFaces() << std::endl;
 
@@ -77,15 +37,27 @@ int main() {
   Camera camera(camPos, camForward);
 
   const auto startTime = std::chrono::system_clock::now();
+
+  // 画像全体のレイをSoA形式でまとめて生成し, まとめてtraverseする
+  RayBuffer rays;
+  camera.generateRays(width, height, 0, 0, width, height, rays);
+
+  std::vector<int> primID(rays.size());
+  std::vector<float> normals[3];
+  HitBatch hits;
+  hits.primID = primID.data();
+  for (int axis = 0; axis < 3; ++axis) {
+    normals[axis].resize(rays.size());
+    hits.hitNormal[axis] = normals[axis].data();
+  }
+  bvh.intersect(rays.batch(), hits);
+
   for (int j = 0; j < height; ++j) {
     for (int i = 0; i < width; ++i) {
-      const float u = (2.0f * i - width) / height;
-      const float v = (2.0f * j - height) / height;
-      const Ray ray = camera.sampleRay(u, v);
-
-      IntersectInfo info;
-      if (bvh.intersect(ray, info)) {
-        img.setPixel(i, j, 0.5f * (info.hitNormal + Vec3(1.0f)));
+      const size_t k = static_cast<size_t>(j) * width + i;
+      if (primID[k] >= 0) {
+        const Vec3 normal(normals[0][k], normals[1][k], normals[2][k]);
+        img.setPixel(i, j, 0.5f * (normal + Vec3(1.0f)));
       } else {
         img.setPixel(i, j, Vec3(0));
       }
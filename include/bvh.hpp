@@ -1,6 +1,9 @@
 #ifndef _BVH_H
 #define _BVH_H
 
+#include "bvh/async-bvh.hpp"
+#include "bvh/generic-bvh.hpp"
+#include "bvh/motion-bvh.hpp"
 #include "bvh/optimized-bvh.hpp"
 #include "bvh/simple-bvh.hpp"
 
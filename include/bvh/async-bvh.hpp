@@ -0,0 +1,193 @@
+#ifndef _ASYNC_BVH_H
+#define _ASYNC_BVH_H
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "core/aabb.hpp"
+#include "core/intersect-info.hpp"
+#include "core/polygon.hpp"
+#include "core/ray.hpp"
+
+// バックグラウンドで再構築できるBVH
+// 新しいBVHを別スレッドで構築している間も, 問い合わせは古いBVHで続けられる.
+// 構築が終わるとポインタをatomicに入れ替え, 古いBVHを読んでいるスレッドが
+// いなくなってから(epoch based reclamation)解放する
+// BVHはSimpleBVH, OptimizedBVH, MotionBVHなどPolygonから構築するもの
+// NOTE: 問い合わせはロックを取らないので, 再構築中も遅延が変わらない
+template <typename BVH>
+class AsyncBVH {
+ public:
+  // 同時に問い合わせできるスレッド数の上限
+  // これを超えた場合は空きができるまで待つ
+  static constexpr int MAX_READERS = 128;
+
+ private:
+  // BVHと, それが参照するPolygon
+  // NOTE: Polygonが参照する頂点などの配列もBVHと同じだけ生存させるために,
+  // shared_ptrのaliasing constructorなどで配列の所有権を持たせておく
+  struct Snapshot {
+    std::shared_ptr<const Polygon> polygon;
+    BVH bvh;
+    uint64_t version;  // 何回目の構築か
+
+    template <typename... Args>
+    Snapshot(std::shared_ptr<const Polygon> polygon, uint64_t version,
+             const Args&... args)
+        : polygon(std::move(polygon)),
+          bvh(*this->polygon, args...),
+          version(version) {
+      bvh.buildBVH();
+    }
+  };
+
+  // 問い合わせ中のスレッドが開始した時のepochを書き込む場所
+  // 0の場合は使われていない
+  // NOTE: false sharingを避けるためにキャッシュラインごとに置く
+  struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> epoch{0};
+  };
+
+  std::atomic<Snapshot*> current{nullptr};  // 問い合わせに使うBVH
+  std::atomic<uint64_t> epoch{1};           // 入れ替えごとに増える値
+  mutable std::array<ReaderSlot, MAX_READERS> readerSlots;
+
+  std::thread builder;                  // 再構築を行うスレッド
+  std::atomic<bool> rebuilding{false};  // 再構築中か
+  uint64_t nBuilds{0};                  // 構築した回数
+
+  // 現在のepochを空いているReaderSlotに書き込み, その番号を返す
+  // NOTE: 書き込んだ後にcurrentを読むので, 書き込む前に入れ替わった古い
+  // BVHは読まない. 書き込んだepoch以降に入れ替わったBVHは解放されない
+  int pin() const {
+    // 前回使ったスロットから探す
+    thread_local int cachedSlot = 0;
+    const uint64_t e = epoch.load();
+    for (int i = cachedSlot;; i = (i + 1) % MAX_READERS) {
+      uint64_t expected = 0;
+      if (readerSlots[i].epoch.compare_exchange_strong(expected, e)) {
+        cachedSlot = i;
+        return i;
+      }
+    }
+  }
+
+  // pinで書き込んだスロットを空ける
+  void unpin(int slot) const { readerSlots[slot].epoch.store(0); }
+
+  // retireEpoch以前に問い合わせを開始したスレッドが全て終わるまで待つ
+  void waitForReaders(uint64_t retireEpoch) const {
+    for (const ReaderSlot& slot : readerSlots) {
+      while (true) {
+        const uint64_t e = slot.epoch.load();
+        if (e == 0 || e > retireEpoch) break;
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // 現在のSnapshotでf(snapshot)を呼び, その返り値を返す
+  // fの実行中はSnapshotが解放されない
+  template <typename F>
+  decltype(auto) querySnapshot(const F& f) const {
+    // スコープを抜ける時にスロットを空ける
+    struct Guard {
+      const AsyncBVH* self;
+      int slot;
+      ~Guard() { self->unpin(slot); }
+    };
+    const Guard guard{this, pin()};
+    return f(*current.load());
+  }
+
+  // BVHを入れ替え, 古いBVHを読むスレッドがいなくなってから解放する
+  void publish(Snapshot* snapshot) {
+    Snapshot* old = current.exchange(snapshot);
+    const uint64_t retireEpoch = epoch.fetch_add(1);
+    if (old) {
+      waitForReaders(retireEpoch);
+      delete old;
+    }
+  }
+
+ public:
+  // 最初のBVHを構築する
+  // argsはPolygonの後にBVHのコンストラクタに渡す引数
+  template <typename... Args>
+  explicit AsyncBVH(std::shared_ptr<const Polygon> polygon,
+                    const Args&... args) {
+    publish(new Snapshot(std::move(polygon), nBuilds++, args...));
+  }
+
+  AsyncBVH(const AsyncBVH&) = delete;
+  AsyncBVH& operator=(const AsyncBVH&) = delete;
+
+  ~AsyncBVH() {
+    wait();
+    delete current.load();
+  }
+
+  // バックグラウンドでpolygonからBVHを再構築し, 終わったら入れ替える
+  // 既に再構築中の場合は何もせずにfalseを返す
+  // NOTE: 問い合わせと同時に呼べるが, rebuild, waitを複数のスレッドから
+  // 同時に呼んではいけない
+  template <typename... Args>
+  bool rebuild(std::shared_ptr<const Polygon> polygon, const Args&... args) {
+    if (rebuilding.load()) {
+      return false;
+    }
+    if (builder.joinable()) {
+      builder.join();
+    }
+
+    rebuilding.store(true);
+    const uint64_t version = nBuilds++;
+    builder = std::thread([this, polygon, version, args...]() {
+      publish(new Snapshot(polygon, version, args...));
+      rebuilding.store(false);
+    });
+    return true;
+  }
+
+  // 再構築中か
+  bool isRebuilding() const { return rebuilding.load(); }
+
+  // 再構築が終わり, 古いBVHが解放されるまで待つ
+  void wait() {
+    if (builder.joinable()) {
+      builder.join();
+    }
+  }
+
+  // 現在のBVHでf(bvh)を呼び, その返り値を返す
+  // fの実行中はBVHが解放されない
+  // NOTE: 複数の問い合わせをまとめて呼ぶと, 同じBVHで処理できる.
+  // fの中でrebuild, waitを呼んではいけない(古いBVHの解放を待ち続ける)
+  template <typename F>
+  decltype(auto) query(const F& f) const {
+    return querySnapshot([&](const Snapshot& snapshot) -> decltype(auto) {
+      return f(snapshot.bvh);
+    });
+  }
+
+  // 現在のBVHの構築番号(最初のBVHは0)を返す
+  uint64_t version() const {
+    return querySnapshot(
+        [](const Snapshot& snapshot) { return snapshot.version; });
+  }
+
+  // 全体のバウンディングボックスを返す
+  AABB rootAABB() const {
+    return query([](const BVH& bvh) { return bvh.rootAABB(); });
+  }
+
+  // traverseをする
+  bool intersect(const Ray& ray, IntersectInfo& info) const {
+    return query([&](const BVH& bvh) { return bvh.intersect(ray, info); });
+  }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef _BUILD_PRIMITIVES_H
+#define _BUILD_PRIMITIVES_H
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "core/aabb.hpp"
+
+// BVHの構築に使うPrimitiveのAABBと中心点
+// 構築の最初に一度だけ計算し, SoAで保持する
+// NOTE: 各配列はPrimitiveの番号(primIndicesの要素)でアクセスする
+class BuildPrimitives {
+ private:
+  std::vector<float> bboxMin[3];    // AABBの最小点
+  std::vector<float> bboxMax[3];    // AABBの最大点
+  std::vector<float> centroids[3];  // AABBの中心点
+
+ public:
+  // calcAABBはPrimitiveの番号を受け取り, そのAABBを返す関数
+  template <typename CalcAABB>
+  BuildPrimitives(uint32_t nPrimitives, const CalcAABB& calcAABB) {
+    for (int axis = 0; axis < 3; ++axis) {
+      bboxMin[axis].resize(nPrimitives);
+      bboxMax[axis].resize(nPrimitives);
+      centroids[axis].resize(nPrimitives);
+    }
+
+    for (uint32_t i = 0; i < nPrimitives; ++i) {
+      const AABB bbox = calcAABB(i);
+      for (int axis = 0; axis < 3; ++axis) {
+        bboxMin[axis][i] = bbox.bounds[0][axis];
+        bboxMax[axis][i] = bbox.bounds[1][axis];
+        centroids[axis][i] =
+            0.5f * (bbox.bounds[0][axis] + bbox.bounds[1][axis]);
+      }
+    }
+  }
+
+  // Primitiveの数を返す
+  uint32_t size() const { return centroids[0].size(); }
+
+  // Primitiveの中心点の指定した軸の座標を返す
+  float centroid(uint32_t prim, int axis) const {
+    return centroids[axis][prim];
+  }
+
+  // Primitiveの中心点を返す
+  Vec3 centroid(uint32_t prim) const {
+    return Vec3(centroids[0][prim], centroids[1][prim], centroids[2][prim]);
+  }
+
+  // PrimitiveのAABBを返す
+  AABB primitiveAABB(uint32_t prim) const {
+    return AABB(Vec3(bboxMin[0][prim], bboxMin[1][prim], bboxMin[2][prim]),
+                Vec3(bboxMax[0][prim], bboxMax[1][prim], bboxMax[2][prim]));
+  }
+
+  // 範囲内のPrimitiveを含むAABBと, 中心点を含むAABBを計算する
+  void calcBounds(const uint32_t* primIndices, int primStart, int primEnd,
+                  AABB& bbox, AABB& centroidBBox) const {
+    for (int axis = 0; axis < 3; ++axis) {
+      float pMin = std::numeric_limits<float>::max();
+      float pMax = std::numeric_limits<float>::lowest();
+      float cMin = std::numeric_limits<float>::max();
+      float cMax = std::numeric_limits<float>::lowest();
+      for (int i = primStart; i < primEnd; ++i) {
+        const uint32_t prim = primIndices[i];
+        pMin = std::min(pMin, bboxMin[axis][prim]);
+        pMax = std::max(pMax, bboxMax[axis][prim]);
+        cMin = std::min(cMin, centroids[axis][prim]);
+        cMax = std::max(cMax, centroids[axis][prim]);
+      }
+      bbox.bounds[0][axis] = pMin;
+      bbox.bounds[1][axis] = pMax;
+      centroidBBox.bounds[0][axis] = cMin;
+      centroidBBox.bounds[1][axis] = cMax;
+    }
+  }
+
+  // 範囲内のPrimitiveを中心点の座標で等数分割し, 分割位置を返す
+  int splitMedian(uint32_t* primIndices, int primStart, int primEnd,
+                  int axis) const {
+    const int splitIdx = primStart + (primEnd - primStart) / 2;
+    const std::vector<float>& c = centroids[axis];
+    std::nth_element(
+        primIndices + primStart, primIndices + splitIdx, primIndices + primEnd,
+        [&](uint32_t prim1, uint32_t prim2) { return c[prim1] < c[prim2]; });
+    return splitIdx;
+  }
+};
+
+// 範囲内のPrimitiveから, 等数分割で再帰的にノードを構築する
+// ノードは配列nodesに置き, 2つの子ノードは常に隣り合わせ
+// (childOffset, childOffset + 1)に置く. Primitiveの数がmaxLeafSize以下なら
+// setLeaf(nodeIdx, bbox, primStart, nPrims)で葉ノードを,
+// そうでなければsetInternal(nodeIdx, bbox, childOffset, axis)で中間ノードを
+// セットする
+// NOTE: 子ノードの組はsetInternalの前に追加するので,
+// コールバックの中ではnodes[nodeIdx]の参照を使える
+template <typename Nodes, typename SetLeaf, typename SetInternal>
+void buildMedianSplitNode(int nodeIdx, int primStart, int primEnd,
+                          int maxLeafSize, const BuildPrimitives& prims,
+                          uint32_t* primIndices, Nodes& nodes,
+                          const SetLeaf& setLeaf,
+                          const SetInternal& setInternal) {
+  // AABBと, 分割用に各Primitiveの中心点を含むAABBを計算
+  // NOTE: bboxをそのまま使ってしまうとsplitが失敗することが多い
+  AABB bbox, splitAABB;
+  prims.calcBounds(primIndices, primStart, primEnd, bbox, splitAABB);
+
+  // 含まれるPrimitiveが少ない場合は葉ノードにする
+  const int nPrims = primEnd - primStart;
+  if (nPrims <= maxLeafSize) {
+    setLeaf(nodeIdx, bbox, primStart, nPrims);
+    return;
+  }
+
+  // AABBの分割(等数分割)
+  const int splitAxis = splitAABB.longestAxis();
+  const int splitIdx =
+      prims.splitMedian(primIndices, primStart, primEnd, splitAxis);
+
+  // NOTE: 等数分割なので, 2個以上のPrimitiveは必ず2つに分かれる
+  assert(splitIdx > primStart && splitIdx < primEnd);
+
+  // 子ノードの組を配列に追加する
+  const int childOffset = nodes.size();
+  nodes.resize(childOffset + 2);
+  setInternal(nodeIdx, bbox, childOffset, splitAxis);
+
+  // 左の子ノード, 右の子ノードを構築していく
+  buildMedianSplitNode(childOffset, primStart, splitIdx, maxLeafSize, prims,
+                       primIndices, nodes, setLeaf, setInternal);
+  buildMedianSplitNode(childOffset + 1, splitIdx, primEnd, maxLeafSize, prims,
+                       primIndices, nodes, setLeaf, setInternal);
+}
+
+#endif
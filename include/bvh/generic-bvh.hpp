@@ -0,0 +1,170 @@
+#ifndef _GENERIC_BVH_H
+#define _GENERIC_BVH_H
+#include <numeric>
+#include <vector>
+
+#include "bvh/build-primitives.hpp"
+#include "core/page-allocator.hpp"
+#include "core/precomputed-ray.hpp"
+#include "core/primitive-set.hpp"
+
+// 任意のPrimitiveの集合(core/primitive-set.hpp)に対するBVH
+// Primitivesはテンプレート引数なので, 交差判定は仮想関数を通さずに
+// インライン展開される
+// NOTE: 三角形だけの場合はTriangle4などを使うOptimizedBVHの方が速い
+template <typename Primitives>
+class GenericBVH {
+ private:
+  Primitives primitives;             // Primitiveの集合
+  PageVector<uint32_t> primIndices;  // Primitiveの番号の配列
+
+  // ノードを表す構造体
+  // NOTE: 2つの子ノードは常に隣り合わせ(childOffset, childOffset + 1)に置く
+  struct BVHNode {
+    AABB bbox;  // バウンディングボックス
+    union {
+      uint32_t primIndicesOffset;  // primIndicesへのオフセット
+      uint32_t childOffset;        // 子ノードの組へのオフセット
+    };
+    uint16_t nPrimitives{
+        0};  // ノードに含まれるPrimitiveの数(中間ノードの場合は0)
+    uint8_t axis{0};  // 分割軸
+  };
+
+  // BVHの統計情報を表す構造体
+  struct BVHStatistics {
+    int nNodes{0};          // ノード総数
+    int nInternalNodes{0};  // 中間ノードの数
+    int nLeafNodes{0};      // 葉ノードの数
+  };
+
+  PageVector<BVHNode> nodes;  // ノード配列(深さ優先順)
+  BVHStatistics stats;        // BVHの統計情報
+
+  // 葉ノードをセットする
+  void setLeafNode(int nodeIdx, const AABB& bbox, int primStart, int nPrims) {
+    BVHNode& node = nodes[nodeIdx];
+    node.bbox = bbox;
+    node.primIndicesOffset = primStart;
+    node.nPrimitives = nPrims;
+    stats.nLeafNodes++;
+  }
+
+  // 中間ノードをセットする
+  void setInternalNode(int nodeIdx, const AABB& bbox, int childOffset,
+                       int axis) {
+    BVHNode& node = nodes[nodeIdx];
+    node.bbox = bbox;
+    node.childOffset = childOffset;
+    node.axis = axis;
+    stats.nInternalNodes++;
+  }
+
+  // 再帰的にBVHのtraverseを行う
+  bool intersectNode(int nodeIdx, const Ray& ray, const PrecomputedRay& rayData,
+                     IntersectInfo& info) const {
+    bool hit = false;
+    const BVHNode& node = nodes[nodeIdx];
+
+    // AABBとの交差判定
+    if (node.bbox.intersect(ray, rayData)) {
+      // 葉ノードの場合
+      if (node.nPrimitives > 0) {
+        // ノードに含まれる全てのPrimitiveと交差計算
+        const int primEnd = node.primIndicesOffset + node.nPrimitives;
+        for (int i = node.primIndicesOffset; i < primEnd; ++i) {
+          if (primitives.intersect(primIndices[i], ray, info)) {
+            // intersectしたらrayのtmaxを更新
+            hit = true;
+            ray.tmax = info.t;
+          }
+        }
+      }
+      // 中間ノードの場合
+      else {
+        // rayの方向に応じて最適な順番で交差判定をする
+        const int sign = rayData.dirInvSign[node.axis];
+        hit |= intersectNode(node.childOffset + sign, ray, rayData, info);
+        hit |= intersectNode(node.childOffset + 1 - sign, ray, rayData, info);
+      }
+    }
+
+    return hit;
+  }
+
+ public:
+  explicit GenericBVH(const Primitives& primitives) : primitives(primitives) {
+    // 集合の全てのPrimitiveを追加していく
+    primIndices.resize(primitives.size());
+    std::iota(primIndices.begin(), primIndices.end(), 0);
+  }
+
+  // BVHを構築する
+  void buildBVH() {
+    // 各PrimitiveのAABBと中心点を事前計算しておく
+    const BuildPrimitives prims(primitives.size(), [&](uint32_t prim) {
+      return primitives.calcAABB(prim);
+    });
+
+    // BVHの構築をルートノードから開始
+    // NOTE: 構築し直す場合に前回の統計情報を数えないようにリセットする
+    stats = BVHStatistics();
+    nodes.resize(1);
+    buildMedianSplitNode(
+        0, 0, primIndices.size(), 4, prims, primIndices.data(), nodes,
+        [&](int nodeIdx, const AABB& bbox, int primStart, int nPrims) {
+          setLeafNode(nodeIdx, bbox, primStart, nPrims);
+        },
+        [&](int nodeIdx, const AABB& bbox, int childOffset, int axis) {
+          setInternalNode(nodeIdx, bbox, childOffset, axis);
+        });
+
+    // 総ノード数を計算
+    stats.nNodes = stats.nInternalNodes + stats.nLeafNodes;
+  }
+
+  // Primitiveの集合を返す
+  const Primitives& getPrimitives() const { return primitives; }
+
+  // ノード数を返す
+  int nNodes() const { return stats.nNodes; }
+  // 中間ノード数を返す
+  int nInternalNodes() const { return stats.nInternalNodes; }
+  // 葉ノード数を返す
+  int nLeafNodes() const { return stats.nLeafNodes; }
+  // ノードとPrimitiveが使用しているメモリ量(Byte)を返す
+  size_t memoryUsage() const {
+    return sizeof(BVHNode) * nodes.capacity() +
+           sizeof(uint32_t) * primIndices.capacity();
+  }
+
+  // 全体のバウンディングボックスを返す
+  AABB rootAABB() const {
+    if (nodes.size() > 0) {
+      return nodes[0].bbox;
+    } else {
+      return AABB();
+    }
+  }
+
+  // 最も近い交差点のt, barycentric, primIDを求める
+  // NOTE: 交差点の情報(位置, 法線など)は計算しない
+  bool intersectClosest(const Ray& ray, IntersectInfo& info) const {
+    if (nodes.size() == 0) return false;
+    const PrecomputedRay rayData(ray);
+    return intersectNode(0, ray, rayData, info);
+  }
+
+  // traverseをする
+  bool intersect(const Ray& ray, IntersectInfo& info) const {
+    if (!intersectClosest(ray, info)) {
+      return false;
+    }
+
+    // 最も近い交差点の情報を計算する
+    primitives.calcSurfaceInfo(ray, info);
+    return true;
+  }
+};
+
+#endif
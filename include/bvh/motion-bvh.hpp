@@ -0,0 +1,247 @@
+#ifndef _MOTION_BVH_H
+#define _MOTION_BVH_H
+#include <numeric>
+#include <vector>
+
+#include "bvh/build-primitives.hpp"
+#include "core/page-allocator.hpp"
+#include "core/precomputed-ray.hpp"
+#include "core/simd.hpp"
+#include "core/triangle.hpp"
+
+// 頂点座標にキーフレームがあるPolygon(モーションブラー)用のBVH
+// ノードはキーフレームごとのAABBを持ち, traverse中にray.timeで線形補間する
+// NOTE: キーフレームの間は頂点が線形に動くので, 補間したAABBはその時刻の
+// 三角形を必ず含む
+class MotionBVH {
+ public:
+  // ノードのAABBの持ち方
+  enum class MotionBounds {
+    INTERPOLATED,  // キーフレームごとのAABBを時刻で線形補間する
+    UNION,         // 全てのキーフレームを含む1つのAABB(比較用)
+  };
+
+ private:
+  const Polygon* polygon;            // Primitive(三角形)を含むPolygon
+  PageVector<uint32_t> primIndices;  // Primitiveの面番号の配列
+
+  // ノードを表す構造体
+  // NOTE: AABBはキーフレームの数だけあるのでboundsに分けて持つ
+  // NOTE: 2つの子ノードは常に隣り合わせ(childOffset, childOffset + 1)に置く
+  struct BVHNode {
+    union {
+      uint32_t primIndicesOffset;  // primIndicesへのオフセット
+      uint32_t childOffset;        // 子ノードの組へのオフセット
+    };
+    uint16_t nPrimitives{
+        0};  // ノードに含まれるPrimitiveの数(中間ノードの場合は0)
+    uint8_t axis{0};  // 分割軸
+  };
+
+  // BVHの統計情報を表す構造体
+  struct BVHStatistics {
+    int nNodes{0};          // ノード総数
+    int nInternalNodes{0};  // 中間ノードの数
+    int nLeafNodes{0};      // 葉ノードの数
+  };
+
+  PageVector<BVHNode> nodes;  // ノード配列(深さ優先順)
+  BVHStatistics stats;        // BVHの統計情報
+
+  // ノードごとのAABBの数(INTERPOLATEDならキーフレーム数, UNIONなら1)
+  int nBoundsPerNode;
+
+  // ノードのAABBの配列
+  // ノードiのAABBはbounds[nBoundsPerNode * i]からnBoundsPerNode個
+  PageVector<AABB> bounds;
+
+  // 葉ノードをセットする
+  void setLeafNode(int nodeIdx, int primStart, int nPrims) {
+    BVHNode& node = nodes[nodeIdx];
+    node.primIndicesOffset = primStart;
+    node.nPrimitives = nPrims;
+    stats.nLeafNodes++;
+  }
+
+  // 中間ノードをセットする
+  void setInternalNode(int nodeIdx, int childOffset, int axis) {
+    BVHNode& node = nodes[nodeIdx];
+    node.childOffset = childOffset;
+    node.axis = axis;
+    stats.nInternalNodes++;
+  }
+
+  // 再帰的にノードのAABBを計算する
+  void calcNodeBounds(int nodeIdx) {
+    const BVHNode& node = nodes[nodeIdx];
+    AABB* nodeBounds = &bounds[nBoundsPerNode * nodeIdx];
+
+    // 葉ノードの場合は含まれる三角形のAABBから計算する
+    if (node.nPrimitives > 0) {
+      const int primEnd = node.primIndicesOffset + node.nPrimitives;
+      for (int i = node.primIndicesOffset; i < primEnd; ++i) {
+        const Triangle triangle(polygon, primIndices[i]);
+        for (unsigned int k = 0; k < polygon->nKeyframes; ++k) {
+          // UNIONの場合は全てのキーフレームを1つのAABBにまとめる
+          AABB& bbox = nodeBounds[nBoundsPerNode == 1 ? 0 : k];
+          bbox = mergeAABB(bbox, triangle.calcAABB(k));
+        }
+      }
+    }
+    // 中間ノードの場合は子ノードのAABBをまとめる
+    else {
+      calcNodeBounds(node.childOffset);
+      calcNodeBounds(node.childOffset + 1);
+      for (int k = 0; k < nBoundsPerNode; ++k) {
+        nodeBounds[k] =
+            mergeAABB(bounds[nBoundsPerNode * node.childOffset + k],
+                      bounds[nBoundsPerNode * (node.childOffset + 1) + k]);
+      }
+    }
+  }
+
+  // キーフレームの区間segment内のweightの位置でのノードのAABBを返す
+  AABB nodeAABB(int nodeIdx, unsigned int segment, float weight) const {
+    if (nBoundsPerNode == 1) {
+      return bounds[nodeIdx];
+    }
+    const AABB& b0 = bounds[nBoundsPerNode * nodeIdx + segment];
+    const AABB& b1 = bounds[nBoundsPerNode * nodeIdx + segment + 1];
+    const Float4 w0(1.0f - weight);
+    const Float4 w1(weight);
+    AABB ret;
+    (w0 * Float4::load(b0.bounds[0]) + w1 * Float4::load(b1.bounds[0]))
+        .store(ret.bounds[0]);
+    (w0 * Float4::load(b0.bounds[1]) + w1 * Float4::load(b1.bounds[1]))
+        .store(ret.bounds[1]);
+    return ret;
+  }
+
+  // 再帰的にBVHのtraverseを行う
+  // segment, weightはray.timeを含むキーフレームの区間と区間内の位置
+  bool intersectNode(int nodeIdx, const Ray& ray, const PrecomputedRay& rayData,
+                     unsigned int segment, float weight,
+                     IntersectInfo& info) const {
+    bool hit = false;
+    const BVHNode& node = nodes[nodeIdx];
+
+    // 時刻ray.timeでのAABBとの交差判定
+    if (nodeAABB(nodeIdx, segment, weight).intersect(ray, rayData)) {
+      // 葉ノードの場合
+      if (node.nPrimitives > 0) {
+        // ノードに含まれる全てのPrimitiveと交差計算
+        const int primEnd = node.primIndicesOffset + node.nPrimitives;
+        for (int i = node.primIndicesOffset; i < primEnd; ++i) {
+          if (Triangle(polygon, primIndices[i]).intersectAtTime(ray, info)) {
+            // intersectしたらrayのtmaxを更新
+            hit = true;
+            ray.tmax = info.t;
+          }
+        }
+      }
+      // 中間ノードの場合
+      else {
+        // rayの方向に応じて最適な順番で交差判定をする
+        const int sign = rayData.dirInvSign[node.axis];
+        hit |= intersectNode(node.childOffset + sign, ray, rayData, segment,
+                             weight, info);
+        hit |= intersectNode(node.childOffset + 1 - sign, ray, rayData,
+                             segment, weight, info);
+      }
+    }
+
+    return hit;
+  }
+
+ public:
+  MotionBVH(const Polygon& polygon,
+            MotionBounds motionBounds = MotionBounds::INTERPOLATED)
+      : polygon(&polygon),
+        nBoundsPerNode(motionBounds == MotionBounds::INTERPOLATED
+                           ? polygon.nKeyframes
+                           : 1) {
+    // Polygonの全ての面をPrimitiveとして追加していく
+    primIndices.resize(polygon.nFaces());
+    std::iota(primIndices.begin(), primIndices.end(), 0);
+  }
+
+  // BVHを構築する
+  void buildBVH() {
+    // 各Primitiveの全てのキーフレームを含むAABBと中心点を事前計算しておく
+    const BuildPrimitives prims(polygon->nFaces(), [&](uint32_t prim) {
+      const Triangle triangle(polygon, prim);
+      AABB bbox;
+      for (unsigned int k = 0; k < polygon->nKeyframes; ++k) {
+        bbox = mergeAABB(bbox, triangle.calcAABB(k));
+      }
+      return bbox;
+    });
+
+    // BVHの構築をルートノードから開始
+    // NOTE: 構築し直す場合に前回の統計情報を数えないようにリセットする
+    stats = BVHStatistics();
+    nodes.resize(1);
+    buildMedianSplitNode(
+        0, 0, primIndices.size(), 4, prims, primIndices.data(), nodes,
+        [&](int nodeIdx, const AABB&, int primStart, int nPrims) {
+          setLeafNode(nodeIdx, primStart, nPrims);
+        },
+        [&](int nodeIdx, const AABB&, int childOffset, int axis) {
+          setInternalNode(nodeIdx, childOffset, axis);
+        });
+
+    // 総ノード数を計算
+    stats.nNodes = stats.nInternalNodes + stats.nLeafNodes;
+
+    // ノードのAABBを計算
+    // NOTE: 前回の構築のAABBとまとめないように空のAABBで埋め直す
+    bounds.assign(nBoundsPerNode * nodes.size(), AABB());
+    calcNodeBounds(0);
+  }
+
+  // ノード数を返す
+  int nNodes() const { return stats.nNodes; }
+  // 中間ノード数を返す
+  int nInternalNodes() const { return stats.nInternalNodes; }
+  // 葉ノード数を返す
+  int nLeafNodes() const { return stats.nLeafNodes; }
+  // ノードとPrimitiveが使用しているメモリ量(Byte)を返す
+  size_t memoryUsage() const {
+    return sizeof(BVHNode) * nodes.capacity() +
+           sizeof(AABB) * bounds.capacity() +
+           sizeof(uint32_t) * primIndices.capacity();
+  }
+
+  // 全ての時刻を含むバウンディングボックスを返す
+  AABB rootAABB() const {
+    AABB ret;
+    if (nodes.size() > 0) {
+      for (int k = 0; k < nBoundsPerNode; ++k) {
+        ret = mergeAABB(ret, bounds[k]);
+      }
+    }
+    return ret;
+  }
+
+  // 時刻ray.timeで最も近い交差点のt, barycentric, primIDを求める
+  // NOTE: 交差点の情報(位置, 法線など)は計算しない
+  bool intersectClosest(const Ray& ray, IntersectInfo& info) const {
+    const PrecomputedRay rayData(ray);
+    float weight;
+    const unsigned int segment = polygon->getKeyframeSegment(ray.time, weight);
+    return intersectNode(0, ray, rayData, segment, weight, info);
+  }
+
+  // traverseをする
+  bool intersect(const Ray& ray, IntersectInfo& info) const {
+    if (!intersectClosest(ray, info)) {
+      return false;
+    }
+
+    // 最も近い交差点の情報を計算する
+    Triangle(polygon, info.primID).calcSurfaceInfo(ray, info);
+    return true;
+  }
+};
+
+#endif
@@ -1,22 +1,59 @@
 #ifndef _OPTIMIZED_BVH_H
 #define _OPTIMIZED_BVH_H
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <stack>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "bvh/build-primitives.hpp"
+#include "core/closest-point-info.hpp"
+#include "core/frustum.hpp"
+#include "core/page-allocator.hpp"
+#include "core/parallel.hpp"
+#include "core/point-batch.hpp"
+#include "core/proximity-info.hpp"
+#include "core/ray-batch.hpp"
+#include "core/sphere.hpp"
+#include "core/transform.hpp"
 #include "core/triangle.hpp"
+#include "core/triangle-pair.hpp"
+#include "core/triangle4.hpp"
 
 class OptimizedBVH {
+ public:
+  // 葉ノードの交差判定の方法
+  enum class LeafIntersector {
+    TRIANGLE,   // Triangleで1つずつ判定する(Möller–Trumbore)
+    TRIANGLE4,  // Triangle4で4つまとめて判定する(watertight)
+  };
+
+  // ノード配列の並び順
+  enum class NodeLayout {
+    DEPTH_FIRST,    // 深さ優先順
+    VAN_EMDE_BOAS,  // van Emde Boas順(cache-oblivious)
+  };
+
  private:
-  std::vector<Triangle> primitives;  // Primitive(三角形)の配列
+  const Polygon* polygon;            // Primitive(三角形)を含むPolygon
+  PageVector<uint32_t> primIndices;  // Primitiveの面番号の配列
 
   // ノードを表す構造体
   // NOTE: 32ByteにAlignmentすることでキャッシュ効率を良くする
+  // NOTE: 2つの子ノードは常に隣り合わせ(childOffset, childOffset + 1)に置く.
+  // 兄弟ノードの組を単位にすることで, ノード配列を自由に並び替えられる
   struct alignas(32) BVHNode {
     AABB bbox;  // バウンディングボックス
     union {
       uint32_t primIndicesOffset;  // primIndicesへのオフセット
-      uint32_t secondChildOffset;  // 2番目の子へのオフセット
+      uint32_t childOffset;        // 子ノードの組へのオフセット
+      uint32_t triangle4Offset;    // leafTrianglesへのオフセット(TRIANGLE4)
     };
     uint16_t nPrimitives{
         0};  // ノードに含まれるPrimitiveの数(中間ノードの場合は0)
@@ -30,143 +67,553 @@ class OptimizedBVH {
     int nLeafNodes{0};      // 葉ノードの数
   };
 
-  std::vector<BVHNode> nodes;  // ノード配列(深さ優先順)
-  BVHStatistics stats;         // BVHの統計情報
+  PageVector<BVHNode> nodes;  // ノード配列(nodeLayoutの順)
+  BVHStatistics stats;        // BVHの統計情報
+
+  LeafIntersector leafIntersector;      // 葉ノードの交差判定の方法
+  NodeLayout nodeLayout;                // ノード配列の並び順
+  PageVector<Triangle4> leafTriangles;  // 葉ノードごとの三角形(TRIANGLE4)
 
-  // 葉ノードを配列に追加する
-  void addLeafNode(const AABB& bbox, int primStart, int nPrims) {
-    BVHNode node;
+  // NUMAノードごとの複製
+  std::vector<std::unique_ptr<OptimizedBVH>> replicas;
+
+  // otherの複製をnumaNodeのNUMAノードに作る
+  OptimizedBVH(const OptimizedBVH& other, int numaNode)
+      : polygon(other.polygon),
+        primIndices(other.primIndices, PageAllocator<uint32_t>(numaNode)),
+        nodes(other.nodes, PageAllocator<BVHNode>(numaNode)),
+        stats(other.stats),
+        leafIntersector(other.leafIntersector),
+        nodeLayout(other.nodeLayout),
+        leafTriangles(other.leafTriangles,
+                      PageAllocator<Triangle4>(numaNode)) {}
+
+  // 実行中のNUMAノードの複製を返す. 複製が無い場合はnullptrを返す
+  const OptimizedBVH* localReplica() const {
+    if (replicas.empty()) return nullptr;
+    const size_t numaNode = currentNumaNode();
+    return numaNode < replicas.size() ? replicas[numaNode].get() : nullptr;
+  }
+
+  // 葉ノードをセットする
+  void setLeafNode(int nodeIdx, const AABB& bbox, int primStart, int nPrims) {
+    BVHNode& node = nodes[nodeIdx];
     node.bbox = bbox;
     node.primIndicesOffset = primStart;
     node.nPrimitives = nPrims;
-    nodes.push_back(node);
     stats.nLeafNodes++;
   }
 
-  // 再帰的にBVHのノードを構築していく
-  void buildBVHNode(int primStart, int primEnd) {
-    // AABBの計算
-    AABB bbox;
-    for (int i = primStart; i < primEnd; ++i) {
-      bbox = mergeAABB(bbox, primitives[i].calcAABB());
+  // 中間ノードをセットする
+  void setInternalNode(int nodeIdx, const AABB& bbox, int childOffset,
+                       int axis) {
+    BVHNode& node = nodes[nodeIdx];
+    node.bbox = bbox;
+    node.childOffset = childOffset;
+    node.axis = axis;
+    stats.nInternalNodes++;
+  }
+
+  // ノードの組(ルートノードは単独)の先頭の位置から, 組のノード数を返す
+  static int unitSize(uint32_t unit) { return unit == 0 ? 1 : 2; }
+
+  // ノードの組を根とする部分木の高さを返す
+  int calcUnitHeight(uint32_t unit) const {
+    int height = 0;
+    for (int i = 0; i < unitSize(unit); ++i) {
+      const BVHNode& node = nodes[unit + i];
+      if (node.nPrimitives == 0) {
+        height = std::max(height, calcUnitHeight(node.childOffset));
+      }
     }
+    return height + 1;
+  }
 
-    // 含まれるPrimitiveが少ない場合は葉ノードにする
-    const int nPrims = primEnd - primStart;
-    if (nPrims <= 4) {
-      addLeafNode(bbox, primStart, nPrims);
+  // ノードの組からdepth段下にある全てのノードの組に対してfを呼ぶ
+  template <typename F>
+  void forEachUnitAtDepth(uint32_t unit, int depth, const F& f) const {
+    if (depth == 0) {
+      f(unit);
       return;
     }
+    for (int i = 0; i < unitSize(unit); ++i) {
+      const BVHNode& node = nodes[unit + i];
+      if (node.nPrimitives == 0) {
+        forEachUnitAtDepth(node.childOffset, depth - 1, f);
+      }
+    }
+  }
 
-    // 分割用に各Primitiveの中心点を含むAABBを計算
-    // NOTE: bboxをそのまま使ってしまうとsplitが失敗することが多い
-    AABB splitAABB;
-    for (int i = primStart; i < primEnd; ++i) {
-      splitAABB = mergeAABB(splitAABB, primitives[i].calcAABB().center());
-    }
-
-    // 分割軸
-    const int splitAxis = splitAABB.longestAxis();
-
-    // AABBの分割(等数分割)
-    const int splitIdx = primStart + nPrims / 2;
-    std::nth_element(primitives.begin() + primStart,
-                     primitives.begin() + splitIdx,
-                     primitives.begin() + primEnd,
-                     [&](const auto& prim1, const auto& prim2) {
-                       return prim1.calcAABB().center()[splitAxis] <
-                              prim2.calcAABB().center()[splitAxis];
-                     });
-
-    // 分割が失敗した場合は葉ノードを作成
-    if (splitIdx == primStart || splitIdx == primEnd) {
-      std::cout << "splitting failed" << std::endl;
-      std::cout << "nPrimitives: " << nPrims << std::endl;
-      std::cout << "splitAxis: " << splitAxis << std::endl;
-      std::cout << "primStart: " << primStart << std::endl;
-      std::cout << "splitIdx: " << splitIdx << std::endl;
-      std::cout << "primEnd: " << primEnd << std::endl;
-      std::cout << std::endl;
-      addLeafNode(bbox, primStart, nPrims);
+  // 高さheightまでの部分木を, van Emde Boas順でorderに追加していく
+  // 部分木を上半分と下半分に分け, 上半分の木, 下半分の各木の順に再帰的に並べる
+  void layoutVanEmdeBoas(uint32_t unit, int height,
+                         std::vector<uint32_t>& order) const {
+    if (height == 1) {
+      order.push_back(unit);
       return;
     }
+    const int topHeight = height / 2;
+    layoutVanEmdeBoas(unit, topHeight, order);
+    forEachUnitAtDepth(unit, topHeight, [&](uint32_t bottomUnit) {
+      layoutVanEmdeBoas(bottomUnit, height - topHeight, order);
+    });
+  }
 
-    // ノードを配列に追加する. その際に自分の位置を覚えておく
-    const int parentOffset = nodes.size();
-    BVHNode node;
-    node.bbox = bbox;
-    node.primIndicesOffset = primStart;
-    node.axis = splitAxis;
-    nodes.push_back(node);
-    stats.nInternalNodes++;
+  // ノード配列をvan Emde Boas順に並び替え, 子ノードへのオフセットを修正する
+  // NOTE: どの階層のキャッシュ(キャッシュライン, ページ)の大きさに対しても,
+  // 親子関係にあるノードが同じブロックに入りやすくなる
+  void reorderNodesVanEmdeBoas() {
+    std::vector<uint32_t> order;
+    order.reserve(nodes.size());
+    layoutVanEmdeBoas(0, calcUnitHeight(0), order);
 
-    // 左の子ノードを配列に追加していく
-    buildBVHNode(primStart, splitIdx);
+    // 元の位置から並び替え後の位置への対応を計算する
+    std::vector<uint32_t> newIndices(nodes.size());
+    uint32_t newIdx = 0;
+    for (const uint32_t unit : order) {
+      for (int i = 0; i < unitSize(unit); ++i) {
+        newIndices[unit + i] = newIdx++;
+      }
+    }
 
-    // 右の子へのオフセットを計算し, 親ノードにセットする
-    const int secondChildOffset = nodes.size();
-    nodes[parentOffset].secondChildOffset = secondChildOffset;
+    PageVector<BVHNode> newNodes(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      BVHNode node = nodes[i];
+      if (node.nPrimitives == 0) {
+        node.childOffset = newIndices[node.childOffset];
+      }
+      newNodes[newIndices[i]] = node;
+    }
+    nodes.swap(newNodes);
+  }
 
-    // 右の子ノードを配列に追加していく
-    buildBVHNode(splitIdx, primEnd);
+  // 葉ノードに含まれる三角形をTriangle4にまとめる
+  // NOTE: 葉ノードのprimIndicesOffsetはtriangle4Offsetに置き換わる
+  void buildLeafTriangles() {
+    leafTriangles.reserve(stats.nLeafNodes);
+    for (BVHNode& node : nodes) {
+      if (node.nPrimitives == 0) continue;
+      leafTriangles.emplace_back(polygon,
+                                 primIndices.data() + node.primIndicesOffset,
+                                 node.nPrimitives);
+      node.triangle4Offset = leafTriangles.size() - 1;
+    }
   }
 
   // 再帰的にBVHのtraverseを行う
+  // octantはレイの方向の象限(PrecomputedRay::octant),
+  // anyHitがtrueの場合は最初に交差が見つかった時点で終了する
+  // triangle4がtrueの場合は葉ノードをTriangle4で判定し, watertightDataを使う
+  // (falseの場合はnullptr)
+  // NOTE: 象限ごとにインスタンス化することで,
+  // 子ノードの順番やAABBの近い面の選択がコンパイル時に決まる
   // NOTE:
   // 再帰なし版も実装してみたがこっちの方が早かった(simple-renderingで0.2秒差)
-  bool intersectNode(int nodeIdx, const Ray& ray, const Vec3& dirInv,
-                     const int dirInvSign[3], IntersectInfo& info) const {
+  template <int octant, bool anyHit, bool triangle4>
+  bool intersectNode(int nodeIdx, const Ray& ray, const PrecomputedRay& rayData,
+                     const WatertightRayData* watertightData,
+                     IntersectInfo& info) const {
     bool hit = false;
     const BVHNode& node = nodes[nodeIdx];
 
     // AABBとの交差判定
-    if (node.bbox.intersect(ray, dirInv, dirInvSign)) {
+    if (node.bbox.intersect<octant>(ray, rayData)) {
       // 葉ノードの場合
       if (node.nPrimitives > 0) {
-        // ノードに含まれる全てのPrimitiveと交差計算
-        const int primEnd = node.primIndicesOffset + node.nPrimitives;
-        for (int i = node.primIndicesOffset; i < primEnd; ++i) {
-          if (primitives[i].intersect(ray, info)) {
-            // intersectしたらrayのtmaxを更新
+        if constexpr (triangle4) {
+          // ノードに含まれる全てのPrimitiveとまとめて交差計算
+          if (leafTriangles[node.triangle4Offset].intersect(
+                  ray, *watertightData, info)) {
             hit = true;
             ray.tmax = info.t;
           }
+        } else {
+          // ノードに含まれる全てのPrimitiveと交差計算
+          const int primEnd = node.primIndicesOffset + node.nPrimitives;
+          for (int i = node.primIndicesOffset; i < primEnd; ++i) {
+            if (Triangle(polygon, primIndices[i]).intersect(ray, info)) {
+              if constexpr (anyHit) return true;
+              // intersectしたらrayのtmaxを更新
+              hit = true;
+              ray.tmax = info.t;
+            }
+          }
         }
       }
       // 中間ノードの場合
       else {
         // 子ノードとの交差判定
         // rayの方向に応じて最適な順番で交差判定をする
-        if (dirInvSign[node.axis] == 0) {
-          hit |= intersectNode(nodeIdx + 1, ray, dirInv, dirInvSign, info);
-          hit |= intersectNode(node.secondChildOffset, ray, dirInv, dirInvSign,
-                               info);
-        } else {
-          hit |= intersectNode(node.secondChildOffset, ray, dirInv, dirInvSign,
-                               info);
-          hit |= intersectNode(nodeIdx + 1, ray, dirInv, dirInvSign, info);
+        const int sign = (octant >> node.axis) & 1;
+        const int nearChild = node.childOffset + sign;
+        const int farChild = node.childOffset + 1 - sign;
+
+        // 近い子を調べている間に, 遠い子の子ノードを先読みしておく
+        // NOTE: 遠い子自体は近い子と隣り合っているので先読みは不要
+        const BVHNode& farNode = nodes[farChild];
+        if (farNode.nPrimitives == 0) {
+          prefetch(&nodes[farNode.childOffset]);
         }
+
+        hit |= intersectNode<octant, anyHit, triangle4>(nearChild, ray, rayData,
+                                                        watertightData, info);
+        if (anyHit && hit) return true;
+        hit |= intersectNode<octant, anyHit, triangle4>(farChild, ray, rayData,
+                                                        watertightData, info);
       }
     }
 
     return hit;
   }
 
- public:
-  OptimizedBVH(const Polygon& polygon) {
-    // PolygonからTriangleを抜き出して追加していく
-    for (unsigned int f = 0; f < polygon.nFaces(); ++f) {
-      primitives.emplace_back(&polygon, f);
+  // 葉ノードに含まれるi番目のPrimitiveの面番号を返す
+  uint32_t leafFaceID(const BVHNode& node, int i) const {
+    if (leafIntersector == LeafIntersector::TRIANGLE4) {
+      return leafTriangles[node.triangle4Offset].getFaceID(i);
+    } else {
+      return primIndices[node.primIndicesOffset + i];
+    }
+  }
+
+  // 最近傍点の探索で使う優先度付きキューの要素
+  struct PointQueueEntry {
+    float distance2;   // 点からノードのAABBまでの距離の2乗
+    uint32_t nodeIdx;  // ノードの位置
+
+    // 距離が近いほど優先度が高い
+    bool operator<(const PointQueueEntry& other) const {
+      return distance2 > other.distance2;
+    }
+  };
+
+  // 距離の2乗の相対誤差がこの範囲の三角形は同じ距離とみなす
+  // NOTE: 辺や頂点が最も近い場合は, 隣接する三角形が丸め誤差の範囲で
+  // 同じ距離になる
+  static constexpr float DISTANCE2_TIE_SCALE = 1.0f + 1e-5f;
+
+  // 再帰的にshapeと重なる三角形を探し, その面番号に対してfを呼ぶ
+  // fがfalseを返した場合はその時点でfalseを返す
+  template <typename Shape, typename F>
+  bool overlapNode(int nodeIdx, const Shape& shape, const F& f) const {
+    const BVHNode& node = nodes[nodeIdx];
+    if (!shape.overlaps(node.bbox)) return true;
+
+    // 葉ノードの場合
+    if (node.nPrimitives > 0) {
+      for (int i = 0; i < node.nPrimitives; ++i) {
+        const uint32_t faceID = leafFaceID(node, i);
+        const auto indices = polygon->getIndices(faceID);
+        if (shape.overlaps(polygon->getVertex(indices[0]),
+                           polygon->getVertex(indices[1]),
+                           polygon->getVertex(indices[2])) &&
+            !f(faceID)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    // 中間ノードの場合
+    else {
+      return overlapNode(node.childOffset, shape, f) &&
+             overlapNode(node.childOffset + 1, shape, f);
+    }
+  }
+
+  // 面の頂点座標をvにセットする
+  void getTriangleVertices(uint32_t faceID, Vec3 v[3]) const {
+    const auto indices = polygon->getIndices(faceID);
+    for (int i = 0; i < 3; ++i) {
+      v[i] = polygon->getVertex(indices[i]);
+    }
+  }
+
+  // 葉ノードに含まれる三角形をtransformで変換してvにセットする
+  void getLeafTriangles(const BVHNode& node, const Transform& transform,
+                        Vec3 v[4][3], uint32_t faceIDs[4]) const {
+    for (int i = 0; i < node.nPrimitives; ++i) {
+      faceIDs[i] = leafFaceID(node, i);
+      getTriangleVertices(faceIDs[i], v[i]);
+      for (int j = 0; j < 3; ++j) {
+        v[i][j] = transform.apply(v[i][j]);
+      }
+    }
+  }
+
+  // ノードの組(node, otherNode)のうち, 子ノードに降りるのがnodeの方か
+  // 葉ノードでない方のうち, AABBが大きい方を降りる
+  static bool descendFirst(const BVHNode& node, const BVHNode& otherNode) {
+    if (otherNode.nPrimitives > 0) return true;
+    if (node.nPrimitives > 0) return false;
+    return length2(node.bbox.bounds[1] - node.bbox.bounds[0]) >=
+           length2(otherNode.bbox.bounds[1] - otherNode.bbox.bounds[0]);
+  }
+
+  // 再帰的にノードの組(nodeIdx, otherのotherNodeIdx)の中で交差する
+  // 三角形の組を探し, その面番号に対してfを呼ぶ
+  // fがfalseを返した場合はその時点でfalseを返す
+  // transformはotherの座標系からこのBVHの座標系への変換
+  template <typename F>
+  bool collideNode(uint32_t nodeIdx, const OptimizedBVH& other,
+                   uint32_t otherNodeIdx, const Transform& transform,
+                   const F& f) const {
+    const BVHNode& node = nodes[nodeIdx];
+    const BVHNode& otherNode = other.nodes[otherNodeIdx];
+    if (!node.bbox.overlaps(transformAABB(transform, otherNode.bbox))) {
+      return true;
+    }
+
+    // 葉ノード同士の場合は三角形同士の交差判定をする
+    if (node.nPrimitives > 0 && otherNode.nPrimitives > 0) {
+      Vec3 otherVertices[4][3];
+      uint32_t otherFaceIDs[4];
+      other.getLeafTriangles(otherNode, transform, otherVertices, otherFaceIDs);
+      for (int i = 0; i < node.nPrimitives; ++i) {
+        const uint32_t faceID = leafFaceID(node, i);
+        Vec3 vertices[3];
+        getTriangleVertices(faceID, vertices);
+        for (int j = 0; j < otherNode.nPrimitives; ++j) {
+          if (trianglesOverlap(vertices, otherVertices[j]) &&
+              !f(faceID, otherFaceIDs[j])) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    if (descendFirst(node, otherNode)) {
+      return collideNode(node.childOffset, other, otherNodeIdx, transform,
+                         f) &&
+             collideNode(node.childOffset + 1, other, otherNodeIdx, transform,
+                         f);
+    } else {
+      return collideNode(nodeIdx, other, otherNode.childOffset, transform,
+                         f) &&
+             collideNode(nodeIdx, other, otherNode.childOffset + 1, transform,
+                         f);
+    }
+  }
+
+  // 再帰的にノードの組(nodeIdx, otherのotherNodeIdx)の中で最も近い
+  // 三角形の組を探し, best2(距離の2乗)より近ければbest2とinfoを更新する
+  // transformはotherの座標系からこのBVHの座標系への変換
+  // NOTE: AABB同士の距離がbest2以上のノードの組は調べない
+  bool minDistanceNode(uint32_t nodeIdx, const OptimizedBVH& other,
+                       uint32_t otherNodeIdx, const Transform& transform,
+                       float& best2, ProximityInfo& info) const {
+    const BVHNode& node = nodes[nodeIdx];
+    const BVHNode& otherNode = other.nodes[otherNodeIdx];
+
+    // 葉ノード同士の場合は三角形同士の距離を計算する
+    if (node.nPrimitives > 0 && otherNode.nPrimitives > 0) {
+      Vec3 otherVertices[4][3];
+      uint32_t otherFaceIDs[4];
+      other.getLeafTriangles(otherNode, transform, otherVertices, otherFaceIDs);
+      AABB otherBBoxes[4];
+      for (int j = 0; j < otherNode.nPrimitives; ++j) {
+        for (const Vec3& v : otherVertices[j]) {
+          otherBBoxes[j] = mergeAABB(otherBBoxes[j], v);
+        }
+      }
+
+      bool found = false;
+      for (int i = 0; i < node.nPrimitives; ++i) {
+        const uint32_t faceID = leafFaceID(node, i);
+        Vec3 vertices[3];
+        getTriangleVertices(faceID, vertices);
+        AABB bbox;
+        for (const Vec3& v : vertices) {
+          bbox = mergeAABB(bbox, v);
+        }
+        for (int j = 0; j < otherNode.nPrimitives; ++j) {
+          // 三角形のAABB同士の距離で先に枝刈りする
+          if (bbox.distance2(otherBBoxes[j]) >= best2) continue;
+          Vec3 p, otherP;
+          const float d2 =
+              closestPointsOnTriangles(vertices, otherVertices[j], p, otherP);
+          if (d2 < best2) {
+            found = true;
+            best2 = d2;
+            info.position = p;
+            info.otherPosition = otherP;
+            info.primID = faceID;
+            info.otherPrimID = otherFaceIDs[j];
+          }
+        }
+      }
+      return found;
+    }
+
+    // 子ノードの組のうち, AABB同士の距離が近い方から調べる
+    uint32_t children[2][2];
+    if (descendFirst(node, otherNode)) {
+      children[0][0] = node.childOffset;
+      children[1][0] = node.childOffset + 1;
+      children[0][1] = children[1][1] = otherNodeIdx;
+    } else {
+      children[0][0] = children[1][0] = nodeIdx;
+      children[0][1] = otherNode.childOffset;
+      children[1][1] = otherNode.childOffset + 1;
+    }
+    float lower2[2];
+    for (int i = 0; i < 2; ++i) {
+      lower2[i] = nodes[children[i][0]].bbox.distance2(
+          transformAABB(transform, other.nodes[children[i][1]].bbox));
+    }
+    const int first = lower2[0] <= lower2[1] ? 0 : 1;
+
+    bool found = false;
+    for (const int i : {first, 1 - first}) {
+      if (lower2[i] < best2) {
+        found |= minDistanceNode(children[i][0], other, children[i][1],
+                                 transform, best2, info);
+      }
+    }
+    return found;
+  }
+
+  // 並列に処理するために, ルートノード同士の組をnPairs個以上の
+  // 子孫ノードの組に分割する. keep(nodeIdx, otherNodeIdx)がfalseの組は除く
+  // NOTE: 葉ノード同士の組はそれ以上分割しない
+  template <typename Keep>
+  std::vector<std::pair<uint32_t, uint32_t>> splitNodePairs(
+      const OptimizedBVH& other, size_t nPairs, const Keep& keep) const {
+    std::vector<std::pair<uint32_t, uint32_t>> pairs, nextPairs;
+    if (keep(0, 0)) pairs.emplace_back(0, 0);
+
+    bool split = true;
+    while (split && pairs.size() < nPairs) {
+      split = false;
+      nextPairs.clear();
+      for (const auto& [nodeIdx, otherNodeIdx] : pairs) {
+        const BVHNode& node = nodes[nodeIdx];
+        const BVHNode& otherNode = other.nodes[otherNodeIdx];
+        if (node.nPrimitives > 0 && otherNode.nPrimitives > 0) {
+          nextPairs.emplace_back(nodeIdx, otherNodeIdx);
+          continue;
+        }
+
+        split = true;
+        for (uint32_t i = 0; i < 2; ++i) {
+          const auto child =
+              descendFirst(node, otherNode)
+                  ? std::make_pair(node.childOffset + i, otherNodeIdx)
+                  : std::make_pair(nodeIdx, otherNode.childOffset + i);
+          if (keep(child.first, child.second)) {
+            nextPairs.push_back(child);
+          }
+        }
+      }
+      pairs.swap(nextPairs);
+    }
+    return pairs;
+  }
+
+  // レイの方向の象限に応じたintersectNodeを呼ぶ
+  template <bool anyHit, bool triangle4>
+  bool traverseOctant(const Ray& ray, const PrecomputedRay& rayData,
+                      const WatertightRayData* watertightData,
+                      IntersectInfo& info) const {
+    switch (rayData.octant) {
+      case 0:
+        return intersectNode<0, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      case 1:
+        return intersectNode<1, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      case 2:
+        return intersectNode<2, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      case 3:
+        return intersectNode<3, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      case 4:
+        return intersectNode<4, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      case 5:
+        return intersectNode<5, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      case 6:
+        return intersectNode<6, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+      default:
+        return intersectNode<7, anyHit, triangle4>(0, ray, rayData,
+                                                    watertightData, info);
+    }
+  }
+
+  // traverseをする
+  // watertightな判定のshear変換はTRIANGLE4の場合のみ計算する
+  template <bool anyHit>
+  bool traverse(const Ray& ray, const PrecomputedRay& rayData,
+                IntersectInfo& info) const {
+    if (leafIntersector == LeafIntersector::TRIANGLE4) {
+      const WatertightRayData watertightData(ray);
+      return traverseOctant<anyHit, true>(ray, rayData, &watertightData, info);
     }
+    return traverseOctant<anyHit, false>(ray, rayData, nullptr, info);
+  }
+
+ public:
+  OptimizedBVH(const Polygon& polygon,
+               LeafIntersector leafIntersector = LeafIntersector::TRIANGLE,
+               NodeLayout nodeLayout = NodeLayout::DEPTH_FIRST)
+      : polygon(&polygon),
+        leafIntersector(leafIntersector),
+        nodeLayout(nodeLayout) {
+    assert(!polygon.hasMotion());
+
+    // Polygonの全ての面をPrimitiveとして追加していく
+    primIndices.resize(polygon.nFaces());
+    std::iota(primIndices.begin(), primIndices.end(), 0);
   }
 
   // BVHを構築する
   void buildBVH() {
+    // 各PrimitiveのAABBと中心点を事前計算しておく
+    const BuildPrimitives prims(polygon->nFaces(), [&](uint32_t prim) {
+      return Triangle(polygon, prim).calcAABB();
+    });
+
+    // 前回の構築で作った複製, 葉ノードの三角形, 統計情報は捨てる
+    replicas.clear();
+    leafTriangles.clear();
+    stats = BVHStatistics();
+
     // BVHの構築をルートノードから開始
-    buildBVHNode(0, primitives.size());
+    nodes.resize(1);
+    buildMedianSplitNode(
+        0, 0, primIndices.size(), 4, prims, primIndices.data(), nodes,
+        [&](int nodeIdx, const AABB& bbox, int primStart, int nPrims) {
+          setLeafNode(nodeIdx, bbox, primStart, nPrims);
+        },
+        [&](int nodeIdx, const AABB& bbox, int childOffset, int axis) {
+          setInternalNode(nodeIdx, bbox, childOffset, axis);
+        });
 
     // 総ノード数を計算
     stats.nNodes = stats.nInternalNodes + stats.nLeafNodes;
+
+    if (nodeLayout == NodeLayout::VAN_EMDE_BOAS) {
+      reorderNodesVanEmdeBoas();
+    }
+
+    if (leafIntersector == LeafIntersector::TRIANGLE4) {
+      buildLeafTriangles();
+    }
+  }
+
+  // NUMAノードごとにBVHの複製を作る. traverseでは実行中のノードの複製を使う
+  // NOTE: NUMAノードが1つの場合(BVH_USE_NUMAが無効の場合を含む)は何もしない.
+  // replicasはノード番号で引くので, 使われていない番号はnullptrのままにする
+  void replicateToNumaNodes() {
+    replicas.clear();
+    const std::vector<int> nodeIDs = numaNodes();
+    if (nodeIDs.size() <= 1) return;
+    replicas.resize(*std::max_element(nodeIDs.begin(), nodeIDs.end()) + 1);
+    for (const int numaNode : nodeIDs) {
+      replicas[numaNode].reset(new OptimizedBVH(*this, numaNode));
+    }
   }
 
   // ノード数を返す
@@ -175,6 +622,16 @@ class OptimizedBVH {
   int nInternalNodes() const { return stats.nInternalNodes; }
   // 葉ノード数を返す
   int nLeafNodes() const { return stats.nLeafNodes; }
+  // ノードとPrimitiveが使用しているメモリ量(Byte)を返す
+  size_t memoryUsage() const {
+    size_t ret = sizeof(BVHNode) * nodes.capacity() +
+                 sizeof(uint32_t) * primIndices.capacity() +
+                 sizeof(Triangle4) * leafTriangles.capacity();
+    for (const auto& replica : replicas) {
+      if (replica) ret += replica->memoryUsage();
+    }
+    return ret;
+  }
 
   // 全体のバウンディングボックスを返す
   AABB rootAABB() const {
@@ -185,15 +642,345 @@ class OptimizedBVH {
     }
   }
 
+  // 最も近い交差点のt, barycentric, primIDを求める
+  // NOTE: 交差点の情報(位置, 法線など)は計算しない
+  bool intersectClosest(const Ray& ray, IntersectInfo& info) const {
+    // 複製がある場合は, 実行中のNUMAノードの複製でtraverseする
+    if (const OptimizedBVH* replica = localReplica()) {
+      return replica->intersectClosest(ray, info);
+    }
+
+    // レイの方向の逆数と符号を事前計算しておく
+    const PrecomputedRay rayData(ray);
+    return traverse<false>(ray, rayData, info);
+  }
+
+  // レイの範囲内に交差する三角形が1つでもあるか判定する(遮蔽判定)
+  // NOTE: 最も近い交差点を探さないので, intersectより速い
+  bool intersectAny(const Ray& ray) const {
+    if (const OptimizedBVH* replica = localReplica()) {
+      return replica->intersectAny(ray);
+    }
+
+    // NOTE: rayのtmaxを更新しないようにコピーしておく
+    const Ray r = ray;
+    const PrecomputedRay rayData(r);
+    IntersectInfo info;
+    return traverse<true>(r, rayData, info);
+  }
+
   // traverseをする
   bool intersect(const Ray& ray, IntersectInfo& info) const {
-    // レイの方向の逆数と符号を事前計算しておく
-    const Vec3 dirInv = 1.0f / ray.direction;
-    int dirInvSign[3];
-    for (int i = 0; i < 3; ++i) {
-      dirInvSign[i] = dirInv[i] > 0 ? 0 : 1;
+    if (!intersectClosest(ray, info)) {
+      return false;
+    }
+
+    // 最も近い交差点の情報を計算する
+    Triangle(polygon, info.primID).calcSurfaceInfo(ray, info);
+    return true;
+  }
+
+  // 点pに最も近い三角形上の点を求め, infoにセットする
+  // maxDistance以内に三角形が無い場合はfalseを返す
+  // NOTE: AABBまでの距離が近いノードから順に調べ(best-first),
+  // それまでに見つかった点より遠いノードは調べない
+  // NOTE: 辺や頂点が最も近い場合は, pへの向きと面法線が最も揃っている三角形を
+  // 選ぶ. 閉じたメッシュではinfo.signedDistanceの符号が内外判定になる
+  bool closestPoint(
+      const Vec3& p, ClosestPointInfo& info,
+      float maxDistance = std::numeric_limits<float>::infinity()) const {
+    if (const OptimizedBVH* replica = localReplica()) {
+      return replica->closestPoint(p, info, maxDistance);
+    }
+    if (nodes.empty()) return false;
+
+    // NOTE: 探索の度に確保しないように, スレッドごとに使い回す
+    thread_local std::vector<PointQueueEntry> queue;
+    queue.clear();
+    queue.push_back({nodes[0].bbox.distance2(p), 0});
+
+    bool found = false;
+    float best2 = maxDistance * maxDistance;  // 見つかった点までの距離の2乗
+    float bestAlignment = 0;  // 見つかった点での, pへの向きと面法線の内積
+    while (!queue.empty()) {
+      std::pop_heap(queue.begin(), queue.end());
+      const PointQueueEntry entry = queue.back();
+      queue.pop_back();
+
+      // 残りのノードは全て見つかった点より遠い
+      if (entry.distance2 > best2 * DISTANCE2_TIE_SCALE) break;
+
+      const BVHNode& node = nodes[entry.nodeIdx];
+      // 葉ノードの場合
+      if (node.nPrimitives > 0) {
+        // ノードに含まれる全てのPrimitiveとの最近傍点を計算
+        for (int i = 0; i < node.nPrimitives; ++i) {
+          const uint32_t faceID = leafFaceID(node, i);
+          const Triangle triangle(polygon, faceID);
+          float barycentric[2];
+          const Vec3 q = triangle.closestPoint(p, barycentric);
+          const float d2 = length2(p - q);
+          if (d2 > best2 * DISTANCE2_TIE_SCALE) continue;
+
+          // 同じ距離とみなせる場合は面法線の向きで選ぶ
+          const Vec3 normal = triangle.faceNormal();
+          const float alignment = std::abs(dot(p - q, normal));
+          const bool closer =
+              found ? d2 * DISTANCE2_TIE_SCALE < best2 : d2 <= best2;
+          if (!closer && (!found || alignment <= bestAlignment)) continue;
+
+          found = true;
+          best2 = d2;
+          bestAlignment = alignment;
+          info.position = q;
+          info.normal = normal;
+          info.barycentric[0] = barycentric[0];
+          info.barycentric[1] = barycentric[1];
+          info.primID = faceID;
+        }
+      }
+      // 中間ノードの場合
+      else {
+        // 見つかった点より近い可能性がある子ノードをキューに追加
+        for (int i = 0; i < 2; ++i) {
+          const uint32_t child = node.childOffset + i;
+          const float d2 = nodes[child].bbox.distance2(p);
+          if (d2 <= best2 * DISTANCE2_TIE_SCALE) {
+            queue.push_back({d2, child});
+            std::push_heap(queue.begin(), queue.end());
+          }
+        }
+      }
+    }
+
+    if (found) {
+      info.distance = std::sqrt(best2);
+      info.geomID = polygon->getGeomID(info.primID);
+    }
+    return found;
+  }
+
+  // 点pから最も近い三角形までの距離を返す
+  float distance(const Vec3& p) const {
+    ClosestPointInfo info;
+    if (!closestPoint(p, info)) {
+      return std::numeric_limits<float>::infinity();
+    }
+    return info.distance;
+  }
+
+  // 点pから最も近い三角形までの符号付き距離を返す
+  // NOTE: 面の裏側(閉じたメッシュの内側)では負になる
+  float signedDistance(const Vec3& p) const {
+    ClosestPointInfo info;
+    if (!closestPoint(p, info)) {
+      return std::numeric_limits<float>::infinity();
+    }
+    return info.signedDistance(p);
+  }
+
+  // 複数の点の最近傍点をまとめて求め, 結果をresultsに書き込む
+  // nThreadsが0の場合はハードウェアのスレッド数で並列に処理する
+  void closestPoint(const PointBatch& points, ClosestPointBatch& results,
+                    unsigned int nThreads = 0) const {
+    parallelFor(
+        0, points.size, 256,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i) {
+            const Vec3 p = points.point(i);
+            const float maxDistance =
+                points.maxDistance ? points.maxDistance[i]
+                                   : std::numeric_limits<float>::infinity();
+            ClosestPointInfo info;
+            const bool found = closestPoint(p, info, maxDistance);
+            results.set(i, found, p, info);
+          }
+        },
+        nThreads);
+  }
+
+  // shapeと重なる全ての三角形の面番号faceIDに対してf(faceID)を呼ぶ
+  // fがfalseを返した場合はその時点で終了する
+  // shapeはAABB, Sphere, Frustumのように, AABBと三角形それぞれとの
+  // 重なり判定overlapsを持つもの
+  // NOTE: ヒープを確保せず, BVHも変更しないので, 複数のスレッドから同時に呼べる
+  template <typename Shape, typename F>
+  void overlap(const Shape& shape, const F& f) const {
+    if (const OptimizedBVH* replica = localReplica()) {
+      replica->overlap(shape, f);
+      return;
     }
-    return intersectNode(0, ray, dirInv, dirInvSign, info);
+    if (nodes.empty()) return;
+    overlapNode(0, shape, f);
+  }
+
+  // shapeと重なる三角形の面番号をprimIDsに書き込み, 重なる三角形の数を返す
+  // NOTE: capacityを超えた分は書き込まないが, 数には含める.
+  // 戻り値がcapacityより大きい場合はバッファを大きくして呼び直す
+  template <typename Shape>
+  size_t overlap(const Shape& shape, uint32_t* primIDs, size_t capacity) const {
+    size_t n = 0;
+    overlap(shape, [&](uint32_t faceID) {
+      if (n < capacity) primIDs[n] = faceID;
+      n++;
+      return true;
+    });
+    return n;
+  }
+
+  // otherと交差する全ての三角形の組に対してf(faceID, otherFaceID)を呼ぶ
+  // fがfalseを返した場合はその時点で終了する
+  // transformはotherの座標系からこのBVHの座標系への変換.
+  // 両方のメッシュがワールド座標系に置かれている場合は,
+  // transform.inverse() * otherTransformを渡す
+  // NOTE: 2つのBVHを同時にtraverseし, AABB同士が重なるノードの組だけを調べる
+  template <typename F>
+  void collide(const OptimizedBVH& other, const Transform& transform,
+               const F& f) const {
+    if (const OptimizedBVH* replica = localReplica()) {
+      replica->collide(other, transform, f);
+      return;
+    }
+    if (nodes.empty() || other.nodes.empty()) return;
+    collideNode(0, other, 0, transform, f);
+  }
+
+  // otherと交差する全ての三角形の組(faceID, otherFaceID)をpairsにセットする
+  // nThreadsが0の場合はハードウェアのスレッド数で並列に処理する
+  // NOTE: ノードの組を部分木の組に分割してスレッドに割り振る.
+  // pairsは並列数によらず同じになるように並び替える
+  void collide(const OptimizedBVH& other, const Transform& transform,
+               std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+               unsigned int nThreads = 0) const {
+    pairs.clear();
+    if (nodes.empty() || other.nodes.empty()) return;
+
+    if (nThreads == 0) {
+      nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    const auto nodePairs = splitNodePairs(
+        other, 16 * nThreads, [&](uint32_t nodeIdx, uint32_t otherNodeIdx) {
+          return nodes[nodeIdx].bbox.overlaps(
+              transformAABB(transform, other.nodes[otherNodeIdx].bbox));
+        });
+
+    std::mutex mutex;
+    parallelFor(
+        0, nodePairs.size(), 1,
+        [&](size_t begin, size_t end) {
+          const OptimizedBVH* replica = localReplica();
+          const OptimizedBVH& bvh = replica ? *replica : *this;
+          std::vector<std::pair<uint32_t, uint32_t>> localPairs;
+          for (size_t i = begin; i < end; ++i) {
+            bvh.collideNode(nodePairs[i].first, other, nodePairs[i].second,
+                            transform,
+                            [&](uint32_t faceID, uint32_t otherFaceID) {
+                              localPairs.emplace_back(faceID, otherFaceID);
+                              return true;
+                            });
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          pairs.insert(pairs.end(), localPairs.begin(), localPairs.end());
+        },
+        nThreads);
+    std::sort(pairs.begin(), pairs.end());
+  }
+
+  // otherとの最短距離と, 最も近い三角形の組をinfoにセットする
+  // transformはotherの座標系からこのBVHの座標系への変換
+  // maxDistance以内に三角形の組が無い場合はfalseを返す
+  // nThreadsが0の場合はハードウェアのスレッド数で並列に処理する
+  // NOTE: AABB同士の距離が近いノードの組から調べ,
+  // それまでに見つかった距離より遠いノードの組は調べない
+  bool minDistance(const OptimizedBVH& other, const Transform& transform,
+                   ProximityInfo& info,
+                   float maxDistance = std::numeric_limits<float>::infinity(),
+                   unsigned int nThreads = 0) const {
+    if (nodes.empty() || other.nodes.empty()) return false;
+
+    if (nThreads == 0) {
+      nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    const float maxDistance2 = maxDistance * maxDistance;
+    const auto lowerBound2 = [&](uint32_t nodeIdx, uint32_t otherNodeIdx) {
+      return nodes[nodeIdx].bbox.distance2(
+          transformAABB(transform, other.nodes[otherNodeIdx].bbox));
+    };
+    auto nodePairs = splitNodePairs(
+        other, nThreads == 1 ? 1 : 16 * nThreads,
+        [&](uint32_t nodeIdx, uint32_t otherNodeIdx) {
+          return lowerBound2(nodeIdx, otherNodeIdx) < maxDistance2;
+        });
+    // 近い組から調べることで, 早く距離の上限を小さくする
+    std::sort(nodePairs.begin(), nodePairs.end(),
+              [&](const auto& a, const auto& b) {
+                return lowerBound2(a.first, a.second) <
+                       lowerBound2(b.first, b.second);
+              });
+
+    // NOTE: 各スレッドは調べ始める時点で最も近い距離を上限にする
+    std::mutex mutex;
+    bool found = false;
+    float best2 = maxDistance2;
+    parallelFor(
+        0, nodePairs.size(), 1,
+        [&](size_t begin, size_t end) {
+          const OptimizedBVH* replica = localReplica();
+          const OptimizedBVH& bvh = replica ? *replica : *this;
+          for (size_t i = begin; i < end; ++i) {
+            float localBest2;
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              localBest2 = best2;
+            }
+            if (lowerBound2(nodePairs[i].first, nodePairs[i].second) >=
+                localBest2) {
+              continue;
+            }
+            ProximityInfo localInfo;
+            if (bvh.minDistanceNode(nodePairs[i].first, other,
+                                    nodePairs[i].second, transform,
+                                    localBest2, localInfo)) {
+              std::lock_guard<std::mutex> lock(mutex);
+              if (localBest2 < best2) {
+                found = true;
+                best2 = localBest2;
+                info = localInfo;
+              }
+            }
+          }
+        },
+        nThreads);
+
+    if (found) {
+      info.distance = std::sqrt(best2);
+    }
+    return found;
+  }
+
+  // 複数のレイをまとめてtraverseし, 結果をhitsに書き込む
+  // nThreadsが0の場合はハードウェアのスレッド数で並列に処理する
+  void intersect(const RayBatch& rays, HitBatch& hits,
+                 unsigned int nThreads = 0) const {
+    const bool needsSurfaceInfo = hits.needsSurfaceInfo();
+    parallelFor(
+        0, rays.size, 256,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i) {
+            const Ray ray = rays.ray(i);
+            IntersectInfo info;
+            const bool hit = intersectClosest(ray, info);
+            if (hit) {
+              if (needsSurfaceInfo) {
+                Triangle(polygon, info.primID).calcSurfaceInfo(ray, info);
+              } else {
+                info.geomID = polygon->getGeomID(info.primID);
+              }
+            }
+            hits.set(i, hit, info);
+          }
+        },
+        nThreads);
   }
 };
 
@@ -0,0 +1,886 @@
+#ifndef _OUT_OF_CORE_BVH_H
+#define _OUT_OF_CORE_BVH_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bvh/build-primitives.hpp"
+#include "core/parallel.hpp"
+#include "core/ray-batch.hpp"
+#include "core/triangle.hpp"
+
+// メモリに載らないシーンのためのBVHのファイル形式
+// 上位の木の葉ノードがチャンクで, 各チャンクは部分木のノードと
+// その三角形を含み, 独立にメモリマップできる
+// | header | top nodes | chunk infos | chunk 0 | chunk 1 | ...
+// チャンクの中は64Byteアラインメントされた各配列が並ぶ
+// | nodes | vertices | indices | normals | normalIndices | uvs | uvIndices |
+// | geomIDs | primIDs |
+// NOTE: リトルエンディアンを前提としている. キーフレームには対応していない
+struct OutOfCoreBVHHeader {
+  char magic[4];              // "BVHO"
+  uint32_t version;           // フォーマットのバージョン
+  uint32_t nFaces;            // 全体の面の数
+  uint32_t nTopNodes;         // 上位の木のノード数
+  uint32_t nChunks;           // チャンクの数
+  uint32_t flags;             // 法線, UV座標, ジオメトリIDを持つか
+  uint64_t topNodesOffset;    // 上位の木のノード配列のオフセット
+  uint64_t chunkInfosOffset;  // チャンクの情報の配列のオフセット
+};
+
+// 上位の木とチャンク内の木のノード
+// 子ノードはoffset, offset + 1に隣接して並ぶ
+struct OutOfCoreBVHNode {
+  AABB bbox;             // バウンディングボックス
+  uint32_t offset;       // 中間ノードでは左の子ノードの番号, 葉ノードでは
+                         // チャンクの番号(上位の木)か最初の面の番号(チャンク内)
+  uint16_t nPrimitives;  // 葉ノードに含まれる面の数(中間ノードは0)
+  uint8_t axis;          // 分割軸(traverseの最適化に使う)
+  uint8_t reserved;      // 未使用
+};
+
+// チャンクの情報
+struct OutOfCoreBVHChunkInfo {
+  AABB bbox;           // チャンクの全ての面を含むAABB
+  uint32_t nFaces;     // 面の数
+  uint32_t nNodes;     // ノード数
+  uint32_t nVertices;  // 頂点数
+  uint32_t nNormals;   // 法線の数(存在しない場合は0)
+  uint32_t nUVs;       // UV座標の数(存在しない場合は0)
+  uint32_t reserved;   // 未使用
+  uint64_t offset;     // ファイル先頭からのオフセット
+  uint64_t size;       // バイト数
+};
+
+constexpr char OUT_OF_CORE_BVH_MAGIC[4] = {'B', 'V', 'H', 'O'};
+constexpr uint32_t OUT_OF_CORE_BVH_VERSION = 1;
+constexpr uint32_t OUT_OF_CORE_BVH_HAS_NORMALS = 1 << 0;
+constexpr uint32_t OUT_OF_CORE_BVH_HAS_UVS = 1 << 1;
+constexpr uint32_t OUT_OF_CORE_BVH_HAS_GEOM_IDS = 1 << 2;
+constexpr uint64_t OUT_OF_CORE_BVH_ALIGNMENT = 64;
+// チャンクのアラインメント
+// NOTE: mmapのオフセットはページサイズ(Windowsではアロケーションの粒度の
+// 64KB)の倍数でなければならない
+constexpr uint64_t OUT_OF_CORE_BVH_CHUNK_ALIGNMENT = 65536;
+
+// offsetをalignmentの倍数に切り上げる
+inline uint64_t alignOutOfCoreBVHOffset(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// チャンク内の各配列のオフセット(チャンク先頭からのバイト数)
+struct OutOfCoreBVHChunkLayout {
+  uint64_t nodesOffset;
+  uint64_t verticesOffset;
+  uint64_t indicesOffset;
+  uint64_t normalsOffset;
+  uint64_t normalIndicesOffset;
+  uint64_t uvsOffset;
+  uint64_t uvIndicesOffset;
+  uint64_t geomIDsOffset;
+  uint64_t primIDsOffset;
+  uint64_t size;  // チャンク全体のバイト数
+
+  OutOfCoreBVHChunkLayout(const OutOfCoreBVHChunkInfo& info, uint32_t flags) {
+    const uint64_t nIndices = 3 * static_cast<uint64_t>(info.nFaces);
+    const uint64_t nNormalIndices = info.nNormals > 0 ? nIndices : 0;
+    const uint64_t nUVIndices = info.nUVs > 0 ? nIndices : 0;
+    const uint64_t nGeomIDs =
+        flags & OUT_OF_CORE_BVH_HAS_GEOM_IDS ? info.nFaces : 0;
+    const auto next = [](uint64_t offset, uint64_t nBytes) {
+      return alignOutOfCoreBVHOffset(offset + nBytes,
+                                     OUT_OF_CORE_BVH_ALIGNMENT);
+    };
+    nodesOffset = 0;
+    verticesOffset =
+        next(nodesOffset, sizeof(OutOfCoreBVHNode) * info.nNodes);
+    indicesOffset =
+        next(verticesOffset, 3 * sizeof(float) * uint64_t(info.nVertices));
+    normalsOffset = next(indicesOffset, sizeof(unsigned int) * nIndices);
+    normalIndicesOffset =
+        next(normalsOffset, 3 * sizeof(float) * uint64_t(info.nNormals));
+    uvsOffset =
+        next(normalIndicesOffset, sizeof(unsigned int) * nNormalIndices);
+    uvIndicesOffset = next(uvsOffset, 2 * sizeof(float) * uint64_t(info.nUVs));
+    geomIDsOffset = next(uvIndicesOffset, sizeof(unsigned int) * nUVIndices);
+    primIDsOffset = next(geomIDsOffset, sizeof(int) * nGeomIDs);
+    size = primIDsOffset + sizeof(uint32_t) * uint64_t(info.nFaces);
+  }
+};
+
+// 範囲内の面から再帰的にノードを構築する
+// nodes[nodeIdx]に範囲内の面を含むノードをセットし, 面の数がmaxLeafSize以下
+// なら葉ノードにする. 葉ノードのoffset, nPrimitivesはsetLeaf(node, primStart,
+// primEnd)でセットする
+// NOTE: 等数分割なので, 葉ノードの面はprimIndicesの連続した範囲になる
+template <typename SetLeaf>
+void buildOutOfCoreBVHNode(uint32_t nodeIdx, int primStart, int primEnd,
+                           int maxLeafSize, const BuildPrimitives& prims,
+                           std::vector<uint32_t>& primIndices,
+                           std::vector<OutOfCoreBVHNode>& nodes,
+                           const SetLeaf& setLeaf) {
+  AABB bbox, splitAABB;
+  prims.calcBounds(primIndices.data(), primStart, primEnd, bbox, splitAABB);
+
+  OutOfCoreBVHNode node;
+  node.bbox = bbox;
+  node.offset = 0;
+  node.nPrimitives = 0;
+  node.axis = 0;
+  node.reserved = 0;
+  if (primEnd - primStart <= maxLeafSize) {
+    setLeaf(node, primStart, primEnd);
+    nodes[nodeIdx] = node;
+    return;
+  }
+
+  const int splitAxis = splitAABB.longestAxis();
+  const int splitIdx =
+      prims.splitMedian(primIndices.data(), primStart, primEnd, splitAxis);
+
+  // 子ノードを隣接して確保してから再帰する
+  node.offset = nodes.size();
+  node.axis = splitAxis;
+  nodes[nodeIdx] = node;
+  nodes.resize(nodes.size() + 2);
+  buildOutOfCoreBVHNode(node.offset, primStart, splitIdx, maxLeafSize, prims,
+                        primIndices, nodes, setLeaf);
+  buildOutOfCoreBVHNode(node.offset + 1, splitIdx, primEnd, maxLeafSize,
+                        prims, primIndices, nodes, setLeaf);
+}
+
+// PolygonからBVHを構築し, チャンクに分けてファイルに書き出す
+// 各チャンクは最大maxChunkFaces個の面を含む
+// NOTE: 構築中は面ごとのAABBと中心点をメモリに置くが, 頂点などはチャンクごとに
+// 集めて書き出すので, PolygonはBinaryMeshでマップしたものでも良い
+inline bool writeOutOfCoreBVH(const std::string& filename,
+                              const Polygon& polygon,
+                              uint32_t maxChunkFaces = 65536) {
+  // NOTE: チャンク内の葉ノードは4面まで. 上位の木の葉ノードは1つのチャンク
+  constexpr int maxLeafSize = 4;
+  if (maxChunkFaces < maxLeafSize) maxChunkFaces = maxLeafSize;
+
+  OutOfCoreBVHHeader header{};
+  std::memcpy(header.magic, OUT_OF_CORE_BVH_MAGIC, sizeof(header.magic));
+  header.version = OUT_OF_CORE_BVH_VERSION;
+  header.nFaces = polygon.nFaces();
+  header.flags = (polygon.hasNormals() ? OUT_OF_CORE_BVH_HAS_NORMALS : 0) |
+                 (polygon.hasUVs() ? OUT_OF_CORE_BVH_HAS_UVS : 0) |
+                 (polygon.geomIDs ? OUT_OF_CORE_BVH_HAS_GEOM_IDS : 0);
+
+  // 上位の木を構築する
+  const BuildPrimitives prims(header.nFaces, [&](uint32_t prim) {
+    return Triangle(&polygon, prim).calcAABB();
+  });
+  std::vector<uint32_t> primIndices(header.nFaces);
+  std::iota(primIndices.begin(), primIndices.end(), 0);
+  std::vector<OutOfCoreBVHNode> topNodes(1);
+  std::vector<std::pair<int, int>> chunkRanges;  // チャンクの面の範囲
+  if (header.nFaces > 0) {
+    // NOTE: 葉ノードのnPrimitivesはチャンクの面の数ではなく1にする
+    buildOutOfCoreBVHNode(
+        0, 0, header.nFaces, maxChunkFaces, prims, primIndices, topNodes,
+        [&](OutOfCoreBVHNode& node, int primStart, int primEnd) {
+          node.offset = chunkRanges.size();
+          node.nPrimitives = 1;
+          chunkRanges.emplace_back(primStart, primEnd);
+        });
+  }
+  header.nTopNodes = header.nFaces > 0 ? topNodes.size() : 0;
+  header.nChunks = chunkRanges.size();
+  header.topNodesOffset = alignOutOfCoreBVHOffset(sizeof(OutOfCoreBVHHeader),
+                                                  OUT_OF_CORE_BVH_ALIGNMENT);
+  header.chunkInfosOffset = alignOutOfCoreBVHOffset(
+      header.topNodesOffset + sizeof(OutOfCoreBVHNode) * header.nTopNodes,
+      OUT_OF_CORE_BVH_ALIGNMENT);
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return false;
+  }
+
+  // パディングを0で埋めながら配列を書き出す
+  uint64_t pos = 0;
+  const auto writeArray = [&](uint64_t offset, const void* data,
+                              uint64_t size) {
+    static const char zeros[OUT_OF_CORE_BVH_CHUNK_ALIGNMENT] = {};
+    file.write(zeros, offset - pos);
+    file.write(reinterpret_cast<const char*>(data), size);
+    pos = offset + size;
+  };
+  // 面の頂点などのインデックスをチャンク内の番号に付け直す
+  // localIndicesにチャンク内の番号を, globalIndicesに元の番号を追加する
+  std::unordered_map<unsigned int, unsigned int> indexMap;
+  const auto remap = [&](unsigned int index,
+                         std::vector<unsigned int>& localIndices,
+                         std::vector<unsigned int>& globalIndices) {
+    const auto result = indexMap.emplace(index, globalIndices.size());
+    if (result.second) globalIndices.push_back(index);
+    localIndices.push_back(result.first->second);
+  };
+
+  // チャンクを順に構築して書き出す
+  // NOTE: チャンクは上位の木の深さ優先順に並ぶので, 近いチャンクはファイル上
+  // でも近くなる
+  std::vector<OutOfCoreBVHChunkInfo> chunkInfos(header.nChunks);
+  uint64_t chunkOffset = header.chunkInfosOffset +
+                         sizeof(OutOfCoreBVHChunkInfo) * header.nChunks;
+  for (uint32_t chunk = 0; chunk < header.nChunks; ++chunk) {
+    const int primStart = chunkRanges[chunk].first;
+    const int primEnd = chunkRanges[chunk].second;
+
+    std::vector<OutOfCoreBVHNode> nodes(1);
+    buildOutOfCoreBVHNode(
+        0, primStart, primEnd, maxLeafSize, prims, primIndices, nodes,
+        [&](OutOfCoreBVHNode& node, int start, int end) {
+          node.offset = start - primStart;
+          node.nPrimitives = end - start;
+        });
+
+    // 葉ノードの順に並んだ面の頂点, 法線, UV座標を集める
+    std::vector<unsigned int> indices, normalIndices, uvIndices;
+    std::vector<unsigned int> vertexIDs, normalIDs, uvIDs;
+    std::vector<float> vertices, normals, uvs;
+    std::vector<int> geomIDs;
+    std::vector<uint32_t> primIDs(primIndices.begin() + primStart,
+                                  primIndices.begin() + primEnd);
+    indexMap.clear();
+    for (const uint32_t prim : primIDs) {
+      for (const unsigned int index : polygon.getIndices(prim)) {
+        remap(index, indices, vertexIDs);
+      }
+    }
+    for (const unsigned int id : vertexIDs) {
+      const Vec3 v = polygon.getVertex(id);
+      vertices.insert(vertices.end(), {v[0], v[1], v[2]});
+    }
+    if (polygon.hasNormals()) {
+      indexMap.clear();
+      for (const uint32_t prim : primIDs) {
+        for (const unsigned int index : polygon.getNormalIndices(prim)) {
+          remap(index, normalIndices, normalIDs);
+        }
+      }
+      for (const unsigned int id : normalIDs) {
+        const Vec3 n = polygon.getNormal(id);
+        normals.insert(normals.end(), {n[0], n[1], n[2]});
+      }
+    }
+    if (polygon.hasUVs()) {
+      indexMap.clear();
+      for (const uint32_t prim : primIDs) {
+        for (const unsigned int index : polygon.getUVIndices(prim)) {
+          remap(index, uvIndices, uvIDs);
+        }
+      }
+      for (const unsigned int id : uvIDs) {
+        const auto uv = polygon.getUV(id);
+        uvs.insert(uvs.end(), {uv.first, uv.second});
+      }
+    }
+    if (polygon.geomIDs) {
+      for (const uint32_t prim : primIDs) {
+        geomIDs.push_back(polygon.getGeomID(prim));
+      }
+    }
+
+    OutOfCoreBVHChunkInfo& info = chunkInfos[chunk];
+    info.bbox = nodes[0].bbox;
+    info.nFaces = primEnd - primStart;
+    info.nNodes = nodes.size();
+    info.nVertices = vertexIDs.size();
+    info.nNormals = normalIDs.size();
+    info.nUVs = uvIDs.size();
+    info.reserved = 0;
+    info.offset = alignOutOfCoreBVHOffset(chunkOffset,
+                                          OUT_OF_CORE_BVH_CHUNK_ALIGNMENT);
+    const OutOfCoreBVHChunkLayout layout(info, header.flags);
+    info.size = layout.size;
+    chunkOffset = info.offset + info.size;
+
+    // 先頭のヘッダなどは最後に書くので, 最初のチャンクの前まで飛ばす
+    if (chunk == 0) {
+      file.seekp(info.offset);
+      pos = info.offset;
+    }
+    writeArray(info.offset + layout.nodesOffset, nodes.data(),
+               sizeof(OutOfCoreBVHNode) * nodes.size());
+    writeArray(info.offset + layout.verticesOffset, vertices.data(),
+               sizeof(float) * vertices.size());
+    writeArray(info.offset + layout.indicesOffset, indices.data(),
+               sizeof(unsigned int) * indices.size());
+    writeArray(info.offset + layout.normalsOffset, normals.data(),
+               sizeof(float) * normals.size());
+    writeArray(info.offset + layout.normalIndicesOffset, normalIndices.data(),
+               sizeof(unsigned int) * normalIndices.size());
+    writeArray(info.offset + layout.uvsOffset, uvs.data(),
+               sizeof(float) * uvs.size());
+    writeArray(info.offset + layout.uvIndicesOffset, uvIndices.data(),
+               sizeof(unsigned int) * uvIndices.size());
+    writeArray(info.offset + layout.geomIDsOffset, geomIDs.data(),
+               sizeof(int) * geomIDs.size());
+    writeArray(info.offset + layout.primIDsOffset, primIDs.data(),
+               sizeof(uint32_t) * primIDs.size());
+  }
+
+  // ヘッダ, 上位の木, チャンクの情報を先頭に書き出す
+  file.seekp(0);
+  pos = 0;
+  writeArray(0, &header, sizeof(OutOfCoreBVHHeader));
+  writeArray(header.topNodesOffset, topNodes.data(),
+             sizeof(OutOfCoreBVHNode) * header.nTopNodes);
+  writeArray(header.chunkInfosOffset, chunkInfos.data(),
+             sizeof(OutOfCoreBVHChunkInfo) * header.nChunks);
+
+  if (!file) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// writeOutOfCoreBVHで書き出したBVHを, 上位の木だけメモリに置いてtraverseする
+// チャンクはレイが到達した時にメモリマップし, マップしたチャンクの合計が
+// maxResidentBytesを超える場合は最も長く使われていないチャンクを解放する
+// NOTE: まとめてtraverseする場合は, レイをチャンクごとのキューに入れてから
+// チャンクを1つずつ読み込むので, 各チャンクの読み込みは1回で済む
+class OutOfCoreBVH {
+ private:
+  // メモリマップしたチャンク
+  struct ResidentChunk {
+    void* data{nullptr};                     // マップされた領域の先頭
+    Polygon polygon{0, nullptr, nullptr};    // マップされた領域を指す
+    const OutOfCoreBVHNode* nodes{nullptr};  // チャンク内の木のノード
+    const uint32_t* primIDs{nullptr};        // チャンク内の面の元の面番号
+    uint32_t nUsers{0};    // 使用中のスレッドの数(0でなければ解放しない)
+    uint64_t lastUsed{0};  // 最後に使われた時刻(LRU)
+  };
+
+  // チャンクの読み込みの統計情報
+  struct ChunkStatistics {
+    uint64_t nLoads{0};             // チャンクをマップした回数
+    uint64_t nEvictions{0};         // チャンクを解放した回数
+    uint64_t residentBytes{0};      // マップしているチャンクの合計
+    uint64_t peakResidentBytes{0};  // residentBytesの最大値
+  };
+
+  OutOfCoreBVHHeader header{};
+  std::vector<OutOfCoreBVHNode> topNodes;         // 上位の木のノード
+  std::vector<OutOfCoreBVHChunkInfo> chunkInfos;  // チャンクの情報
+  std::vector<ResidentChunk> chunks;              // チャンクのマップの状態
+  // チャンクの範囲の確認結果
+  enum class ChunkCheck : uint8_t { UNCHECKED, VALID, INVALID };
+  std::vector<ChunkCheck> chunkChecks;  // チャンクごとの確認結果
+  uint64_t maxResidentBytes{0};  // マップするチャンクの合計の上限
+  uint64_t clock{0};             // LRUの時刻
+  ChunkStatistics stats;         // チャンクの読み込みの統計情報
+  mutable std::mutex mutex;      // chunks, clock, statsを保護する
+#ifdef _WIN32
+  HANDLE fileHandle{INVALID_HANDLE_VALUE};
+  HANDLE mappingHandle{nullptr};
+#else
+  int fd{-1};
+#endif
+
+  // ノード配列の子ノードと葉ノードの範囲が正しいか判定する
+  // 葉ノードはoffsetからnPrimitives個がnItems個の中に収まっていなければならない
+  // NOTE: 壊れたファイルでtraverseが終わらなくならないように,
+  // 子ノードは親ノードより後ろにあることを確認する
+  static bool checkNodes(const OutOfCoreBVHNode* nodes, uint32_t nNodes,
+                         uint32_t nItems) {
+    for (uint32_t i = 0; i < nNodes; ++i) {
+      const OutOfCoreBVHNode& node = nodes[i];
+      if (node.nPrimitives > 0) {
+        if (uint64_t(node.offset) + node.nPrimitives > nItems) return false;
+      } else if (node.offset <= i || uint64_t(node.offset) + 2 > nNodes ||
+                 node.axis >= 3) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // インデックス配列の全ての要素がn未満か判定する
+  static bool checkIndices(const unsigned int* indices, uint64_t nIndices,
+                           uint32_t n) {
+    for (uint64_t i = 0; i < nIndices; ++i) {
+      if (indices[i] >= n) return false;
+    }
+    return true;
+  }
+
+  // マップしたチャンクのノードとインデックスが範囲内か判定する
+  bool checkChunk(const ResidentChunk& chunk,
+                  const OutOfCoreBVHChunkInfo& info) const {
+    const Polygon& polygon = chunk.polygon;
+    const uint64_t nIndices = 3 * static_cast<uint64_t>(info.nFaces);
+    return checkNodes(chunk.nodes, info.nNodes, info.nFaces) &&
+           checkIndices(polygon.indices, nIndices, info.nVertices) &&
+           (info.nNormals == 0 ||
+            checkIndices(polygon.normalIndices, nIndices, info.nNormals)) &&
+           (info.nUVs == 0 ||
+            checkIndices(polygon.uvIndices, nIndices, info.nUVs)) &&
+           checkIndices(chunk.primIDs, info.nFaces, header.nFaces);
+  }
+
+  bool validate(uint64_t fileSize) const {
+    if (std::memcmp(header.magic, OUT_OF_CORE_BVH_MAGIC,
+                    sizeof(header.magic)) != 0) {
+      return false;
+    }
+    if (header.version != OUT_OF_CORE_BVH_VERSION) return false;
+    if (!checkNodes(topNodes.data(), header.nTopNodes, header.nChunks)) {
+      return false;
+    }
+    for (const OutOfCoreBVHChunkInfo& info : chunkInfos) {
+      const OutOfCoreBVHChunkLayout layout(info, header.flags);
+      if (info.nNodes == 0 ||
+          info.offset % OUT_OF_CORE_BVH_CHUNK_ALIGNMENT != 0 ||
+          info.size != layout.size || info.offset > fileSize ||
+          info.size > fileSize - info.offset) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // チャンク内の配列の先頭を返す. 要素数が0の場合はnullptrを返す
+  template <typename T>
+  static T* getArray(void* data, uint64_t offset, uint64_t n) {
+    if (n == 0) return nullptr;
+    return reinterpret_cast<T*>(static_cast<char*>(data) + offset);
+  }
+
+  // チャンクをメモリマップし, 各配列を指すようにする
+  // NOTE: mutexをロックした状態で呼ぶ
+  bool mapChunk(uint32_t chunkIdx) {
+    const OutOfCoreBVHChunkInfo& info = chunkInfos[chunkIdx];
+    ResidentChunk& chunk = chunks[chunkIdx];
+#ifdef _WIN32
+    ULARGE_INTEGER offset;
+    offset.QuadPart = info.offset;
+    chunk.data = MapViewOfFile(mappingHandle, FILE_MAP_READ, offset.HighPart,
+                               offset.LowPart, info.size);
+#else
+    chunk.data = mmap(nullptr, info.size, PROT_READ, MAP_PRIVATE, fd,
+                      info.offset);
+    if (chunk.data == MAP_FAILED) {
+      chunk.data = nullptr;
+    } else {
+      // 多くのレイがチャンク全体を使うので, 先読みを始めておく
+      madvise(chunk.data, info.size, MADV_WILLNEED);
+    }
+#endif
+    if (!chunk.data) {
+      std::cerr << "failed to map chunk " << chunkIdx << std::endl;
+      return false;
+    }
+
+    // NOTE: Polygonは書き込み可能なポインタを持つが, traverseでは書き込まない
+    const OutOfCoreBVHChunkLayout layout(info, header.flags);
+    const uint64_t nIndices = 3 * static_cast<uint64_t>(info.nFaces);
+    void* data = chunk.data;
+    chunk.polygon = Polygon(
+        nIndices, getArray<float>(data, layout.verticesOffset, info.nVertices),
+        getArray<unsigned int>(data, layout.indicesOffset, nIndices),
+        getArray<float>(data, layout.normalsOffset, info.nNormals),
+        getArray<float>(data, layout.uvsOffset, info.nUVs),
+        getArray<int>(data, layout.geomIDsOffset,
+                      header.flags & OUT_OF_CORE_BVH_HAS_GEOM_IDS
+                          ? info.nFaces
+                          : 0),
+        getArray<unsigned int>(data, layout.normalIndicesOffset,
+                               info.nNormals > 0 ? nIndices : 0),
+        getArray<unsigned int>(data, layout.uvIndicesOffset,
+                               info.nUVs > 0 ? nIndices : 0));
+    chunk.nodes = getArray<const OutOfCoreBVHNode>(data, layout.nodesOffset,
+                                                   info.nNodes);
+    chunk.primIDs =
+        getArray<const uint32_t>(data, layout.primIDsOffset, info.nFaces);
+
+    // 壊れたファイルで範囲外を読まないように, ノードとインデックスを確認する
+    // NOTE: チャンク全体を読むので, 解放と再マップを繰り返す場合に備えて
+    // 各チャンクは最初にマップした時だけ確認する
+    if (chunkChecks[chunkIdx] == ChunkCheck::UNCHECKED &&
+        !checkChunk(chunk, info)) {
+      std::cerr << "invalid chunk " << chunkIdx << std::endl;
+      chunkChecks[chunkIdx] = ChunkCheck::INVALID;
+#ifdef _WIN32
+      UnmapViewOfFile(chunk.data);
+#else
+      munmap(chunk.data, info.size);
+#endif
+      chunk = ResidentChunk();
+      return false;
+    }
+    chunkChecks[chunkIdx] = ChunkCheck::VALID;
+
+    stats.nLoads++;
+    stats.residentBytes += info.size;
+    stats.peakResidentBytes =
+        std::max(stats.peakResidentBytes, stats.residentBytes);
+    return true;
+  }
+
+  // チャンクのメモリマップを解放する
+  // NOTE: mutexをロックした状態で呼ぶ
+  void unmapChunk(uint32_t chunkIdx) {
+    ResidentChunk& chunk = chunks[chunkIdx];
+    if (!chunk.data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(chunk.data);
+#else
+    munmap(chunk.data, chunkInfos[chunkIdx].size);
+#endif
+    chunk = ResidentChunk();
+    stats.residentBytes -= chunkInfos[chunkIdx].size;
+  }
+
+  // チャンクを使用中にして返す. マップされていない場合はマップする
+  // 上限を超える場合は, 使用中でないチャンクを古い順に解放する
+  // NOTE: 全てのチャンクが使用中の場合は上限を超えてマップする
+  const ResidentChunk* acquireChunk(uint32_t chunkIdx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ResidentChunk& chunk = chunks[chunkIdx];
+    if (!chunk.data) {
+      // 壊れていたチャンクはマップし直さない
+      if (chunkChecks[chunkIdx] == ChunkCheck::INVALID) return nullptr;
+      const uint64_t size = chunkInfos[chunkIdx].size;
+      while (stats.residentBytes + size > maxResidentBytes) {
+        uint32_t victim = header.nChunks;
+        for (uint32_t i = 0; i < header.nChunks; ++i) {
+          if (chunks[i].data && chunks[i].nUsers == 0 &&
+              (victim == header.nChunks ||
+               chunks[i].lastUsed < chunks[victim].lastUsed)) {
+            victim = i;
+          }
+        }
+        if (victim == header.nChunks) break;
+        unmapChunk(victim);
+        stats.nEvictions++;
+      }
+      if (!mapChunk(chunkIdx)) return nullptr;
+    }
+    chunk.nUsers++;
+    chunk.lastUsed = ++clock;
+    return &chunk;
+  }
+
+  // acquireChunkで使用中にしたチャンクを使用中でなくする
+  void releaseChunk(uint32_t chunkIdx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    chunks[chunkIdx].nUsers--;
+  }
+
+  // 上位の木をtraverseし, レイと交差するチャンクの番号をレイの方向に近い順に
+  // visit(chunkIdx)に渡す
+  template <typename Visit>
+  void traverseTopNode(uint32_t nodeIdx, const Ray& ray,
+                       const PrecomputedRay& rayData,
+                       const Visit& visit) const {
+    const OutOfCoreBVHNode& node = topNodes[nodeIdx];
+    if (!node.bbox.intersect(ray, rayData)) return;
+    if (node.nPrimitives > 0) {
+      visit(node.offset);
+      return;
+    }
+    const int sign = rayData.dirInvSign[node.axis];
+    traverseTopNode(node.offset + sign, ray, rayData, visit);
+    traverseTopNode(node.offset + 1 - sign, ray, rayData, visit);
+  }
+
+  // チャンク内の木を再帰的にtraverseする
+  // info.primIDにはチャンク内の面番号がセットされる
+  static bool intersectNode(const ResidentChunk& chunk, uint32_t nodeIdx,
+                            const Ray& ray, const PrecomputedRay& rayData,
+                            IntersectInfo& info) {
+    const OutOfCoreBVHNode& node = chunk.nodes[nodeIdx];
+    if (!node.bbox.intersect(ray, rayData)) return false;
+
+    bool hit = false;
+    if (node.nPrimitives > 0) {
+      const uint32_t primEnd = node.offset + node.nPrimitives;
+      for (uint32_t i = node.offset; i < primEnd; ++i) {
+        if (Triangle(&chunk.polygon, i).intersect(ray, info)) {
+          // intersectしたらrayのtmaxを更新
+          hit = true;
+          ray.tmax = info.t;
+        }
+      }
+    } else {
+      const int sign = rayData.dirInvSign[node.axis];
+      hit |= intersectNode(chunk, node.offset + sign, ray, rayData, info);
+      hit |= intersectNode(chunk, node.offset + 1 - sign, ray, rayData, info);
+    }
+    return hit;
+  }
+
+  // チャンク内で最も近い交差点を求め, 交差点の情報を計算する
+  // needsSurfaceInfoがfalseの場合はgeomIDまでしか計算しない
+  // NOTE: チャンクは後で解放されるかもしれないので, マップしている間に計算する
+  static bool intersectChunk(const ResidentChunk& chunk, const Ray& ray,
+                             const PrecomputedRay& rayData,
+                             IntersectInfo& info, bool needsSurfaceInfo) {
+    if (!intersectNode(chunk, 0, ray, rayData, info)) return false;
+    if (needsSurfaceInfo) {
+      Triangle(&chunk.polygon, info.primID).calcSurfaceInfo(ray, info);
+    } else {
+      info.geomID = chunk.polygon.getGeomID(info.primID);
+    }
+    info.primID = chunk.primIDs[info.primID];
+    return true;
+  }
+
+  void close() {
+    for (uint32_t i = 0; i < chunks.size(); ++i) {
+      unmapChunk(i);
+    }
+#ifdef _WIN32
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+#endif
+    header = OutOfCoreBVHHeader();
+    topNodes.clear();
+    chunkInfos.clear();
+    chunks.clear();
+    chunkChecks.clear();
+    clock = 0;
+    stats = ChunkStatistics();
+  }
+
+ public:
+  OutOfCoreBVH() {}
+  OutOfCoreBVH(const OutOfCoreBVH&) = delete;
+  OutOfCoreBVH& operator=(const OutOfCoreBVH&) = delete;
+  ~OutOfCoreBVH() { close(); }
+
+  // ファイルからヘッダ, 上位の木, チャンクの情報を読み込む
+  // チャンクはtraverseで必要になった時にマップする
+  bool load(const std::string& filename,
+            uint64_t maxResidentBytes = std::numeric_limits<uint64_t>::max()) {
+    close();
+    this->maxResidentBytes = maxResidentBytes;
+
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+      std::cerr << "failed to open " << filename << std::endl;
+      return false;
+    }
+    const uint64_t fileSize = file.tellg();
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(&header), sizeof(OutOfCoreBVHHeader));
+    const auto readArray = [&](uint64_t offset, auto& array, uint32_t n) {
+      const uint64_t nBytes = sizeof(array[0]) * uint64_t(n);
+      if (!file || offset > fileSize || nBytes > fileSize - offset) {
+        return false;
+      }
+      array.resize(n);
+      file.seekg(offset);
+      file.read(reinterpret_cast<char*>(array.data()), nBytes);
+      return static_cast<bool>(file);
+    };
+    if (!readArray(header.topNodesOffset, topNodes, header.nTopNodes) ||
+        !readArray(header.chunkInfosOffset, chunkInfos, header.nChunks) ||
+        !validate(fileSize)) {
+      std::cerr << "invalid out-of-core BVH: " << filename << std::endl;
+      close();
+      return false;
+    }
+    chunks.resize(header.nChunks);
+    chunkChecks.resize(header.nChunks);
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                             nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+      mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0,
+                                         0, nullptr);
+    }
+    const bool opened = mappingHandle != nullptr;
+#else
+    fd = open(filename.c_str(), O_RDONLY);
+    const bool opened = fd >= 0;
+#endif
+    if (!opened) {
+      std::cerr << "failed to map " << filename << std::endl;
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  // 面の数を返す
+  unsigned int nFaces() const { return header.nFaces; }
+  // 上位の木のノード数を返す
+  unsigned int nTopNodes() const { return header.nTopNodes; }
+  // チャンクの数を返す
+  unsigned int nChunks() const { return header.nChunks; }
+  // 全てのチャンクの合計のバイト数を返す
+  uint64_t totalChunkBytes() const {
+    uint64_t ret = 0;
+    for (const OutOfCoreBVHChunkInfo& info : chunkInfos) {
+      ret += info.size;
+    }
+    return ret;
+  }
+  // チャンクをマップした回数を返す
+  uint64_t nChunkLoads() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats.nLoads;
+  }
+  // チャンクを解放した回数を返す
+  uint64_t nChunkEvictions() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats.nEvictions;
+  }
+  // マップしているチャンクの合計の最大値を返す
+  uint64_t peakResidentBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats.peakResidentBytes;
+  }
+  // 常にメモリに置く上位の木とチャンクの情報が使用しているメモリ量(Byte)と,
+  // マップしているチャンクの合計を返す
+  size_t memoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sizeof(OutOfCoreBVHNode) * topNodes.capacity() +
+           sizeof(OutOfCoreBVHChunkInfo) * chunkInfos.capacity() +
+           sizeof(ResidentChunk) * chunks.capacity() + stats.residentBytes;
+  }
+
+  // 全体のバウンディングボックスを返す
+  AABB rootAABB() const {
+    if (!topNodes.empty()) {
+      return topNodes[0].bbox;
+    } else {
+      return AABB();
+    }
+  }
+
+  // traverseをする
+  // 上位の木で近い順に見つけたチャンクを読み込み, チャンク内をtraverseする
+  // NOTE: 複数のスレッドから呼んでも良い. レイごとにチャンクを読み込むので,
+  // 多くのレイを追跡する場合はまとめてtraverseする方が速い
+  bool intersect(const Ray& ray, IntersectInfo& info) {
+    if (topNodes.empty()) return false;
+    const PrecomputedRay rayData(ray);
+    bool hit = false;
+    // NOTE: 近いチャンクで交差した場合はray.tmaxが更新されるので,
+    // それより遠いチャンクは読み込まない
+    traverseTopNode(0, ray, rayData, [&](uint32_t chunkIdx) {
+      const ResidentChunk* chunk = acquireChunk(chunkIdx);
+      if (!chunk) return;
+      if (intersectChunk(*chunk, ray, rayData, info, true)) {
+        hit = true;
+        ray.tmax = info.t;
+      }
+      releaseChunk(chunkIdx);
+    });
+    return hit;
+  }
+
+  // 複数のレイをまとめてtraverseし, 結果をhitsに書き込む
+  // レイを上位の木でtraverseして交差するチャンクのキューに入れ, ファイル上の
+  // 順にチャンクを読み込んでキューのレイをnThreadsスレッドでtraverseする
+  // NOTE: 前のチャンクでより近い交差点が見つかったレイは, チャンクのAABBで
+  // 判定し直して読み飛ばす. 次のチャンクは先に読み込みを始めておく
+  void intersect(const RayBatch& rays, HitBatch& hits,
+                 unsigned int nThreads = 0) {
+    const bool needsSurfaceInfo = hits.needsSurfaceInfo();
+    std::vector<float> tmax(rays.size);
+    std::vector<std::vector<uint32_t>> queues(header.nChunks);
+    std::mutex queueMutex;
+    parallelFor(
+        0, rays.size, 4096,
+        [&](size_t begin, size_t end) {
+          std::vector<std::pair<uint32_t, uint32_t>> entries;
+          for (size_t i = begin; i < end; ++i) {
+            const Ray ray = rays.ray(i);
+            tmax[i] = ray.tmax;
+            hits.set(i, false, IntersectInfo());
+            if (topNodes.empty()) continue;
+            const PrecomputedRay rayData(ray);
+            traverseTopNode(0, ray, rayData, [&](uint32_t chunkIdx) {
+              entries.emplace_back(chunkIdx, i);
+            });
+          }
+          std::lock_guard<std::mutex> lock(queueMutex);
+          for (const auto& entry : entries) {
+            queues[entry.first].push_back(entry.second);
+          }
+        },
+        nThreads);
+
+    // レイが入っているチャンクの番号
+    std::vector<uint32_t> chunkOrder;
+    for (uint32_t chunkIdx = 0; chunkIdx < header.nChunks; ++chunkIdx) {
+      if (!queues[chunkIdx].empty()) chunkOrder.push_back(chunkIdx);
+    }
+
+    const ResidentChunk* next =
+        chunkOrder.empty() ? nullptr : acquireChunk(chunkOrder[0]);
+    for (size_t k = 0; k < chunkOrder.size(); ++k) {
+      const uint32_t chunkIdx = chunkOrder[k];
+      const ResidentChunk* chunk = next;
+      next = k + 1 < chunkOrder.size() ? acquireChunk(chunkOrder[k + 1])
+                                       : nullptr;
+      if (!chunk) continue;
+
+      const AABB& chunkBBox = chunkInfos[chunkIdx].bbox;
+      const std::vector<uint32_t>& queue = queues[chunkIdx];
+      parallelFor(
+          0, queue.size(), 256,
+          [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+              const uint32_t i = queue[k];
+              Ray ray = rays.ray(i);
+              ray.tmax = tmax[i];
+              const PrecomputedRay rayData(ray);
+              if (!chunkBBox.intersect(ray, rayData)) continue;
+              IntersectInfo info;
+              if (intersectChunk(*chunk, ray, rayData, info,
+                                 needsSurfaceInfo)) {
+                tmax[i] = info.t;
+                hits.set(i, true, info);
+              }
+            }
+          },
+          nThreads);
+      releaseChunk(chunkIdx);
+
+      // キューのメモリは使い終わったら解放する
+      std::vector<uint32_t>().swap(queues[chunkIdx]);
+    }
+  }
+};
+
+#endif
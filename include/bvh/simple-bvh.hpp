@@ -1,13 +1,17 @@
 #ifndef _SIMPLE_BVH_H
 #define _SIMPLE_BVH_H
+#include <cassert>
 #include <numeric>
 #include <vector>
 
+#include "bvh/build-primitives.hpp"
+#include "core/memory-arena.hpp"
 #include "core/triangle.hpp"
 
 class SimpleBVH {
  private:
-  std::vector<Triangle> primitives;  // Primitive(三角形)の配列
+  const Polygon* polygon;             // Primitive(三角形)を含むPolygon
+  std::vector<uint32_t> primIndices;  // Primitiveの面番号の配列
 
   // ノードを表す構造体
   struct BVHNode {
@@ -25,8 +29,11 @@ class SimpleBVH {
     int nLeafNodes{0};      // 葉ノードの数
   };
 
-  BVHNode* root;        // ルートノードへのポインタ
-  BVHStatistics stats;  // BVHの統計情報
+  // ノードを確保するアロケーター
+  // NOTE: ノードは深さ優先順(traverseの順番)にメモリ上に並ぶ
+  MemoryArena arena;
+  BVHNode* root{nullptr};  // ルートノードへのポインタ
+  BVHStatistics stats;     // BVHの統計情報
 
   // 葉ノードの作成
   BVHNode* createLeafNode(BVHNode* node, const AABB& bbox,
@@ -41,15 +48,16 @@ class SimpleBVH {
   }
 
   // 再帰的にBVHのノードを構築していく
-  BVHNode* buildBVHNode(int primStart, int primEnd) {
+  // primsは事前計算したPrimitiveのAABBと中心点
+  BVHNode* buildBVHNode(int primStart, int primEnd,
+                        const BuildPrimitives& prims) {
     // ノードの作成
-    BVHNode* node = new BVHNode;
+    BVHNode* node = arena.allocate<BVHNode>();
 
-    // AABBの計算
-    AABB bbox;
-    for (int i = primStart; i < primEnd; ++i) {
-      bbox = mergeAABB(bbox, primitives[i].calcAABB());
-    }
+    // AABBと, 分割用に各Primitiveの中心点を含むAABBを計算
+    // NOTE: bboxをそのまま使ってしまうとsplitが失敗することが多い
+    AABB bbox, splitAABB;
+    prims.calcBounds(primIndices.data(), primStart, primEnd, bbox, splitAABB);
 
     const int nPrims = primEnd - primStart;
     if (nPrims <= 4) {
@@ -57,42 +65,15 @@ class SimpleBVH {
       return createLeafNode(node, bbox, primStart, nPrims);
     }
 
-    // 分割用に各Primitiveの中心点を含むAABBを計算
-    // NOTE: bboxをそのまま使ってしまうとsplitが失敗することが多い
-    AABB splitAABB;
-    for (int i = primStart; i < primEnd; ++i) {
-      splitAABB = mergeAABB(splitAABB, primitives[i].calcAABB().center());
-    }
-
     // 分割軸
     const int splitAxis = splitAABB.longestAxis();
 
-    // 分割点
-    const float splitPos = splitAABB.center()[splitAxis];
-
     // AABBの分割(等数分割)
-    const int splitIdx = primStart + nPrims / 2;
-    std::nth_element(primitives.begin() + primStart,
-                     primitives.begin() + splitIdx,
-                     primitives.begin() + primEnd,
-                     [&](const auto& prim1, const auto& prim2) {
-                       return prim1.calcAABB().center()[splitAxis] <
-                              prim2.calcAABB().center()[splitAxis];
-                     });
-
-    // 分割が失敗した場合は葉ノードを作成
-    if (splitIdx == primStart || splitIdx == primEnd) {
-      std::cout << "splitting failed" << std::endl;
-      std::cout << "nPrimitives: " << nPrims << std::endl;
-      std::cout << "splitAxis: " << splitAxis << std::endl;
-      std::cout << "splitPos: " << splitPos << std::endl;
-      std::cout << "primStart: " << primStart << std::endl;
-      std::cout << "splitIdx: " << splitIdx << std::endl;
-      std::cout << "primEnd: " << primEnd << std::endl;
-      std::cout << std::endl;
-      // 葉ノードの作成
-      return createLeafNode(node, bbox, primStart, nPrims);
-    }
+    const int splitIdx =
+        prims.splitMedian(primIndices.data(), primStart, primEnd, splitAxis);
+
+    // NOTE: 等数分割なので, 5個以上のPrimitiveは必ず2つに分かれる
+    assert(splitIdx > primStart && splitIdx < primEnd);
 
     // 中間ノードに情報をセット
     node->bbox = bbox;
@@ -100,34 +81,27 @@ class SimpleBVH {
     node->axis = splitAxis;
 
     // 左の子ノードで同様の計算
-    node->child[0] = buildBVHNode(primStart, splitIdx);
+    node->child[0] = buildBVHNode(primStart, splitIdx, prims);
     // 右の子ノードで同様の計算
-    node->child[1] = buildBVHNode(splitIdx, primEnd);
+    node->child[1] = buildBVHNode(splitIdx, primEnd, prims);
     stats.nInternalNodes++;
 
     return node;
   }
 
-  // 再帰的にBVHNodeを消去していく
-  void deleteBVHNode(BVHNode* node) {
-    if (node->child[0]) deleteBVHNode(node->child[0]);
-    if (node->child[1]) deleteBVHNode(node->child[1]);
-    delete node;
-  }
-
   // 再帰的にBVHのtraverseを行う
-  bool intersectNode(const BVHNode* node, const Ray& ray, const Vec3& dirInv,
-                     const int dirInvSign[3], IntersectInfo& info) const {
+  bool intersectNode(const BVHNode* node, const Ray& ray,
+                     const PrecomputedRay& rayData, IntersectInfo& info) const {
     bool hit = false;
 
     // AABBとの交差判定
-    if (node->bbox.intersect(ray, dirInv, dirInvSign)) {
+    if (node->bbox.intersect(ray, rayData)) {
       if (node->child[0] == nullptr && node->child[1] == nullptr) {
         // 葉ノードの場合
         // ノードに含まれる全てのPrimitiveと交差計算
         const int primEnd = node->primIndicesOffset + node->nPrimitives;
         for (int i = node->primIndicesOffset; i < primEnd; ++i) {
-          if (primitives[i].intersect(ray, info)) {
+          if (Triangle(polygon, primIndices[i]).intersect(ray, info)) {
             // intersectしたらrayのtmaxを更新
             hit = true;
             ray.tmax = info.t;
@@ -136,10 +110,9 @@ class SimpleBVH {
       } else {
         // 子ノードとの交差判定
         // rayの方向に応じて最適な順番で交差判定をする
-        hit |= intersectNode(node->child[dirInvSign[node->axis]], ray, dirInv,
-                             dirInvSign, info);
-        hit |= intersectNode(node->child[1 - dirInvSign[node->axis]], ray,
-                             dirInv, dirInvSign, info);
+        const int sign = rayData.dirInvSign[node->axis];
+        hit |= intersectNode(node->child[sign], ray, rayData, info);
+        hit |= intersectNode(node->child[1 - sign], ray, rayData, info);
       }
     }
 
@@ -147,23 +120,23 @@ class SimpleBVH {
   }
 
  public:
-  SimpleBVH(const Polygon& polygon) {
-    // PolygonからTriangleを抜き出して追加していく
-    for (unsigned int f = 0; f < polygon.nFaces(); ++f) {
-      primitives.emplace_back(&polygon, f);
-    }
-  }
-
-  ~SimpleBVH() {
-    if (root) {
-      deleteBVHNode(root);
-    }
+  // NOTE: キーフレームがあるPolygonはMotionBVHを使う
+  SimpleBVH(const Polygon& polygon) : polygon(&polygon) {
+    assert(!polygon.hasMotion());
+    // Polygonの全ての面をPrimitiveとして追加していく
+    primIndices.resize(polygon.nFaces());
+    std::iota(primIndices.begin(), primIndices.end(), 0);
   }
 
   // BVHを構築する
   void buildBVH() {
+    // 各PrimitiveのAABBと中心点を事前計算しておく
+    const BuildPrimitives prims(polygon->nFaces(), [&](uint32_t prim) {
+      return Triangle(polygon, prim).calcAABB();
+    });
+
     // BVHの構築をルートノードから開始
-    root = buildBVHNode(0, primitives.size());
+    root = buildBVHNode(0, primIndices.size(), prims);
 
     // 総ノード数を計算
     stats.nNodes = stats.nInternalNodes + stats.nLeafNodes;
@@ -175,6 +148,10 @@ class SimpleBVH {
   int nInternalNodes() const { return stats.nInternalNodes; }
   // 葉ノード数を返す
   int nLeafNodes() const { return stats.nLeafNodes; }
+  // ノードとPrimitiveが使用しているメモリ量(Byte)を返す
+  size_t memoryUsage() const {
+    return arena.nBytesReserved() + sizeof(uint32_t) * primIndices.capacity();
+  }
 
   // 全体のバウンディングボックスを返す
   AABB rootAABB() const {
@@ -188,12 +165,14 @@ class SimpleBVH {
   // traverseをする
   bool intersect(const Ray& ray, IntersectInfo& info) const {
     // レイの方向の逆数と符号を事前計算しておく
-    const Vec3 dirInv = 1.0f / ray.direction;
-    int dirInvSign[3];
-    for (int i = 0; i < 3; ++i) {
-      dirInvSign[i] = dirInv[i] > 0 ? 0 : 1;
+    const PrecomputedRay rayData(ray);
+    if (!intersectNode(root, ray, rayData, info)) {
+      return false;
     }
-    return intersectNode(root, ray, dirInv, dirInvSign, info);
+
+    // 最も近い交差点の情報を計算する
+    Triangle(polygon, info.primID).calcSurfaceInfo(ray, info);
+    return true;
   }
 };
 
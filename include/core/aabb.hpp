@@ -2,10 +2,13 @@
 #define _AABB_H
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <limits>
 
+#include "core/precomputed-ray.hpp"
 #include "core/ray.hpp"
+#include "core/simd.hpp"
 #include "core/vec3.hpp"
 
 struct AABB {
@@ -13,7 +16,7 @@ struct AABB {
 
   explicit AABB()
       : bounds{Vec3(std::numeric_limits<float>::max()),
-               Vec3(std::numeric_limits<float>::min())} {}
+               Vec3(std::numeric_limits<float>::lowest())} {}
   explicit AABB(const Vec3& pMin, const Vec3& pMax) : bounds{pMin, pMax} {}
 
   Vec3 center() const { return 0.5f * (bounds[0] + bounds[1]); }
@@ -34,44 +37,178 @@ struct AABB {
     }
   }
 
-  bool intersect(const Ray& ray, const Vec3& dirInv,
-                 const int dirInvSign[3]) const {
+  // 点pまでの距離の2乗を返す. pが内側にある場合は0
+  float distance2(const Vec3& p) const {
+    const Float4 v = Float4::load(p);
+    const Float4 d = max(max(Float4::load(bounds[0]) - v,
+                             v - Float4::load(bounds[1])),
+                         Float4(0.0f));
+    return dot3(d, d);
+  }
+
+  // bboxまでの距離の2乗を返す. 重なっている場合は0
+  float distance2(const AABB& bbox) const {
+    const Float4 d = max(max(Float4::load(bounds[0]) -
+                                 Float4::load(bbox.bounds[1]),
+                             Float4::load(bbox.bounds[0]) -
+                                 Float4::load(bounds[1])),
+                         Float4(0.0f));
+    return dot3(d, d);
+  }
+
+  // bboxと重なっているか
+  bool overlaps(const AABB& bbox) const {
+    const Bool4 separated =
+        (Float4::load(bbox.bounds[1]) < Float4::load(bounds[0])) |
+        (Float4::load(bbox.bounds[0]) > Float4::load(bounds[1]));
+    return (separated.mask() & 0b111) == 0;
+  }
+
+  // 三角形v0v1v2と重なっているか(分離軸判定)
+  // Real-Time Collision Detection 5.2.9
+  bool overlaps(const Vec3& v0, const Vec3& v1, const Vec3& v2) const {
+    // AABBの中心が原点になるように平行移動する
+    const Vec3 c = center();
+    const Vec3 e = 0.5f * (bounds[1] - bounds[0]);
+    const Vec3 p[3] = {v0 - c, v1 - c, v2 - c};
+    const Vec3 f[3] = {p[1] - p[0], p[2] - p[1], p[0] - p[2]};
+
+    // AABBの各軸と三角形の各辺の外積(9軸)
+    for (int i = 0; i < 3; ++i) {
+      Vec3 axis(0);
+      axis[i] = 1;
+      for (int j = 0; j < 3; ++j) {
+        const Vec3 a = cross(axis, f[j]);
+        const float r = e[0] * std::abs(a[0]) + e[1] * std::abs(a[1]) +
+                        e[2] * std::abs(a[2]);
+        const float q0 = dot(p[0], a);
+        const float q1 = dot(p[1], a);
+        const float q2 = dot(p[2], a);
+        if (std::max({q0, q1, q2}) < -r || std::min({q0, q1, q2}) > r) {
+          return false;
+        }
+      }
+    }
+
+    // AABBの各軸(3軸)
+    for (int i = 0; i < 3; ++i) {
+      if (std::max({p[0][i], p[1][i], p[2][i]}) < -e[i] ||
+          std::min({p[0][i], p[1][i], p[2][i]}) > e[i]) {
+        return false;
+      }
+    }
+
+    // 三角形の法線
+    const Vec3 n = cross(f[0], f[1]);
+    const float r = e[0] * std::abs(n[0]) + e[1] * std::abs(n[1]) +
+                    e[2] * std::abs(n[2]);
+    return std::abs(dot(n, p[0])) <= r;
+  }
+
+  // レイとの交差判定(slab test)
+  // rayDataはrayから事前計算した情報
+  bool intersect(const Ray& ray, const PrecomputedRay& rayData) const {
     // https://dl.acm.org/doi/abs/10.1145/1198555.1198748
-    float tmin, tmax, tymin, tymax, tzmin, tzmax;
-
-    tmin = (bounds[dirInvSign[0]][0] - ray.origin[0]) * dirInv[0];
-    tmax = (bounds[1 - dirInvSign[0]][0] - ray.origin[0]) * dirInv[0];
-    tymin = (bounds[dirInvSign[1]][1] - ray.origin[1]) * dirInv[1];
-    tymax = (bounds[1 - dirInvSign[1]][1] - ray.origin[1]) * dirInv[1];
-    if (tmin > tymax || tymin > tmax) return false;
-    if (tymin > tmin) tmin = tymin;
-    if (tymax < tmax) tmax = tymax;
-
-    tzmin = (bounds[dirInvSign[2]][2] - ray.origin[2]) * dirInv[2];
-    tzmax = (bounds[1 - dirInvSign[2]][2] - ray.origin[2]) * dirInv[2];
-    if (tmin > tzmax || tzmin > tmax) return false;
-    if (tzmin > tmin) tmin = tzmin;
-    if (tzmax < tmax) tmax = tzmax;
-
-    return tmin < ray.tmax && tmax > ray.tmin;
+    // 分岐を使わず, 3軸分のmin/maxを取ってから最後に一度だけ比較する
+    // NOTE: レイの方向が0の軸で原点がAABBの境界上にあると0 * inf = NaNになる.
+    // NaNとの比較はfalseになるので, その場合はその軸の制約が無視される
+    // NOTE: 丸め誤差で交差を見逃さないように, 遠い面の距離を保守的に大きくする
+    // https://jcgt.org/published/0002/02/02/
+#ifdef BVH_SIMD_SSE
+    // 3軸分をまとめて計算する
+    const Float4 pMin = Float4::load(bounds[0]);
+    const Float4 pMax = Float4::load(bounds[1]);
+
+    // レイの方向に応じて近い面と遠い面を選ぶ
+    const Float4 t0 = (select(rayData.negative, pMax, pMin) - rayData.origin4) *
+                      rayData.dirInv4;
+    const Float4 t1 = (select(rayData.negative, pMin, pMax) - rayData.origin4) *
+                      rayData.dirInv4 * Float4(ROBUST_SCALE);
+
+    return slabTest(t0, t1, ray);
+#else
+    // 事前計算したByteオフセットで近い面と遠い面を選ぶ
+    const char* p = reinterpret_cast<const char*>(bounds);
+    float tmin = ray.tmin;
+    float tmax = ray.tmax;
+    for (int i = 0; i < 3; ++i) {
+      const float pNear =
+          *reinterpret_cast<const float*>(p + rayData.nearOffset[i]);
+      const float pFar =
+          *reinterpret_cast<const float*>(p + rayData.farOffset[i]);
+      const float t0 = (pNear - rayData.origin[i]) * rayData.dirInv[i];
+      const float t1 =
+          (pFar - rayData.origin[i]) * rayData.dirInv[i] * ROBUST_SCALE;
+      // NOTE: maxss, minssになるように比較の向きを揃えている
+      tmin = t0 > tmin ? t0 : tmin;
+      tmax = t1 < tmax ? t1 : tmax;
+    }
+    return tmin <= tmax;
+#endif
+  }
+
+  // レイの方向の象限octantをコンパイル時に固定したレイとの交差判定
+  // octantのiビット目はrayData.dirInvSign[i]と一致している必要がある
+  // NOTE: 近い面と遠い面の選択がデータに依存しなくなる
+  template <int octant>
+  bool intersect(const Ray& ray, const PrecomputedRay& rayData) const {
+#ifdef BVH_SIMD_SSE
+    const Float4 pMin = Float4::load(bounds[0]);
+    const Float4 pMax = Float4::load(bounds[1]);
+    const Float4 t0 = (blend<octant>(pMin, pMax) - rayData.origin4) *
+                      rayData.dirInv4;
+    const Float4 t1 = (blend<octant>(pMax, pMin) - rayData.origin4) *
+                      rayData.dirInv4 * Float4(ROBUST_SCALE);
+    return slabTest(t0, t1, ray);
+#else
+    float tmin = ray.tmin;
+    float tmax = ray.tmax;
+    for (int i = 0; i < 3; ++i) {
+      const int sign = (octant >> i) & 1;
+      const float t0 =
+          (bounds[sign][i] - rayData.origin[i]) * rayData.dirInv[i];
+      const float t1 = (bounds[1 - sign][i] - rayData.origin[i]) *
+                       rayData.dirInv[i] * ROBUST_SCALE;
+      tmin = t0 > tmin ? t0 : tmin;
+      tmax = t1 < tmax ? t1 : tmax;
+    }
+    return tmin <= tmax;
+#endif
+  }
+
+ private:
+#ifdef BVH_SIMD_SSE
+  // 3軸分の近い面と遠い面までの距離から交差しているか判定する
+  static bool slabTest(const Float4& t0, const Float4& t1, const Ray& ray) {
+    // NOTE: max, minはNaNの場合に2番目の引数を返すので, NaNの軸は無視される
+    const float tmin = reduceMax3(max(t0, Float4(ray.tmin)));
+    const float tmax = reduceMin3(min(t1, Float4(ray.tmax)));
+    return tmin <= tmax;
   }
+#endif
+
+  // 遠い面の距離に掛ける係数 1 + 2 * gamma(3)
+  // gamma(n) = n * eps / (1 - n * eps)は, n回の浮動小数点演算の相対誤差の上限
+  static constexpr float GAMMA3 =
+      3 * (0.5f * std::numeric_limits<float>::epsilon()) /
+      (1 - 3 * (0.5f * std::numeric_limits<float>::epsilon()));
+  static constexpr float ROBUST_SCALE = 1 + 2 * GAMMA3;
 };
 
 inline AABB mergeAABB(const AABB& bbox, const Vec3& p) {
+  const Float4 v = Float4::load(p);
   AABB ret;
-  for (int i = 0; i < 3; ++i) {
-    ret.bounds[0][i] = std::min(bbox.bounds[0][i], p[i]);
-    ret.bounds[1][i] = std::max(bbox.bounds[1][i], p[i]);
-  }
+  min(Float4::load(bbox.bounds[0]), v).store(ret.bounds[0]);
+  max(Float4::load(bbox.bounds[1]), v).store(ret.bounds[1]);
   return ret;
 }
 
 inline AABB mergeAABB(const AABB& bbox1, const AABB& bbox2) {
   AABB ret;
-  for (int i = 0; i < 3; ++i) {
-    ret.bounds[0][i] = std::min(bbox1.bounds[0][i], bbox2.bounds[0][i]);
-    ret.bounds[1][i] = std::max(bbox1.bounds[1][i], bbox2.bounds[1][i]);
-  }
+  min(Float4::load(bbox1.bounds[0]), Float4::load(bbox2.bounds[0]))
+      .store(ret.bounds[0]);
+  max(Float4::load(bbox1.bounds[1]), Float4::load(bbox2.bounds[1]))
+      .store(ret.bounds[1]);
   return ret;
 }
 
@@ -0,0 +1,20 @@
+#ifndef _CLOSEST_POINT_INFO_H
+#define _CLOSEST_POINT_INFO_H
+#include "core/vec3.hpp"
+
+struct ClosestPointInfo {
+  float distance;
+  Vec3 position;
+  Vec3 normal;
+  float barycentric[2];
+  int geomID;
+  int primID;
+
+  // 点pからの符号付き距離を返す. pが面の裏側にある場合は負になる
+  // NOTE: pはclosestPointに渡した点
+  float signedDistance(const Vec3& p) const {
+    return dot(p - position, normal) < 0.0f ? -distance : distance;
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _FRUSTUM_H
+#define _FRUSTUM_H
+#include <algorithm>
+
+#include "core/aabb.hpp"
+#include "core/vec3.hpp"
+
+// 6枚の平面で囲まれた視錐台(重なり判定のクエリに使う)
+// NOTE: 重なり判定は保守的で, どれか1枚の平面の完全に外側にある場合のみ
+// 重ならないと判定する. 視錐台の角の近くでは重なっていなくてもtrueになる
+struct Frustum {
+  // 平面iの外側はdot(normals[i], x) > offsets[i]を満たす点x
+  Vec3 normals[6];   // 外向きの法線
+  float offsets[6];  // 原点からの距離
+
+  explicit Frustum(const Vec3 normals[6], const float offsets[6]) {
+    std::copy(normals, normals + 6, this->normals);
+    std::copy(offsets, offsets + 6, this->offsets);
+  }
+
+  // 透視投影のカメラの視錐台
+  // forward, right, upは正規直交基底(right = cross(forward, up)),
+  // halfWidth, halfHeightはoriginからforward方向に距離1の位置での
+  // 視野の幅と高さの半分
+  // near, farはforward方向の描画範囲
+  explicit Frustum(const Vec3& origin, const Vec3& forward, const Vec3& right,
+                   const Vec3& up, float halfWidth, float halfHeight,
+                   float near, float far) {
+    // 側面は視野の端の辺とoriginを含む平面(右, 左, 上, 下)
+    const Vec3 sides[4][2] = {
+        {forward + halfWidth * right, up},
+        {forward - halfWidth * right, -up},
+        {forward + halfHeight * up, -right},
+        {forward - halfHeight * up, right},
+    };
+    for (int i = 0; i < 4; ++i) {
+      normals[i] = normalize(cross(sides[i][0], sides[i][1]));
+      offsets[i] = dot(normals[i], origin);
+    }
+    normals[4] = -forward;
+    offsets[4] = dot(normals[4], origin + near * forward);
+    normals[5] = forward;
+    offsets[5] = dot(normals[5], origin + far * forward);
+  }
+
+  // bboxと重なっている可能性があるか
+  bool overlaps(const AABB& bbox) const {
+    for (int i = 0; i < 6; ++i) {
+      // 法線と逆方向に最も遠いAABBの頂点が外側なら, AABB全体が外側
+      Vec3 p;
+      for (int axis = 0; axis < 3; ++axis) {
+        p[axis] = bbox.bounds[normals[i][axis] < 0 ? 1 : 0][axis];
+      }
+      if (dot(normals[i], p) > offsets[i]) return false;
+    }
+    return true;
+  }
+
+  // 三角形v0v1v2と重なっている可能性があるか
+  bool overlaps(const Vec3& v0, const Vec3& v1, const Vec3& v2) const {
+    for (int i = 0; i < 6; ++i) {
+      if (dot(normals[i], v0) > offsets[i] &&
+          dot(normals[i], v1) > offsets[i] &&
+          dot(normals[i], v2) > offsets[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
@@ -6,6 +6,7 @@ struct IntersectInfo {
   float t;
   Vec3 hitPos;
   Vec3 hitNormal;
+  Vec3 geomNormal;
   float barycentric[2];
   float uv[2];
   int geomID;
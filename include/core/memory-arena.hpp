@@ -0,0 +1,80 @@
+#ifndef _MEMORY_ARENA_H
+#define _MEMORY_ARENA_H
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// 大きなブロックを確保し, そこから先頭から順番に切り出していくアロケーター
+// 個別の解放はできず, reset()または破棄時にまとめて解放する
+// NOTE: 確保した順番にメモリ上に並ぶので,
+// 確保順を走査順と揃えるとキャッシュ効率が良くなる
+class MemoryArena {
+ private:
+  static constexpr size_t BLOCK_ALIGNMENT = 64;  // キャッシュラインに揃える
+
+  size_t blockSize;                                   // ブロックのサイズ
+  std::vector<std::pair<std::byte*, size_t>> blocks;  // 確保したブロック
+  size_t currentPos{0};                               // 次に切り出す位置
+  size_t nBytesUsed{0};                               // 切り出した合計
+
+ public:
+  explicit MemoryArena(size_t blockSize = 256 * 1024) : blockSize(blockSize) {}
+  MemoryArena(const MemoryArena&) = delete;
+  MemoryArena& operator=(const MemoryArena&) = delete;
+  ~MemoryArena() { reset(); }
+
+  // sizeバイトの領域をalignmentに揃えて切り出す
+  void* allocate(size_t size, size_t alignment) {
+    assert(alignment <= BLOCK_ALIGNMENT);
+    size_t pos = (currentPos + alignment - 1) & ~(alignment - 1);
+
+    // 現在のブロックに収まらない場合は新しいブロックを確保する
+    if (blocks.empty() || pos + size > blocks.back().second) {
+      const size_t newBlockSize = std::max(size, blockSize);
+      std::byte* block = static_cast<std::byte*>(
+          ::operator new(newBlockSize, std::align_val_t(BLOCK_ALIGNMENT)));
+      blocks.emplace_back(block, newBlockSize);
+      pos = 0;
+    }
+
+    currentPos = pos + size;
+    nBytesUsed += size;
+    return blocks.back().first + pos;
+  }
+
+  // Tを1つ切り出して初期化する
+  // NOTE: デストラクタは呼ばれないので, 自明に破棄可能な型のみ扱う
+  template <typename T>
+  T* allocate() {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "MemoryArena only supports trivially destructible types");
+    return new (allocate(sizeof(T), alignof(T))) T;
+  }
+
+  // 全てのブロックを解放する
+  void reset() {
+    for (const auto& block : blocks) {
+      ::operator delete(block.first, std::align_val_t(BLOCK_ALIGNMENT));
+    }
+    blocks.clear();
+    currentPos = 0;
+    nBytesUsed = 0;
+  }
+
+  // 切り出したバイト数を返す
+  size_t nBytesAllocated() const { return nBytesUsed; }
+  // 確保したブロックの合計バイト数を返す
+  size_t nBytesReserved() const {
+    size_t ret = 0;
+    for (const auto& block : blocks) {
+      ret += block.second;
+    }
+    return ret;
+  }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef _PAGE_ALLOCATOR_H
+#define _PAGE_ALLOCATOR_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// BVH_USE_HUGE_PAGES: 大きなバッファをHuge Page(2MB)で確保する
+// BVH_USE_NUMA: libnumaを使ってバッファを配置するNUMAノードを指定する
+// どちらも定義されていない場合は通常のoperator newと同じ
+#if defined(__linux__) && \
+    (defined(BVH_USE_HUGE_PAGES) || defined(BVH_USE_NUMA))
+#define BVH_USE_PAGE_ALLOCATION
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(BVH_USE_PAGE_ALLOCATION) && defined(BVH_USE_NUMA)
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#endif
+
+// Huge Pageのサイズ
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// 全てのNUMAノードに交互に配置することを表す値
+constexpr int NUMA_INTERLEAVE = -1;
+
+// 使用できるNUMAノードの番号を返す
+// NOTE: ノード番号は連続しているとは限らない
+inline std::vector<int> numaNodes() {
+#if defined(BVH_USE_PAGE_ALLOCATION) && defined(BVH_USE_NUMA)
+  if (numa_available() >= 0) {
+    std::vector<int> ret;
+    for (int node = 0; node <= numa_max_node(); ++node) {
+      if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+        ret.push_back(node);
+      }
+    }
+    if (!ret.empty()) return ret;
+  }
+#endif
+  return {0};
+}
+
+// 使用できるNUMAノードの数を返す
+inline int nNumaNodes() { return numaNodes().size(); }
+
+// 現在のスレッドが動いているNUMAノードを返す
+// NOTE: 問い合わせのたびにsched_getcpuとnuma_node_of_cpuを呼ばないように,
+// スレッドごとに最初に調べた値を使う. スレッドが別のノードに移動した場合は
+// 古い値のままになるので, スレッドをノードに固定して使う
+inline int currentNumaNode() {
+#if defined(BVH_USE_PAGE_ALLOCATION) && defined(BVH_USE_NUMA)
+  thread_local const int numaNode = [] {
+    if (numa_available() < 0) return 0;
+    const int cpu = sched_getcpu();
+    return cpu >= 0 ? std::max(numa_node_of_cpu(cpu), 0) : 0;
+  }();
+  return numaNode;
+#else
+  return 0;
+#endif
+}
+
+// 確保済みの領域にメモリ配置の方針を適用する
+// Huge Pageを使うようにカーネルに伝え, numaNodeのNUMAノード
+// (NUMA_INTERLEAVEの場合は全てのノードに交互)に配置する.
+// 既に物理ページが割り当てられている場合は移動する
+// NOTE: ページ単位でしか適用できないので, 前後のページも対象になる
+inline void applyMemoryPolicy([[maybe_unused]] const void* p,
+                              [[maybe_unused]] size_t size,
+                              [[maybe_unused]] int numaNode = NUMA_INTERLEAVE) {
+#ifdef BVH_USE_PAGE_ALLOCATION
+  if (p == nullptr || size == 0) return;
+  const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(p) & ~(pageSize - 1);
+  const uintptr_t end =
+      (reinterpret_cast<uintptr_t>(p) + size + pageSize - 1) & ~(pageSize - 1);
+  void* addr = reinterpret_cast<void*>(begin);
+
+#ifdef BVH_USE_HUGE_PAGES
+  madvise(addr, end - begin, MADV_HUGEPAGE);
+#endif
+
+#ifdef BVH_USE_NUMA
+  if (numa_available() < 0) return;
+  bitmask* nodes = numa_allocate_nodemask();
+  if (numaNode == NUMA_INTERLEAVE) {
+    copy_bitmask_to_bitmask(numa_all_nodes_ptr, nodes);
+  } else {
+    numa_bitmask_setbit(nodes, numaNode);
+  }
+  mbind(addr, end - begin,
+        numaNode == NUMA_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_BIND,
+        nodes->maskp, nodes->size + 1, MPOL_MF_MOVE);
+  numa_free_nodemask(nodes);
+#endif
+#endif
+}
+
+// allocatePagesでmmapを使って確保するか
+// HUGE_PAGE_SIZE以上の領域と, NUMAノードを指定した領域はページ単位で確保する
+inline bool usesPageMapping([[maybe_unused]] size_t size,
+                            [[maybe_unused]] int numaNode) {
+#ifdef BVH_USE_PAGE_ALLOCATION
+#ifdef BVH_USE_NUMA
+  if (numaNode != NUMA_INTERLEAVE) return true;
+#endif
+  return size >= HUGE_PAGE_SIZE;
+#else
+  return false;
+#endif
+}
+
+// ページ単位で領域を確保する
+// NOTE: usesPageMappingがfalseの領域はoperator newでalignmentに揃えて
+// 確保する. NUMAノードを指定した領域は, 小さくても他の領域とページを
+// 共有しないようにmmapで確保して配置する
+inline void* allocatePages(size_t size, size_t alignment,
+                           int numaNode = NUMA_INTERLEAVE) {
+#ifdef BVH_USE_PAGE_ALLOCATION
+  if (usesPageMapping(size, numaNode) && size < HUGE_PAGE_SIZE) {
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t alignedSize = (size + pageSize - 1) & ~(pageSize - 1);
+    void* p = mmap(nullptr, std::max(alignedSize, pageSize),
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    applyMemoryPolicy(p, alignedSize, numaNode);
+    return p;
+  }
+  if (usesPageMapping(size, numaNode)) {
+    // Huge Pageの境界に揃えるために余分に確保し, 前後を解放する
+    const size_t alignedSize =
+        (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    void* p = mmap(nullptr, alignedSize + HUGE_PAGE_SIZE,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(p);
+    const uintptr_t aligned =
+        (begin + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (aligned > begin) {
+      munmap(p, aligned - begin);
+    }
+    if (begin + HUGE_PAGE_SIZE > aligned) {
+      munmap(reinterpret_cast<void*>(aligned + alignedSize),
+             begin + HUGE_PAGE_SIZE - aligned);
+    }
+
+    // 物理ページが割り当てられる前に方針を適用しておく
+    applyMemoryPolicy(reinterpret_cast<void*>(aligned), alignedSize, numaNode);
+    return reinterpret_cast<void*>(aligned);
+  }
+#else
+  static_cast<void>(numaNode);
+#endif
+  return ::operator new(size, std::align_val_t(alignment));
+}
+
+// allocatePagesで確保した領域を解放する
+// NOTE: size, alignment, numaNodeは確保した時と同じ値を渡す
+inline void deallocatePages(void* p, size_t size, size_t alignment,
+                            int numaNode = NUMA_INTERLEAVE) {
+#ifdef BVH_USE_PAGE_ALLOCATION
+  if (usesPageMapping(size, numaNode) && size < HUGE_PAGE_SIZE) {
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    munmap(p, std::max((size + pageSize - 1) & ~(pageSize - 1), pageSize));
+    return;
+  }
+  if (usesPageMapping(size, numaNode)) {
+    munmap(p, (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    return;
+  }
+#else
+  static_cast<void>(size);
+  static_cast<void>(numaNode);
+#endif
+  ::operator delete(p, std::align_val_t(alignment));
+}
+
+// allocatePagesを使うアロケーター
+// NOTE: BVHのノードなど, traverse中に何度も読む大きな配列に使う
+template <typename T>
+class PageAllocator {
+ public:
+  using value_type = T;
+
+  int numaNode;  // 配置するNUMAノード
+
+  PageAllocator(int numaNode = NUMA_INTERLEAVE) : numaNode(numaNode) {}
+  template <typename U>
+  PageAllocator(const PageAllocator<U>& other) : numaNode(other.numaNode) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(allocatePages(sizeof(T) * n, alignof(T), numaNode));
+  }
+  void deallocate(T* p, size_t n) {
+    deallocatePages(p, sizeof(T) * n, alignof(T), numaNode);
+  }
+
+  template <typename U>
+  bool operator==(const PageAllocator<U>& other) const {
+    return numaNode == other.numaNode;
+  }
+  template <typename U>
+  bool operator!=(const PageAllocator<U>& other) const {
+    return numaNode != other.numaNode;
+  }
+};
+
+// PageAllocatorを使う配列
+template <typename T>
+using PageVector = std::vector<T, PageAllocator<T>>;
+
+#endif
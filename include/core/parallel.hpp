@@ -0,0 +1,47 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// [begin, end)をgrainSizeずつの区間に分け, 複数のスレッドで
+// f(chunkBegin, chunkEnd)を呼ぶ
+// nThreadsが0の場合はハードウェアのスレッド数を使う
+// NOTE: 区間は空いたスレッドから順に取っていくので, 処理時間に偏りがあっても
+// 負荷が分散される. fは複数のスレッドから同時に呼ばれる
+template <typename F>
+void parallelFor(size_t begin, size_t end, size_t grainSize, const F& f,
+                 unsigned int nThreads = 0) {
+  if (begin >= end) return;
+  grainSize = std::max<size_t>(grainSize, 1);
+
+  if (nThreads == 0) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  const size_t nChunks = (end - begin + grainSize - 1) / grainSize;
+  nThreads = std::min<size_t>(nThreads, nChunks);
+
+  std::atomic<size_t> next{begin};
+  const auto worker = [&]() {
+    while (true) {
+      const size_t chunkBegin = next.fetch_add(grainSize);
+      if (chunkBegin >= end) break;
+      f(chunkBegin, std::min(chunkBegin + grainSize, end));
+    }
+  };
+
+  // 呼び出したスレッドも処理に参加する
+  std::vector<std::thread> threads;
+  threads.reserve(nThreads - 1);
+  for (unsigned int i = 1; i < nThreads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// BVH_USE_PERF_COUNTERS: Linuxのperf_event_openでハードウェアカウンタ
+// (サイクル数, 命令数, キャッシュミス, 分岐予測ミスなど)を読む
+// 定義されていない場合は全てのカウンタが無効になり, 計測は何もしない
+#if defined(__linux__) && defined(BVH_USE_PERF_COUNTERS)
+#define BVH_USE_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+// 計測するカウンタ
+enum class PerfEvent {
+  CYCLES,            // CPUのサイクル数
+  INSTRUCTIONS,      // 実行した命令数
+  CACHE_REFERENCES,  // 最後のレベルのキャッシュへのアクセス数
+  CACHE_MISSES,      // 最後のレベルのキャッシュのミス数
+  L1D_READ_MISSES,   // L1データキャッシュの読み込みミス数
+  BRANCHES,          // 分岐命令数
+  BRANCH_MISSES,     // 分岐予測ミス数
+  TASK_CLOCK,        // スレッドが動いていた時間(ns)
+  PAGE_FAULTS,       // ページフォルト数
+};
+
+// カウンタの数
+constexpr int N_PERF_EVENTS = 9;
+
+// カウンタの名前
+constexpr const char* PERF_EVENT_NAMES[N_PERF_EVENTS] = {
+    "cycles",        "instructions",    "cache-references",
+    "cache-misses",  "L1D-read-misses", "branches",
+    "branch-misses", "task-clock(ns)",  "page-faults"};
+
+// カウンタの値の組
+// NOTE: 読めなかったカウンタはvalidがfalseになる
+struct PerfCounterValues {
+  uint64_t values[N_PERF_EVENTS]{};
+  bool valid[N_PERF_EVENTS]{};
+
+  uint64_t operator[](PerfEvent event) const {
+    return values[static_cast<int>(event)];
+  }
+  bool isValid(PerfEvent event) const { return valid[static_cast<int>(event)]; }
+
+  PerfCounterValues& operator+=(const PerfCounterValues& other) {
+    for (int i = 0; i < N_PERF_EVENTS; ++i) {
+      values[i] += other.values[i];
+      valid[i] |= other.valid[i];
+    }
+    return *this;
+  }
+
+  // 2つの時点の差を返す
+  friend PerfCounterValues operator-(const PerfCounterValues& end,
+                                     const PerfCounterValues& start) {
+    PerfCounterValues ret;
+    for (int i = 0; i < N_PERF_EVENTS; ++i) {
+      ret.valid[i] = end.valid[i] && start.valid[i];
+      ret.values[i] = ret.valid[i] ? end.values[i] - start.values[i] : 0;
+    }
+    return ret;
+  }
+
+  // numerator / denominatorを返す. どちらかが無効な場合は負の値を返す
+  double ratio(PerfEvent numerator, PerfEvent denominator) const {
+    if (!isValid(numerator) || !isValid(denominator) ||
+        (*this)[denominator] == 0) {
+      return -1.0;
+    }
+    return static_cast<double>((*this)[numerator]) / (*this)[denominator];
+  }
+};
+
+// 呼び出したスレッドのカウンタ
+// 作成した時点から数え始め, readでそれまでの値を返す
+// NOTE: 他のスレッドの分は数えないので, スレッドごとに作る.
+// ハードウェアカウンタは1つのグループとして開き, 同じ期間を数えるようにする.
+// グループを開けない場合(カウンタが足りない場合など)は1つずつ開き,
+// カーネルが時分割で数えた分を, 数えていた時間の割合で補正する
+class PerfCounters {
+ private:
+  int fds[N_PERF_EVENTS];  // 各カウンタのファイルディスクリプタ
+
+#ifdef BVH_USE_PERF_EVENT
+  int nGroupEvents{0};  // 先頭からグループで開いたカウンタの数
+
+  // ハードウェアカウンタの数. PerfEventの先頭から並んでいる
+  static constexpr int N_HARDWARE_EVENTS = 7;
+
+  // カウンタを開く. groupedの場合はグループとして読み,
+  // groupFdが-1でない場合はそのリーダーのグループに加える.
+  // 失敗した場合は-1を返す
+  static int open(uint32_t type, uint64_t config, bool grouped = false,
+                  int groupFd = -1) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (grouped) attr.read_format |= PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+  }
+
+  // 数えていた時間の割合で補正した値を返す
+  static uint64_t scale(uint64_t value, uint64_t timeEnabled,
+                        uint64_t timeRunning) {
+    return timeRunning > 0 ? static_cast<uint64_t>(static_cast<double>(value) *
+                                                   timeEnabled / timeRunning)
+                           : 0;
+  }
+#endif
+
+ public:
+  PerfCounters() {
+    for (int i = 0; i < N_PERF_EVENTS; ++i) {
+      fds[i] = -1;
+    }
+#ifdef BVH_USE_PERF_EVENT
+    constexpr uint64_t L1D_READ_MISS =
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const std::pair<uint32_t, uint64_t> events[N_PERF_EVENTS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HW_CACHE, L1D_READ_MISS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    };
+    // ハードウェアカウンタを先頭のカウンタをリーダーとするグループで開く
+    bool grouped = true;
+    for (int i = 0; i < N_HARDWARE_EVENTS && grouped; ++i) {
+      fds[i] =
+          open(events[i].first, events[i].second, true, i > 0 ? fds[0] : -1);
+      grouped = fds[i] >= 0;
+    }
+    if (grouped) {
+      nGroupEvents = N_HARDWARE_EVENTS;
+    } else {
+      for (int i = 0; i < N_HARDWARE_EVENTS; ++i) {
+        if (fds[i] >= 0) close(fds[i]);
+        fds[i] = -1;
+      }
+    }
+
+    // グループに入れなかったカウンタは1つずつ開く.
+    // 仮想マシンなどで使えないカウンタは無効のままにする
+    for (int i = nGroupEvents; i < N_PERF_EVENTS; ++i) {
+      fds[i] = open(events[i].first, events[i].second);
+    }
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#ifdef BVH_USE_PERF_EVENT
+    for (int i = 0; i < N_PERF_EVENTS; ++i) {
+      if (fds[i] >= 0) close(fds[i]);
+    }
+#endif
+  }
+
+  // 作成した時点からのカウンタの値を返す
+  PerfCounterValues read() const {
+    PerfCounterValues ret;
+#ifdef BVH_USE_PERF_EVENT
+    // グループのカウンタはリーダーからまとめて読む
+    // カウンタの数, 有効だった時間, 実際に数えていた時間, 各カウンタの値
+    if (nGroupEvents > 0) {
+      uint64_t data[3 + N_PERF_EVENTS];
+      const ssize_t size = sizeof(uint64_t) * (3 + nGroupEvents);
+      if (::read(fds[0], data, size) == size &&
+          data[0] == static_cast<uint64_t>(nGroupEvents)) {
+        for (int i = 0; i < nGroupEvents; ++i) {
+          ret.valid[i] = true;
+          ret.values[i] = scale(data[3 + i], data[1], data[2]);
+        }
+      }
+    }
+    for (int i = nGroupEvents; i < N_PERF_EVENTS; ++i) {
+      if (fds[i] < 0) continue;
+      // 値, 有効だった時間, 実際に数えていた時間
+      uint64_t data[3];
+      if (::read(fds[i], data, sizeof(data)) != sizeof(data)) continue;
+      ret.valid[i] = true;
+      ret.values[i] = scale(data[0], data[1], data[2]);
+    }
+#endif
+    return ret;
+  }
+
+  // 呼び出したスレッドのカウンタを返す
+  static const PerfCounters& thisThread() {
+    thread_local const PerfCounters counters;
+    return counters;
+  }
+};
+
+// 計測区間(構築, traverseなど)ごと, スレッドごとにカウンタを集計する
+// 使い方:
+//   PerfProfiler profiler;
+//   {
+//     const PerfProfiler::Phase phase(profiler, "build");
+//     bvh.buildBVH();
+//   }
+//   profiler.report(std::cout);
+// NOTE: 区間は入れ子にでき, 複数のスレッドから同時に計測できる
+class PerfProfiler {
+ private:
+  mutable std::mutex mutex;
+  std::vector<std::string> phaseNames;  // 計測区間の名前(最初に計測した順)
+  // 計測区間ごと, スレッドごとのカウンタの合計
+  std::map<std::string, std::map<int, PerfCounterValues>> phases;
+
+  // 呼び出したスレッドの番号(最初に計測した順)を返す
+  static int threadIndex() {
+    static std::atomic<int> nThreads{0};
+    thread_local const int index = nThreads++;
+    return index;
+  }
+
+  // 値を表示する. 無効な値は"-"にする
+  template <typename T>
+  static void printValue(std::ostream& stream, bool valid, T value) {
+    if (valid) {
+      stream << value;
+    } else {
+      stream << "-";
+    }
+  }
+
+  static void printValues(std::ostream& stream, const std::string& label,
+                          const PerfCounterValues& values) {
+    stream << "    " << label << ":";
+    for (int i = 0; i < N_PERF_EVENTS; ++i) {
+      stream << " " << PERF_EVENT_NAMES[i] << "=";
+      printValue(stream, values.valid[i], values.values[i]);
+    }
+    const double ipc = values.ratio(PerfEvent::INSTRUCTIONS, PerfEvent::CYCLES);
+    const double cacheMissRate =
+        values.ratio(PerfEvent::CACHE_MISSES, PerfEvent::CACHE_REFERENCES);
+    const double branchMissRate =
+        values.ratio(PerfEvent::BRANCH_MISSES, PerfEvent::BRANCHES);
+    stream << " IPC=";
+    printValue(stream, ipc >= 0, ipc);
+    stream << " cache-miss-rate=";
+    printValue(stream, cacheMissRate >= 0, 100.0 * cacheMissRate);
+    stream << "% branch-miss-rate=";
+    printValue(stream, branchMissRate >= 0, 100.0 * branchMissRate);
+    stream << "%" << std::endl;
+  }
+
+ public:
+  // スコープの間のカウンタを計測し, profilerに加える
+  // NOTE: BVH_USE_PERF_COUNTERSが定義されていない場合は何もしない.
+  // 名前の文字列も作らないので, 計測したい処理の中に置いたままにできる
+  class Phase {
+#ifdef BVH_USE_PERF_EVENT
+   private:
+    PerfProfiler& profiler;
+    std::string name;
+    PerfCounterValues start;
+
+   public:
+    Phase(PerfProfiler& profiler, std::string name)
+        : profiler(profiler),
+          name(std::move(name)),
+          start(PerfCounters::thisThread().read()) {}
+    ~Phase() {
+      profiler.add(name, PerfCounters::thisThread().read() - start);
+    }
+#else
+   public:
+    template <typename Name>
+    Phase(PerfProfiler&, const Name&) {}
+#endif
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+  };
+
+  // 呼び出したスレッドの計測区間nameにvaluesを加える
+  // NOTE: BVH_USE_PERF_COUNTERSが定義されていない場合は何もしない
+  void add(const std::string& name, const PerfCounterValues& values) {
+#ifdef BVH_USE_PERF_EVENT
+    const int thread = threadIndex();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (phases.count(name) == 0) {
+      phaseNames.push_back(name);
+    }
+    phases[name][thread] += values;
+#else
+    static_cast<void>(name);
+    static_cast<void>(values);
+#endif
+  }
+
+  // 計測区間の全てのスレッドの合計を返す
+  PerfCounterValues total(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    PerfCounterValues ret;
+    const auto it = phases.find(name);
+    if (it != phases.end()) {
+      for (const auto& [thread, values] : it->second) {
+        ret += values;
+      }
+    }
+    return ret;
+  }
+
+  // 計測区間ごとにスレッドごとの値と合計を表示する
+  // NOTE: BVH_USE_PERF_COUNTERSが定義されていない場合は何も表示しない
+  void report(std::ostream& stream) const {
+#ifdef BVH_USE_PERF_EVENT
+    std::lock_guard<std::mutex> lock(mutex);
+    stream << "perf counters" << std::endl;
+    for (const std::string& name : phaseNames) {
+      stream << "  " << name << std::endl;
+      PerfCounterValues sum;
+      const auto& threads = phases.at(name);
+      for (const auto& [thread, values] : threads) {
+        sum += values;
+        if (threads.size() > 1) {
+          printValues(stream, "thread " + std::to_string(thread), values);
+        }
+      }
+      printValues(stream, "total", sum);
+    }
+#else
+    static_cast<void>(stream);
+#endif
+  }
+};
+
+#endif
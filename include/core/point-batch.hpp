@@ -0,0 +1,52 @@
+#ifndef _POINT_BATCH_H
+#define _POINT_BATCH_H
+#include <cstddef>
+
+#include "core/closest-point-info.hpp"
+#include "core/vec3.hpp"
+
+// SoA形式の点の配列
+// NOTE: maxDistanceがnullptrの場合は距離の上限を設けない
+struct PointBatch {
+  size_t size{0};                                       // 点の数
+  const float* position[3]{nullptr, nullptr, nullptr};  // 座標の各軸
+  const float* maxDistance{nullptr};                    // 探索する距離の上限
+
+  // i番目の点を返す
+  Vec3 point(size_t i) const {
+    return Vec3(position[0][i], position[1][i], position[2][i]);
+  }
+};
+
+// SoA形式の最近傍点の配列
+// 各配列はPointBatchと同じ数の要素を持つ. nullptrの配列には書き込まない
+// NOTE: 距離の上限内に三角形が無かった点はprimIDが-1になり,
+// それ以外の配列は変更しない
+struct ClosestPointBatch {
+  float* distance{nullptr};                       // 距離
+  float* signedDistance{nullptr};                 // 符号付き距離
+  float* position[3]{nullptr, nullptr, nullptr};  // 最近傍点の各軸
+  int* primID{nullptr};                           // 面番号
+  int* geomID{nullptr};                           // ジオメトリID
+  float* barycentric[2]{nullptr, nullptr};        // 重心座標
+
+  // i番目の結果をセットする. pはi番目の点
+  void set(size_t i, bool found, const Vec3& p, const ClosestPointInfo& info) {
+    if (primID) primID[i] = found ? info.primID : -1;
+    if (!found) return;
+    if (distance) distance[i] = info.distance;
+    if (signedDistance) signedDistance[i] = info.signedDistance(p);
+    if (position[0]) {
+      position[0][i] = info.position[0];
+      position[1][i] = info.position[1];
+      position[2][i] = info.position[2];
+    }
+    if (geomID) geomID[i] = info.geomID;
+    if (barycentric[0]) {
+      barycentric[0][i] = info.barycentric[0];
+      barycentric[1][i] = info.barycentric[1];
+    }
+  }
+};
+
+#endif
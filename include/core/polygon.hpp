@@ -1,27 +1,39 @@
 #ifndef _POLYGON_H
 #define _POLYGON_H
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstddef>
 #include <iostream>
 
 #include "core/vec3.hpp"
 
 struct Polygon {
-  unsigned int nVertices;  // 頂点数
-  float* vertices;         // 頂点座標の配列
-  unsigned int* indices;   // verticesへのインデックス配列
-  float* normals;          // 頂点ごとの法線の配列
-  float* uvs;              // 頂点ごとのUV座標の配列
-  int* geomIDs;
+  unsigned int nVertices;       // 頂点数
+  float* vertices;              // 頂点座標の配列
+  unsigned int* indices;        // verticesへのインデックス配列
+  float* normals;               // 法線の配列
+  float* uvs;                   // UV座標の配列
+  int* geomIDs;                 // 面ごとのジオメトリID(マテリアルID)の配列
+  unsigned int* normalIndices;  // normalsへのインデックス配列
+  unsigned int* uvIndices;      // uvsへのインデックス配列
+  unsigned int nKeyframes{1};   // 頂点座標のキーフレーム数
+  size_t keyframeStride{0};     // キーフレーム間のverticesの要素数
 
+  // NOTE: normalIndices, uvIndicesがnullptrの場合はindicesで法線,
+  // UV座標を参照する(頂点ごとの法線, UV座標)
   Polygon(unsigned int nVertices, float* vertices, unsigned int* indices,
           float* normals = nullptr, float* uvs = nullptr,
-          int* geomIDs = nullptr)
+          int* geomIDs = nullptr, unsigned int* normalIndices = nullptr,
+          unsigned int* uvIndices = nullptr)
       : nVertices(nVertices),
         vertices(vertices),
         indices(indices),
         normals(normals),
         uvs(uvs),
-        geomIDs(geomIDs) {}
+        geomIDs(geomIDs),
+        normalIndices(normalIndices),
+        uvIndices(uvIndices) {}
 
   // 指定した頂点座標の位置の頂点座標をVec3で取得する
   Vec3 getVertex(unsigned int vertexIdx) const {
@@ -30,6 +42,48 @@ struct Polygon {
                 vertices[3 * vertexIdx + 2]);
   }
 
+  // 頂点座標のキーフレームを設定する
+  // verticesにnKeyframes個のキーフレームの頂点座標がstride要素ずつ並んでいる.
+  // キーフレームは時刻0から1まで等間隔に置かれ, その間は線形補間する
+  void setKeyframes(unsigned int nKeyframes, size_t stride) {
+    assert(nKeyframes > 0);
+    this->nKeyframes = nKeyframes;
+    keyframeStride = stride;
+  }
+
+  // 指定したキーフレームの, 指定した頂点座標の位置の頂点座標を取得する
+  Vec3 getKeyframeVertex(unsigned int keyframe, unsigned int vertexIdx) const {
+    assert(keyframe < nKeyframes);
+    const float* v = vertices + keyframeStride * keyframe + 3 * vertexIdx;
+    return Vec3(v[0], v[1], v[2]);
+  }
+
+  // 時刻timeを含むキーフレームの区間の番号を返し,
+  // 区間内での位置(0~1)をweightにセットする
+  unsigned int getKeyframeSegment(float time, float& weight) const {
+    if (nKeyframes <= 1) {
+      weight = 0.0f;
+      return 0;
+    }
+    const float t = std::clamp(time, 0.0f, 1.0f) * (nKeyframes - 1);
+    const unsigned int segment =
+        std::min(static_cast<unsigned int>(t), nKeyframes - 2);
+    weight = t - segment;
+    return segment;
+  }
+
+  // 時刻timeでの, 指定した頂点座標の位置の頂点座標を取得する
+  Vec3 getVertexAtTime(unsigned int vertexIdx, float time) const {
+    if (nKeyframes <= 1) return getVertex(vertexIdx);
+    float weight;
+    const unsigned int segment = getKeyframeSegment(time, weight);
+    return (1.0f - weight) * getKeyframeVertex(segment, vertexIdx) +
+           weight * getKeyframeVertex(segment + 1, vertexIdx);
+  }
+
+  // 頂点座標が時刻によって変わるか
+  bool hasMotion() const { return nKeyframes > 1; }
+
   // 指定した面の頂点座標配列へのインデックスを取得する
   std::array<unsigned int, 3> getIndices(unsigned int faceIdx) const {
     assert(faceIdx <= nFaces());
@@ -37,26 +91,44 @@ struct Polygon {
             indices[3 * faceIdx + 2]};
   }
 
-  // 指定した頂点座標の位置の法線をVec3で取得する
-  Vec3 getNormal(unsigned int vertexIdx) const {
-    assert(vertexIdx <= nVertices);
-    return Vec3(normals[3 * vertexIdx], normals[3 * vertexIdx + 1],
-                normals[3 * vertexIdx + 2]);
+  // 指定した面の法線配列へのインデックスを取得する
+  std::array<unsigned int, 3> getNormalIndices(unsigned int faceIdx) const {
+    assert(faceIdx <= nFaces());
+    const unsigned int* idx = normalIndices ? normalIndices : indices;
+    return {idx[3 * faceIdx + 0], idx[3 * faceIdx + 1], idx[3 * faceIdx + 2]};
   }
 
-  // 指定した頂点座標の位置のUV座標を取得する
-  std::pair<float, float> getUV(unsigned int vertexIdx) const {
-    assert(vertexIdx <= nVertices);
-    return {uvs[2 * vertexIdx], uvs[2 * vertexIdx + 1]};
+  // 指定した面のUV座標配列へのインデックスを取得する
+  std::array<unsigned int, 3> getUVIndices(unsigned int faceIdx) const {
+    assert(faceIdx <= nFaces());
+    const unsigned int* idx = uvIndices ? uvIndices : indices;
+    return {idx[3 * faceIdx + 0], idx[3 * faceIdx + 1], idx[3 * faceIdx + 2]};
+  }
+
+  // 指定した位置の法線をVec3で取得する
+  Vec3 getNormal(unsigned int normalIdx) const {
+    return Vec3(normals[3 * normalIdx], normals[3 * normalIdx + 1],
+                normals[3 * normalIdx + 2]);
+  }
+
+  // 指定した位置のUV座標を取得する
+  std::pair<float, float> getUV(unsigned int uvIdx) const {
+    return {uvs[2 * uvIdx], uvs[2 * uvIdx + 1]};
+  }
+
+  // 指定した面のジオメトリIDを取得する. 存在しない場合は0を返す
+  int getGeomID(unsigned int faceIdx) const {
+    assert(faceIdx <= nFaces());
+    return geomIDs ? geomIDs[faceIdx] : 0;
   }
 
-  // 頂点ごとの法線が存在するか
+  // 法線が存在するか
   bool hasNormals() const { return normals != nullptr; }
-  // 頂点ごとのUVが存在するか
+  // UVが存在するか
   bool hasUVs() const { return uvs != nullptr; }
 
   // 面の数を返す
   unsigned int nFaces() const { return nVertices / 3; };
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,48 @@
+#ifndef _PRECOMPUTED_RAY_H
+#define _PRECOMPUTED_RAY_H
+#include <cmath>
+#include <cstdint>
+
+#include "core/ray.hpp"
+#include "core/simd.hpp"
+#include "core/vec3.hpp"
+
+// traverse中に何度も使うレイの情報を事前計算しておく構造体
+// NOTE: 方向が0の軸ではdirInvが±infになる.
+// AABBとの交差判定はこれを前提にNaNを扱う
+struct PrecomputedRay {
+  Vec3 origin;        // レイの始点
+  Vec3 dirInv;        // レイの方向の逆数
+  int dirInvSign[3];  // dirInvの符号(正なら0, 負なら1)
+  int octant;         // レイの方向の象限(iビット目がdirInvSign[i])
+
+  // AABB::boundsの先頭から, 各軸の近い面と遠い面の座標へのByteオフセット
+  uint32_t nearOffset[3];
+  uint32_t farOffset[3];
+
+#ifdef BVH_SIMD_SSE
+  Float4 origin4;  // originの3軸分
+  Float4 dirInv4;  // dirInvの3軸分
+  Bool4 negative;  // dirInvが負の軸
+#endif
+
+  explicit PrecomputedRay(const Ray& ray)
+      : origin(ray.origin),
+        dirInv(1.0f / ray.direction)
+#ifdef BVH_SIMD_SSE
+        ,
+        origin4(Float4::load(origin)),
+        dirInv4(Float4::load(dirInv)),
+        negative(dirInv4 < Float4(0.0f))
+#endif
+  {
+    for (int i = 0; i < 3; ++i) {
+      dirInvSign[i] = dirInv[i] > 0 ? 0 : 1;
+      nearOffset[i] = sizeof(Vec3) * dirInvSign[i] + sizeof(float) * i;
+      farOffset[i] = sizeof(Vec3) * (1 - dirInvSign[i]) + sizeof(float) * i;
+    }
+    octant = dirInvSign[0] | (dirInvSign[1] << 1) | (dirInvSign[2] << 2);
+  }
+};
+
+#endif
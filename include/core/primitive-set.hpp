@@ -0,0 +1,224 @@
+#ifndef _PRIMITIVE_SET_H
+#define _PRIMITIVE_SET_H
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <utility>
+
+#include "core/aabb.hpp"
+#include "core/intersect-info.hpp"
+#include "core/polygon.hpp"
+#include "core/ray.hpp"
+#include "core/sphere.hpp"
+#include "core/triangle.hpp"
+
+// GenericBVHに渡すPrimitiveの集合
+// Primitiveは0からsize() - 1までの番号で指定し, 以下を持つ
+//   uint32_t size() const
+//     Primitiveの数を返す
+//   AABB calcAABB(uint32_t prim) const
+//     PrimitiveのAABBを返す
+//   bool intersect(uint32_t prim, const Ray& ray, IntersectInfo& info) const
+//     交差判定を行い, 交差した場合はt, barycentric, primIDをinfoにセットする
+//   void calcSurfaceInfo(const Ray& ray, IntersectInfo& info) const
+//     info.primIDの交差点の情報(位置, 法線, UV, ジオメトリID)を計算する
+// NOTE: 集合は参照するデータを所有しないので, BVHより長く生存させる
+
+// Polygonの三角形の集合
+struct TrianglePrimitives {
+  const Polygon* polygon;  // 三角形を含むPolygon
+
+  // NOTE: キーフレームがあるPolygonはMotionBVHを使う
+  explicit TrianglePrimitives(const Polygon& polygon) : polygon(&polygon) {
+    assert(!polygon.hasMotion());
+  }
+
+  uint32_t size() const { return polygon->nFaces(); }
+
+  AABB calcAABB(uint32_t prim) const {
+    return Triangle(polygon, prim).calcAABB();
+  }
+
+  bool intersect(uint32_t prim, const Ray& ray, IntersectInfo& info) const {
+    return Triangle(polygon, prim).intersect(ray, info);
+  }
+
+  void calcSurfaceInfo(const Ray& ray, IntersectInfo& info) const {
+    Triangle(polygon, info.primID).calcSurfaceInfo(ray, info);
+  }
+};
+
+// 球の集合(パーティクルなど)
+struct SpherePrimitives {
+  uint32_t nSpheres;     // 球の数
+  const float* centers;  // 中心の配列(xyzの順)
+  const float* radii;    // 半径の配列
+  const int* geomIDs;    // 球ごとのジオメトリIDの配列
+
+  // NOTE: geomIDsがnullptrの場合はジオメトリIDを0とする
+  SpherePrimitives(uint32_t nSpheres, const float* centers,
+                   const float* radii, const int* geomIDs = nullptr)
+      : nSpheres(nSpheres),
+        centers(centers),
+        radii(radii),
+        geomIDs(geomIDs) {}
+
+  // 指定した球を返す
+  Sphere getSphere(uint32_t prim) const {
+    return Sphere(Vec3(centers[3 * prim], centers[3 * prim + 1],
+                       centers[3 * prim + 2]),
+                  radii[prim]);
+  }
+
+  uint32_t size() const { return nSpheres; }
+
+  AABB calcAABB(uint32_t prim) const { return getSphere(prim).calcAABB(); }
+
+  bool intersect(uint32_t prim, const Ray& ray, IntersectInfo& info) const {
+    float t;
+    if (!getSphere(prim).intersect(ray, t)) return false;
+
+    info.t = t;
+    info.barycentric[0] = 0.0f;
+    info.barycentric[1] = 0.0f;
+    info.primID = prim;
+    return true;
+  }
+
+  // NOTE: UVは球面座標(経度, 緯度)を[0, 1]にしたもの
+  void calcSurfaceInfo(const Ray& ray, IntersectInfo& info) const {
+    const Sphere sphere = getSphere(info.primID);
+    info.hitPos = ray(info.t);
+    info.hitNormal = normalize(info.hitPos - sphere.center);
+    info.geomNormal = info.hitNormal;
+    info.geomID = geomIDs ? geomIDs[info.primID] : 0;
+
+    constexpr float PI = 3.14159265358979323846f;
+    const Vec3& n = info.hitNormal;
+    info.uv[0] = 0.5f + std::atan2(n[2], n[0]) / (2.0f * PI);
+    info.uv[1] = std::acos(std::clamp(n[1], -1.0f, 1.0f)) / PI;
+  }
+};
+
+// ユーザーが関数で定義するPrimitiveの集合
+// 関数の引数と返り値はPrimitiveの集合の説明と同じ
+// NOTE: 関数呼び出しのオーバーヘッドがあるので, 多数のPrimitiveには
+// 専用の集合を定義する方が速い
+struct UserPrimitives {
+  uint32_t nPrimitives;  // Primitiveの数
+  std::function<AABB(uint32_t)> calcAABBFunc;
+  std::function<bool(uint32_t, const Ray&, IntersectInfo&)> intersectFunc;
+  std::function<void(const Ray&, IntersectInfo&)> calcSurfaceInfoFunc;
+
+  UserPrimitives(
+      uint32_t nPrimitives, std::function<AABB(uint32_t)> calcAABBFunc,
+      std::function<bool(uint32_t, const Ray&, IntersectInfo&)> intersectFunc,
+      std::function<void(const Ray&, IntersectInfo&)> calcSurfaceInfoFunc)
+      : nPrimitives(nPrimitives),
+        calcAABBFunc(std::move(calcAABBFunc)),
+        intersectFunc(std::move(intersectFunc)),
+        calcSurfaceInfoFunc(std::move(calcSurfaceInfoFunc)) {}
+
+  uint32_t size() const { return nPrimitives; }
+
+  AABB calcAABB(uint32_t prim) const { return calcAABBFunc(prim); }
+
+  bool intersect(uint32_t prim, const Ray& ray, IntersectInfo& info) const {
+    return intersectFunc(prim, ray, info);
+  }
+
+  void calcSurfaceInfo(const Ray& ray, IntersectInfo& info) const {
+    calcSurfaceInfoFunc(ray, info);
+  }
+};
+
+// 種類の違うPrimitiveの集合をまとめた集合
+// 1つのBVHで三角形, 球などを混ぜたシーンをtraverseできる
+// Primitiveの番号は集合を順に並べたもの(2つ目の集合の最初のPrimitiveは
+// 1つ目の集合のsize()番)になる. setIndex, localPrimIDで元の集合と番号を返す
+template <typename... Sets>
+class CompositePrimitives {
+ private:
+  static constexpr size_t N_SETS = sizeof...(Sets);
+
+  std::tuple<Sets...> sets;                  // Primitiveの集合
+  std::array<uint32_t, N_SETS + 1> offsets;  // 各集合の最初の番号
+
+  // primを含む集合でf(set, localPrimID)を呼ぶ
+  // NOTE: 集合の数は少ないので先頭から順に調べる
+  template <typename F, size_t... Is>
+  void dispatch(uint32_t prim, const F& f, std::index_sequence<Is...>) const {
+    static_cast<void>(
+        ((prim < offsets[Is + 1]
+              ? (f(std::get<Is>(sets), prim - offsets[Is]), true)
+              : false) ||
+         ...));
+  }
+
+  template <typename F>
+  void dispatch(uint32_t prim, const F& f) const {
+    dispatch(prim, f, std::index_sequence_for<Sets...>{});
+  }
+
+ public:
+  explicit CompositePrimitives(const Sets&... primitiveSets)
+      : sets(primitiveSets...) {
+    offsets[0] = 0;
+    size_t i = 0;
+    static_cast<void>(
+        ((offsets[i + 1] = offsets[i] + primitiveSets.size(), ++i), ...));
+  }
+
+  // 指定した番号の集合を返す
+  template <size_t I>
+  const auto& getSet() const {
+    return std::get<I>(sets);
+  }
+
+  // Primitiveを含む集合の番号を返す
+  int setIndex(uint32_t prim) const {
+    int ret = 0;
+    while (prim >= offsets[ret + 1]) ret++;
+    return ret;
+  }
+
+  // Primitiveの元の集合での番号を返す
+  uint32_t localPrimID(uint32_t prim) const {
+    return prim - offsets[setIndex(prim)];
+  }
+
+  uint32_t size() const { return offsets[N_SETS]; }
+
+  AABB calcAABB(uint32_t prim) const {
+    AABB ret;
+    dispatch(prim, [&](const auto& set, uint32_t localPrim) {
+      ret = set.calcAABB(localPrim);
+    });
+    return ret;
+  }
+
+  bool intersect(uint32_t prim, const Ray& ray, IntersectInfo& info) const {
+    bool hit = false;
+    dispatch(prim, [&](const auto& set, uint32_t localPrim) {
+      hit = set.intersect(localPrim, ray, info);
+    });
+    // 番号をまとめた集合での番号に戻す
+    if (hit) info.primID = prim;
+    return hit;
+  }
+
+  void calcSurfaceInfo(const Ray& ray, IntersectInfo& info) const {
+    const uint32_t prim = info.primID;
+    dispatch(prim, [&](const auto& set, uint32_t localPrim) {
+      info.primID = localPrim;
+      set.calcSurfaceInfo(ray, info);
+    });
+    info.primID = prim;
+  }
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _PROXIMITY_INFO_H
+#define _PROXIMITY_INFO_H
+#include "core/vec3.hpp"
+
+// 2つのメッシュの最も近い三角形の組
+// NOTE: position, otherPositionはどちらも基準にしたBVHの座標系
+struct ProximityInfo {
+  float distance;
+  Vec3 position;
+  Vec3 otherPosition;
+  int primID;
+  int otherPrimID;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _RAY_BATCH_H
+#define _RAY_BATCH_H
+#include <cstddef>
+
+#include "core/intersect-info.hpp"
+#include "core/ray.hpp"
+
+// SoA形式のレイの配列
+// NOTE: tmin, tmaxがnullptrの場合はRayの既定値を使う
+struct RayBatch {
+  size_t size{0};                                        // レイの数
+  const float* origin[3]{nullptr, nullptr, nullptr};     // 始点の各軸
+  const float* direction[3]{nullptr, nullptr, nullptr};  // 方向の各軸
+  const float* tmin{nullptr};                            // レイの始点側の範囲
+  const float* tmax{nullptr};                            // レイの終点側の範囲
+
+  // i番目のレイを返す
+  Ray ray(size_t i) const {
+    Ray ret(Vec3(origin[0][i], origin[1][i], origin[2][i]),
+            Vec3(direction[0][i], direction[1][i], direction[2][i]));
+    if (tmin) ret.tmin = tmin[i];
+    if (tmax) ret.tmax = tmax[i];
+    return ret;
+  }
+};
+
+// SoA形式の交差結果の配列
+// 各配列はRayBatchと同じ数の要素を持つ. nullptrの配列には書き込まない
+// NOTE: 交差しなかったレイはprimIDが-1になり, それ以外の配列は変更しない.
+// hitNormal, uvを求める場合のみ交差点の情報を計算するので,
+// 不要な場合はnullptrにしておくと速い
+struct HitBatch {
+  float* t{nullptr};                               // 交差点までの距離
+  int* primID{nullptr};                            // 面番号
+  int* geomID{nullptr};                            // ジオメトリID
+  float* barycentric[2]{nullptr, nullptr};         // 重心座標
+  float* hitNormal[3]{nullptr, nullptr, nullptr};  // 法線の各軸
+  float* uv[2]{nullptr, nullptr};                  // UV座標
+
+  // 交差点の情報を計算する必要があるか
+  bool needsSurfaceInfo() const { return hitNormal[0] || uv[0]; }
+
+  // i番目の結果をセットする
+  void set(size_t i, bool hit, const IntersectInfo& info) {
+    if (primID) primID[i] = hit ? info.primID : -1;
+    if (!hit) return;
+    if (t) t[i] = info.t;
+    if (geomID) geomID[i] = info.geomID;
+    if (barycentric[0]) {
+      barycentric[0][i] = info.barycentric[0];
+      barycentric[1][i] = info.barycentric[1];
+    }
+    if (hitNormal[0]) {
+      hitNormal[0][i] = info.hitNormal[0];
+      hitNormal[1][i] = info.hitNormal[1];
+      hitNormal[2][i] = info.hitNormal[2];
+    }
+    if (uv[0]) {
+      uv[0][i] = info.uv[0];
+      uv[1][i] = info.uv[1];
+    }
+  }
+};
+
+#endif
@@ -1,5 +1,8 @@
 #ifndef _RAY_H
 #define _RAY_H
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 
 #include "core/vec3.hpp"
@@ -7,8 +10,9 @@
 struct Ray {
   Vec3 origin;
   Vec3 direction;
-  mutable float tmin{1e-3f};
+  mutable float tmin{0.0f};
   mutable float tmax{std::numeric_limits<float>::max()};
+  float time{0.0f};  // 時刻(0~1). 頂点座標にキーフレームがある場合に使う
 
   explicit Ray(const Vec3& origin, const Vec3& direction)
       : origin(origin), direction(direction) {}
@@ -16,4 +20,34 @@ struct Ray {
   Vec3 operator()(float t) const { return origin + t * direction; }
 };
 
+// 面上の点pから出るレイが同じ面と交差しないように, 始点を法線nの方向に
+// 浮動小数点数の誤差の分だけずらした点を返す
+// nはレイが出ていく側を向いた(幾何)法線
+// NOTE: pの大きさに応じてulp単位でずらすので, 固定のtminを使うよりも
+// 座標が大きいシーンで自己交差が起きにくく, 原点付近で近くの面を見逃しにくい
+// Ray Tracing Gems Chapter 6
+inline Vec3 offsetRayOrigin(const Vec3& p, const Vec3& n) {
+  constexpr float ORIGIN = 1.0f / 32.0f;
+  constexpr float FLOAT_SCALE = 1.0f / 65536.0f;
+  constexpr float INT_SCALE = 256.0f;
+
+  Vec3 ret;
+  for (int i = 0; i < 3; ++i) {
+    // 原点付近ではulpが小さすぎるので固定の距離だけずらす
+    if (std::abs(p[i]) < ORIGIN) {
+      ret[i] = p[i] + FLOAT_SCALE * n[i];
+      continue;
+    }
+
+    // 浮動小数点数のビット列を整数としてずらす
+    const int32_t offset = static_cast<int32_t>(INT_SCALE * n[i]);
+    const float pi = p[i];
+    int32_t bits;
+    std::memcpy(&bits, &pi, sizeof(float));
+    bits += pi < 0.0f ? -offset : offset;
+    std::memcpy(&ret[i], &bits, sizeof(float));
+  }
+  return ret;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef _REAL_H
+#define _REAL_H
+
+// 三角形の頂点の計算(交差判定, 交差点の位置)に使う浮動小数点型
+// BVH_USE_DOUBLE_PRECISION: 倍精度で計算する
+// NOTE: ノードのAABBとの交差判定, Triangle4は単精度のまま.
+// 座標が大きいシーンでは交差点の誤差が小さくなるが, 交差判定は遅くなる
+#ifdef BVH_USE_DOUBLE_PRECISION
+using Real = double;
+#else
+using Real = float;
+#endif
+
+#endif
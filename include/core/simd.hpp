@@ -0,0 +1,331 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+#include <algorithm>
+#include <cmath>
+
+#include "core/vec3.hpp"
+
+// 使用するSIMD命令セットをコンパイル時に選択する
+// BVH_DISABLE_SIMDが定義されている場合はスカラー実装を使う
+#if !defined(BVH_DISABLE_SIMD) &&             \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BVH_SIMD_SSE
+#include <immintrin.h>
+#endif
+
+#if defined(BVH_SIMD_SSE) && defined(__AVX__)
+#define BVH_SIMD_AVX
+#endif
+
+// 4要素のfloatベクトル
+// NOTE: Vec3を読み込んだ場合, 4番目の要素は0になる
+struct Float4 {
+#ifdef BVH_SIMD_SSE
+  __m128 v;
+
+  Float4() {}
+  Float4(__m128 v) : v(v) {}
+  explicit Float4(float k) : v(_mm_set1_ps(k)) {}
+  explicit Float4(float x, float y, float z, float w)
+      : v(_mm_setr_ps(x, y, z, w)) {}
+
+  // 4要素を読み込む
+  static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+
+  // 3要素を読み込む
+  // NOTE: 16Byte読み込むと配列の範囲外を読んでしまうので, 8Byteと4Byteに分ける
+  // NOTE: _mm_load_sdはdouble*として読むのでstrict aliasingに違反する.
+  // __m64はmay_aliasなので_mm_loadl_piを使う
+  static Float4 load3(const float* p) {
+    const __m128 xy =
+        _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(p));
+    const __m128 z = _mm_load_ss(p + 2);
+    return _mm_movelh_ps(xy, z);
+  }
+
+  // 4要素を書き込む
+  void store(float* p) const { _mm_storeu_ps(p, v); }
+
+  // 先頭3要素を書き込む
+  void store3(float* p) const {
+    _mm_storel_pi(reinterpret_cast<__m64*>(p), v);
+    _mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+  }
+
+  float operator[](int i) const {
+    alignas(16) float ret[4];
+    _mm_store_ps(ret, v);
+    return ret[i];
+  }
+#else
+  float v[4];
+
+  Float4() {}
+  explicit Float4(float k) : v{k, k, k, k} {}
+  explicit Float4(float x, float y, float z, float w) : v{x, y, z, w} {}
+
+  static Float4 load(const float* p) { return Float4(p[0], p[1], p[2], p[3]); }
+  static Float4 load3(const float* p) { return Float4(p[0], p[1], p[2], 0); }
+
+  void store(float* p) const {
+    for (int i = 0; i < 4; ++i) {
+      p[i] = v[i];
+    }
+  }
+  void store3(float* p) const {
+    p[0] = v[0];
+    p[1] = v[1];
+    p[2] = v[2];
+  }
+
+  float operator[](int i) const { return v[i]; }
+#endif
+
+  // Vec3を読み込む
+  static Float4 load(const Vec3& p) { return load3(p.data()); }
+
+  // 先頭3要素をVec3に書き込む
+  void store(Vec3& p) const { store3(p.data()); }
+};
+
+// 4要素の比較結果
+struct Bool4 {
+#ifdef BVH_SIMD_SSE
+  __m128 v;
+
+  Bool4(__m128 v) : v(v) {}
+
+  // 各要素の結果をビットにまとめる
+  int mask() const { return _mm_movemask_ps(v); }
+#else
+  bool v[4];
+
+  explicit Bool4(bool x, bool y, bool z, bool w) : v{x, y, z, w} {}
+
+  int mask() const { return v[0] | (v[1] << 1) | (v[2] << 2) | (v[3] << 3); }
+#endif
+};
+
+#ifdef BVH_SIMD_SSE
+inline Float4 operator+(const Float4& a, const Float4& b) {
+  return _mm_add_ps(a.v, b.v);
+}
+inline Float4 operator-(const Float4& a, const Float4& b) {
+  return _mm_sub_ps(a.v, b.v);
+}
+inline Float4 operator*(const Float4& a, const Float4& b) {
+  return _mm_mul_ps(a.v, b.v);
+}
+inline Float4 operator/(const Float4& a, const Float4& b) {
+  return _mm_div_ps(a.v, b.v);
+}
+inline Float4 operator-(const Float4& a) {
+  return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f));
+}
+inline Float4 abs(const Float4& a) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+}
+inline Float4 sqrt(const Float4& a) { return _mm_sqrt_ps(a.v); }
+
+// NOTE: どちらかがNaNの場合は2番目の引数を返す
+inline Float4 min(const Float4& a, const Float4& b) {
+  return _mm_min_ps(a.v, b.v);
+}
+inline Float4 max(const Float4& a, const Float4& b) {
+  return _mm_max_ps(a.v, b.v);
+}
+
+inline Bool4 operator<(const Float4& a, const Float4& b) {
+  return _mm_cmplt_ps(a.v, b.v);
+}
+inline Bool4 operator>(const Float4& a, const Float4& b) {
+  return _mm_cmpgt_ps(a.v, b.v);
+}
+inline Bool4 operator<=(const Float4& a, const Float4& b) {
+  return _mm_cmple_ps(a.v, b.v);
+}
+inline Bool4 operator>=(const Float4& a, const Float4& b) {
+  return _mm_cmpge_ps(a.v, b.v);
+}
+inline Bool4 operator==(const Float4& a, const Float4& b) {
+  return _mm_cmpeq_ps(a.v, b.v);
+}
+inline Bool4 operator!=(const Float4& a, const Float4& b) {
+  return _mm_cmpneq_ps(a.v, b.v);
+}
+inline Bool4 operator&(const Bool4& a, const Bool4& b) {
+  return _mm_and_ps(a.v, b.v);
+}
+inline Bool4 operator|(const Bool4& a, const Bool4& b) {
+  return _mm_or_ps(a.v, b.v);
+}
+// aが立っていない, かつbが立っている要素
+inline Bool4 andNot(const Bool4& a, const Bool4& b) {
+  return _mm_andnot_ps(a.v, b.v);
+}
+
+// maskが立っている要素はa, そうでない要素はbを返す
+inline Float4 select(const Bool4& mask, const Float4& a, const Float4& b) {
+#ifdef __SSE4_1__
+  return _mm_blendv_ps(b.v, a.v, mask.v);
+#else
+  return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+#endif
+}
+
+// maskのiビット目が立っている要素はb, そうでない要素はaを返す
+template <int mask>
+inline Float4 blend(const Float4& a, const Float4& b) {
+#ifdef __SSE4_1__
+  return _mm_blend_ps(a.v, b.v, mask);
+#else
+  const __m128 m = _mm_castsi128_ps(_mm_setr_epi32(
+      (mask & 1) ? -1 : 0, (mask & 2) ? -1 : 0, (mask & 4) ? -1 : 0,
+      (mask & 8) ? -1 : 0));
+  return _mm_or_ps(_mm_and_ps(m, b.v), _mm_andnot_ps(m, a.v));
+#endif
+}
+
+// 要素の並び替え
+template <int i0, int i1, int i2, int i3>
+inline Float4 shuffle(const Float4& a) {
+  return _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(i3, i2, i1, i0));
+}
+
+// 先頭3要素の最小値, 最大値, 和
+inline float reduceMin3(const Float4& a) {
+  const __m128 m = _mm_min_ss(a.v, _mm_shuffle_ps(a.v, a.v, 1));
+  return _mm_cvtss_f32(_mm_min_ss(m, _mm_movehl_ps(a.v, a.v)));
+}
+inline float reduceMax3(const Float4& a) {
+  const __m128 m = _mm_max_ss(a.v, _mm_shuffle_ps(a.v, a.v, 1));
+  return _mm_cvtss_f32(_mm_max_ss(m, _mm_movehl_ps(a.v, a.v)));
+}
+inline float reduceAdd3(const Float4& a) {
+  const __m128 s = _mm_add_ss(a.v, _mm_shuffle_ps(a.v, a.v, 1));
+  return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(a.v, a.v)));
+}
+#else
+namespace simd_detail {
+template <typename F>
+inline Float4 map(const Float4& a, const Float4& b, F f) {
+  return Float4(f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]),
+                f(a.v[3], b.v[3]));
+}
+template <typename F>
+inline Bool4 compare(const Float4& a, const Float4& b, F f) {
+  return Bool4(f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]),
+               f(a.v[3], b.v[3]));
+}
+}  // namespace simd_detail
+
+inline Float4 operator+(const Float4& a, const Float4& b) {
+  return simd_detail::map(a, b, [](float x, float y) { return x + y; });
+}
+inline Float4 operator-(const Float4& a, const Float4& b) {
+  return simd_detail::map(a, b, [](float x, float y) { return x - y; });
+}
+inline Float4 operator*(const Float4& a, const Float4& b) {
+  return simd_detail::map(a, b, [](float x, float y) { return x * y; });
+}
+inline Float4 operator/(const Float4& a, const Float4& b) {
+  return simd_detail::map(a, b, [](float x, float y) { return x / y; });
+}
+inline Float4 operator-(const Float4& a) {
+  return Float4(-a.v[0], -a.v[1], -a.v[2], -a.v[3]);
+}
+inline Float4 abs(const Float4& a) {
+  return Float4(std::abs(a.v[0]), std::abs(a.v[1]), std::abs(a.v[2]),
+                std::abs(a.v[3]));
+}
+inline Float4 sqrt(const Float4& a) {
+  return Float4(std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]),
+                std::sqrt(a.v[3]));
+}
+
+// NOTE: SSEと同じく, どちらかがNaNの場合は2番目の引数を返す
+inline Float4 min(const Float4& a, const Float4& b) {
+  return simd_detail::map(a, b, [](float x, float y) { return x < y ? x : y; });
+}
+inline Float4 max(const Float4& a, const Float4& b) {
+  return simd_detail::map(a, b, [](float x, float y) { return x > y ? x : y; });
+}
+
+inline Bool4 operator<(const Float4& a, const Float4& b) {
+  return simd_detail::compare(a, b, [](float x, float y) { return x < y; });
+}
+inline Bool4 operator>(const Float4& a, const Float4& b) {
+  return simd_detail::compare(a, b, [](float x, float y) { return x > y; });
+}
+inline Bool4 operator<=(const Float4& a, const Float4& b) {
+  return simd_detail::compare(a, b, [](float x, float y) { return x <= y; });
+}
+inline Bool4 operator>=(const Float4& a, const Float4& b) {
+  return simd_detail::compare(a, b, [](float x, float y) { return x >= y; });
+}
+inline Bool4 operator==(const Float4& a, const Float4& b) {
+  return simd_detail::compare(a, b, [](float x, float y) { return x == y; });
+}
+inline Bool4 operator!=(const Float4& a, const Float4& b) {
+  return simd_detail::compare(a, b, [](float x, float y) { return x != y; });
+}
+inline Bool4 operator&(const Bool4& a, const Bool4& b) {
+  return Bool4(a.v[0] && b.v[0], a.v[1] && b.v[1], a.v[2] && b.v[2],
+               a.v[3] && b.v[3]);
+}
+inline Bool4 operator|(const Bool4& a, const Bool4& b) {
+  return Bool4(a.v[0] || b.v[0], a.v[1] || b.v[1], a.v[2] || b.v[2],
+               a.v[3] || b.v[3]);
+}
+inline Bool4 andNot(const Bool4& a, const Bool4& b) {
+  return Bool4(!a.v[0] && b.v[0], !a.v[1] && b.v[1], !a.v[2] && b.v[2],
+               !a.v[3] && b.v[3]);
+}
+
+inline Float4 select(const Bool4& mask, const Float4& a, const Float4& b) {
+  return Float4(mask.v[0] ? a.v[0] : b.v[0], mask.v[1] ? a.v[1] : b.v[1],
+                mask.v[2] ? a.v[2] : b.v[2], mask.v[3] ? a.v[3] : b.v[3]);
+}
+
+template <int mask>
+inline Float4 blend(const Float4& a, const Float4& b) {
+  return Float4((mask & 1) ? b.v[0] : a.v[0], (mask & 2) ? b.v[1] : a.v[1],
+                (mask & 4) ? b.v[2] : a.v[2], (mask & 8) ? b.v[3] : a.v[3]);
+}
+
+template <int i0, int i1, int i2, int i3>
+inline Float4 shuffle(const Float4& a) {
+  return Float4(a.v[i0], a.v[i1], a.v[i2], a.v[i3]);
+}
+
+inline float reduceMin3(const Float4& a) {
+  return std::min(std::min(a.v[0], a.v[1]), a.v[2]);
+}
+inline float reduceMax3(const Float4& a) {
+  return std::max(std::max(a.v[0], a.v[1]), a.v[2]);
+}
+inline float reduceAdd3(const Float4& a) { return a.v[0] + a.v[1] + a.v[2]; }
+#endif
+
+// pを含むキャッシュラインを先読みする
+inline void prefetch(const void* p) {
+#ifdef BVH_SIMD_SSE
+  _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+  static_cast<void>(p);
+#endif
+}
+
+// 先頭3要素の内積
+inline float dot3(const Float4& a, const Float4& b) {
+  return reduceAdd3(a * b);
+}
+
+// 先頭3要素の外積
+inline Float4 cross3(const Float4& a, const Float4& b) {
+  const Float4 ret = a * shuffle<1, 2, 0, 3>(b) - shuffle<1, 2, 0, 3>(a) * b;
+  return shuffle<1, 2, 0, 3>(ret);
+}
+
+#endif
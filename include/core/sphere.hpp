@@ -0,0 +1,66 @@
+#ifndef _SPHERE_H
+#define _SPHERE_H
+#include <cmath>
+#include <utility>
+
+#include "core/aabb.hpp"
+#include "core/ray.hpp"
+#include "core/triangle.hpp"
+#include "core/vec3.hpp"
+
+// 球(重なり判定のクエリ, SpherePrimitivesのPrimitiveに使う)
+struct Sphere {
+  Vec3 center;   // 中心
+  float radius;  // 半径
+
+  explicit Sphere(const Vec3& center, float radius)
+      : center(center), radius(radius) {}
+
+  // bboxと重なっているか
+  bool overlaps(const AABB& bbox) const {
+    return bbox.distance2(center) <= radius * radius;
+  }
+
+  // 三角形v0v1v2と重なっているか
+  bool overlaps(const Vec3& v0, const Vec3& v1, const Vec3& v2) const {
+    float barycentric[2];
+    const Vec3 p = closestPointOnTriangle(center, v0, v1, v2, barycentric);
+    return length2(p - center) <= radius * radius;
+  }
+
+  // AABBを計算する
+  AABB calcAABB() const {
+    return AABB(center - Vec3(radius), center + Vec3(radius));
+  }
+
+  // レイとの交差判定を行い, [tmin, tmax]の範囲で最も近い交差点のtを返す
+  // NOTE: 桁落ちを避けるために判別式を中心からレイへの距離で計算する
+  // Ray Tracing Gems Chapter 7
+  bool intersect(const Ray& ray, float& t) const {
+    const Vec3 f = ray.origin - center;
+    const float a = dot(ray.direction, ray.direction);
+    const float b = -dot(f, ray.direction);
+    const Vec3 l = f + (b / a) * ray.direction;
+    const float discriminant = a * (radius * radius - dot(l, l));
+    if (discriminant < 0.0f) return false;
+
+    // 2つの解 t0 <= t1
+    const float c = dot(f, f) - radius * radius;
+    const float q = b + std::copysign(std::sqrt(discriminant), b);
+    float t0 = c / q;
+    float t1 = q / a;
+    if (t0 > t1) std::swap(t0, t1);
+
+    if (t0 >= ray.tmin && t0 <= ray.tmax) {
+      t = t0;
+      return true;
+    }
+    if (t1 >= ray.tmin && t1 <= ray.tmax) {
+      t = t1;
+      return true;
+    }
+    return false;
+  }
+};
+
+#endif
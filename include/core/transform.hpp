@@ -0,0 +1,95 @@
+#ifndef _TRANSFORM_H
+#define _TRANSFORM_H
+#include <algorithm>
+#include <cmath>
+
+#include "core/aabb.hpp"
+#include "core/vec3.hpp"
+
+// 剛体変換(回転 + 平行移動)
+// 点pを rotation * p + translation に移す
+struct Transform {
+  Vec3 rotation[3];  // 回転行列の各行
+  Vec3 translation;  // 平行移動
+
+  // 恒等変換
+  explicit Transform()
+      : rotation{Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)},
+        translation(0) {}
+  explicit Transform(const Vec3 rotation[3], const Vec3& translation)
+      : rotation{rotation[0], rotation[1], rotation[2]},
+        translation(translation) {}
+
+  // 単位ベクトルaxis周りにangle(ラジアン)回転してから平行移動する変換
+  explicit Transform(const Vec3& axis, float angle, const Vec3& translation)
+      : translation(translation) {
+    // ロドリゲスの回転公式
+    const float c = std::cos(angle);
+    const float s = std::sin(angle);
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        rotation[i][j] = (1.0f - c) * axis[i] * axis[j];
+      }
+      rotation[i][i] += c;
+    }
+    rotation[0][1] -= s * axis[2];
+    rotation[0][2] += s * axis[1];
+    rotation[1][0] += s * axis[2];
+    rotation[1][2] -= s * axis[0];
+    rotation[2][0] -= s * axis[1];
+    rotation[2][1] += s * axis[0];
+  }
+
+  // 点を変換する
+  Vec3 apply(const Vec3& p) const { return applyVector(p) + translation; }
+
+  // 方向ベクトルを変換する(回転のみ)
+  Vec3 applyVector(const Vec3& v) const {
+    return Vec3(dot(rotation[0], v), dot(rotation[1], v),
+                dot(rotation[2], v));
+  }
+
+  // 逆変換を返す
+  // NOTE: 回転行列の逆行列は転置行列
+  Transform inverse() const {
+    Transform ret;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        ret.rotation[i][j] = rotation[j][i];
+      }
+    }
+    ret.translation = -ret.applyVector(translation);
+    return ret;
+  }
+};
+
+// t2を適用してからt1を適用する変換を返す
+inline Transform operator*(const Transform& t1, const Transform& t2) {
+  Transform ret;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      ret.rotation[i][j] = t1.rotation[i][0] * t2.rotation[0][j] +
+                           t1.rotation[i][1] * t2.rotation[1][j] +
+                           t1.rotation[i][2] * t2.rotation[2][j];
+    }
+  }
+  ret.translation = t1.apply(t2.translation);
+  return ret;
+}
+
+// 変換したbboxを含むAABBを返す
+// Graphics Gems, Transforming Axis-Aligned Bounding Boxes (Arvo)
+inline AABB transformAABB(const Transform& transform, const AABB& bbox) {
+  AABB ret(transform.translation, transform.translation);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      const float a = transform.rotation[i][j] * bbox.bounds[0][j];
+      const float b = transform.rotation[i][j] * bbox.bounds[1][j];
+      ret.bounds[0][i] += std::min(a, b);
+      ret.bounds[1][i] += std::max(a, b);
+    }
+  }
+  return ret;
+}
+
+#endif
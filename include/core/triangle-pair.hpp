@@ -0,0 +1,172 @@
+#ifndef _TRIANGLE_PAIR_H
+#define _TRIANGLE_PAIR_H
+#include <algorithm>
+#include <limits>
+
+#include "core/triangle.hpp"
+#include "core/vec3.hpp"
+
+// 三角形同士の交差判定, 距離計算
+// Real-Time Collision Detection 5.1, 5.2
+
+// 三角形a, bをaxisに射影した区間が離れているか
+inline bool separatedOnAxis(const Vec3 a[3], const Vec3 b[3],
+                            const Vec3& axis) {
+  const float a0 = dot(a[0], axis), a1 = dot(a[1], axis), a2 = dot(a[2], axis);
+  const float b0 = dot(b[0], axis), b1 = dot(b[1], axis), b2 = dot(b[2], axis);
+  return std::max({a0, a1, a2}) < std::min({b0, b1, b2}) ||
+         std::max({b0, b1, b2}) < std::min({a0, a1, a2});
+}
+
+// 三角形a, bが交差しているか(分離軸判定)
+// NOTE: 接している場合も交差しているとみなす
+inline bool trianglesOverlap(const Vec3 a[3], const Vec3 b[3]) {
+  const Vec3 ea[3] = {a[1] - a[0], a[2] - a[1], a[0] - a[2]};
+  const Vec3 eb[3] = {b[1] - b[0], b[2] - b[1], b[0] - b[2]};
+
+  // 面法線(2軸)
+  const Vec3 na = cross(ea[0], ea[1]);
+  const Vec3 nb = cross(eb[0], eb[1]);
+  if (separatedOnAxis(a, b, na) || separatedOnAxis(a, b, nb)) return false;
+
+  // 辺同士の外積(9軸)
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (separatedOnAxis(a, b, cross(ea[i], eb[j]))) return false;
+    }
+  }
+
+  // 同一平面上にある場合は, 平面内の各辺の法線(6軸)も調べる
+  // NOTE: 同一平面上にない場合は, ここまでの軸で分離できなければ
+  // 必ず交差するので, 以下の軸で分離されることはない
+  for (int i = 0; i < 3; ++i) {
+    if (separatedOnAxis(a, b, cross(na, ea[i])) ||
+        separatedOnAxis(a, b, cross(nb, eb[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 線分p0p1と線分q0q1の最近傍点をそれぞれc0, c1にセットし,
+// 距離の2乗を返す
+inline float closestPointsOnSegments(const Vec3& p0, const Vec3& p1,
+                                     const Vec3& q0, const Vec3& q1, Vec3& c0,
+                                     Vec3& c1) {
+  constexpr float EPS = 1e-12f;
+  const Vec3 d0 = p1 - p0;
+  const Vec3 d1 = q1 - q0;
+  const Vec3 r = p0 - q0;
+  const float a = dot(d0, d0);
+  const float e = dot(d1, d1);
+  const float f = dot(d1, r);
+
+  float s, t;
+  if (a <= EPS && e <= EPS) {
+    // どちらも点に縮退している
+    s = t = 0.0f;
+  } else if (a <= EPS) {
+    // 線分p0p1が点に縮退している
+    s = 0.0f;
+    t = std::clamp(f / e, 0.0f, 1.0f);
+  } else {
+    const float c = dot(d0, r);
+    if (e <= EPS) {
+      // 線分q0q1が点に縮退している
+      t = 0.0f;
+      s = std::clamp(-c / a, 0.0f, 1.0f);
+    } else {
+      // 平行な場合はs = 0にする
+      const float b = dot(d0, d1);
+      const float denom = a * e - b * b;
+      s = denom != 0.0f ? std::clamp((b * f - c * e) / denom, 0.0f, 1.0f)
+                        : 0.0f;
+      t = (b * s + f) / e;
+      if (t < 0.0f) {
+        t = 0.0f;
+        s = std::clamp(-c / a, 0.0f, 1.0f);
+      } else if (t > 1.0f) {
+        t = 1.0f;
+        s = std::clamp((b - c) / a, 0.0f, 1.0f);
+      }
+    }
+  }
+
+  c0 = p0 + s * d0;
+  c1 = q0 + t * d1;
+  return length2(c0 - c1);
+}
+
+// 線分p0p1が三角形tと交わる場合, その点をcにセットしてtrueを返す
+inline bool segmentTriangleIntersection(const Vec3& p0, const Vec3& p1,
+                                        const Vec3 t[3], Vec3& c) {
+  const Vec3 d = p1 - p0;
+  const Vec3 e1 = t[1] - t[0];
+  const Vec3 e2 = t[2] - t[0];
+  const Vec3 pvec = cross(d, e2);
+  const float det = dot(e1, pvec);
+  if (det == 0.0f) return false;
+  const float invDet = 1.0f / det;
+
+  const Vec3 tvec = p0 - t[0];
+  const float u = dot(tvec, pvec) * invDet;
+  if (u < 0.0f || u > 1.0f) return false;
+  const Vec3 qvec = cross(tvec, e1);
+  const float v = dot(d, qvec) * invDet;
+  if (v < 0.0f || u + v > 1.0f) return false;
+  const float s = dot(e2, qvec) * invDet;
+  if (s < 0.0f || s > 1.0f) return false;
+
+  c = p0 + s * d;
+  return true;
+}
+
+// 三角形a, b上の最近傍点をそれぞれca, cbにセットし, 距離の2乗を返す
+// NOTE: 交差している場合は0になり, ca, cbは交差している点の1つ
+inline float closestPointsOnTriangles(const Vec3 a[3], const Vec3 b[3],
+                                      Vec3& ca, Vec3& cb) {
+  float best2 = std::numeric_limits<float>::max();
+  const auto update = [&](float d2, const Vec3& pa, const Vec3& pb) {
+    if (d2 < best2) {
+      best2 = d2;
+      ca = pa;
+      cb = pb;
+    }
+  };
+
+  // 交差している場合は, 一方の辺が他方の三角形を貫いている点を探す
+  // NOTE: 同一平面上で重なっている場合は辺同士か頂点と三角形の距離が0になる
+  if (trianglesOverlap(a, b)) {
+    Vec3 c;
+    for (int i = 0; i < 3; ++i) {
+      if (segmentTriangleIntersection(a[i], a[(i + 1) % 3], b, c) ||
+          segmentTriangleIntersection(b[i], b[(i + 1) % 3], a, c)) {
+        ca = cb = c;
+        return 0.0f;
+      }
+    }
+  }
+
+  // 辺同士の距離(9通り)
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      Vec3 pa, pb;
+      const float d2 = closestPointsOnSegments(a[i], a[(i + 1) % 3], b[j],
+                                               b[(j + 1) % 3], pa, pb);
+      update(d2, pa, pb);
+    }
+  }
+
+  // 頂点と三角形の距離(6通り)
+  for (int i = 0; i < 3; ++i) {
+    float barycentric[2];
+    const Vec3 pb = closestPointOnTriangle(a[i], b[0], b[1], b[2], barycentric);
+    update(length2(a[i] - pb), a[i], pb);
+    const Vec3 pa = closestPointOnTriangle(b[i], a[0], a[1], a[2], barycentric);
+    update(length2(b[i] - pa), pa, b[i]);
+  }
+
+  return best2;
+}
+
+#endif
@@ -3,21 +3,190 @@
 #include "core/aabb.hpp"
 #include "core/intersect-info.hpp"
 #include "core/polygon.hpp"
+#include "core/real.hpp"
+
+// 点pに最も近い三角形abc上の点を返し, その点の重心座標をbarycentricにセットする
+// NOTE: barycentricは頂点b, cの重み
+// Real-Time Collision Detection 5.1.5
+inline Vec3 closestPointOnTriangle(const Vec3& p, const Vec3& a, const Vec3& b,
+                                   const Vec3& c, float barycentric[2]) {
+  const Vec3 ab = b - a;
+  const Vec3 ac = c - a;
+
+  // 頂点aの領域
+  const Vec3 ap = p - a;
+  const float d1 = dot(ab, ap);
+  const float d2 = dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f) {
+    barycentric[0] = 0.0f;
+    barycentric[1] = 0.0f;
+    return a;
+  }
+
+  // 頂点bの領域
+  const Vec3 bp = p - b;
+  const float d3 = dot(ab, bp);
+  const float d4 = dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3) {
+    barycentric[0] = 1.0f;
+    barycentric[1] = 0.0f;
+    return b;
+  }
+
+  // 辺abの領域
+  const float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    const float v = d1 / (d1 - d3);
+    barycentric[0] = v;
+    barycentric[1] = 0.0f;
+    return a + v * ab;
+  }
+
+  // 頂点cの領域
+  const Vec3 cp = p - c;
+  const float d5 = dot(ab, cp);
+  const float d6 = dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6) {
+    barycentric[0] = 0.0f;
+    barycentric[1] = 1.0f;
+    return c;
+  }
+
+  // 辺acの領域
+  const float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    const float w = d2 / (d2 - d6);
+    barycentric[0] = 0.0f;
+    barycentric[1] = w;
+    return a + w * ac;
+  }
+
+  // 辺bcの領域
+  const float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+    const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    barycentric[0] = 1.0f - w;
+    barycentric[1] = w;
+    return b + w * (c - b);
+  }
+
+  // 三角形の内側
+  const float denom = 1.0f / (va + vb + vc);
+  const float v = vb * denom;
+  const float w = vc * denom;
+  barycentric[0] = v;
+  barycentric[1] = w;
+  return a + v * ab + w * ac;
+}
+
+// レイと三角形v1v2v3の交差判定を型Tで行い, [tmin, tmax]の範囲で交差した場合は
+// t, 頂点v2, v3の重みu, vをセットする
+// https://www.tandfonline.com/doi/abs/10.1080/10867651.1997.10487468
+template <typename T>
+inline bool intersectTriangle(const Ray& ray, const Vec3& v1, const Vec3& v2,
+                              const Vec3& v3, float& t, float& u, float& v) {
+  constexpr T EPS = 1e-8;
+  T e1[3], e2[3], tvec[3], direction[3];
+  for (int i = 0; i < 3; ++i) {
+    e1[i] = T(v2[i]) - T(v1[i]);
+    e2[i] = T(v3[i]) - T(v1[i]);
+    tvec[i] = T(ray.origin[i]) - T(v1[i]);
+    direction[i] = ray.direction[i];
+  }
+  const auto cross = [](const T* a, const T* b, T* ret) {
+    ret[0] = a[1] * b[2] - a[2] * b[1];
+    ret[1] = a[2] * b[0] - a[0] * b[2];
+    ret[2] = a[0] * b[1] - a[1] * b[0];
+  };
+  const auto dot = [](const T* a, const T* b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+  };
+
+  T pvec[3];
+  cross(direction, e2, pvec);
+  const T det = dot(e1, pvec);
+
+  if (det > -EPS && det < EPS) return false;
+  const T invDet = T(1) / det;
+
+  const T uT = dot(tvec, pvec) * invDet;
+  if (uT < T(0) || uT > T(1)) return false;
+
+  T qvec[3];
+  cross(tvec, e1, qvec);
+  const T vT = dot(direction, qvec) * invDet;
+  if (vT < T(0) || uT + vT > T(1)) return false;
+
+  const T tT = dot(e2, qvec) * invDet;
+  if (tT < ray.tmin || tT > ray.tmax) return false;
+
+  t = tT;
+  u = uT;
+  v = vT;
+  return true;
+}
 
 class Triangle {
  private:
   const Polygon* polygon;
   unsigned int faceID;
 
+#ifdef BVH_USE_DOUBLE_PRECISION
+  // 頂点v1, v2, v3の三角形との交差判定を行う
+  // NOTE: 頂点の計算をRealで行う
+  bool intersectVertices(const Ray& ray, const Vec3& v1, const Vec3& v2,
+                         const Vec3& v3, IntersectInfo& info) const {
+    float t, u, v;
+    if (!intersectTriangle<Real>(ray, v1, v2, v3, t, u, v)) {
+      return false;
+    }
+#else
+  // 頂点v1, v2, v3の三角形との交差判定を行う
+  bool intersectVertices(const Ray& ray, const Float4& v1, const Float4& v2,
+                         const Float4& v3, IntersectInfo& info) const {
+    const Float4 direction = Float4::load(ray.direction);
+
+    // https://www.tandfonline.com/doi/abs/10.1080/10867651.1997.10487468
+    constexpr float EPS = 1e-8;
+    const Float4 e1 = v2 - v1;
+    const Float4 e2 = v3 - v1;
+
+    const Float4 pvec = cross3(direction, e2);
+    const float det = dot3(e1, pvec);
+
+    if (det > -EPS && det < EPS) return false;
+    const float invDet = 1.0f / det;
+
+    const Float4 tvec = Float4::load(ray.origin) - v1;
+    const float u = dot3(tvec, pvec) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    const Float4 qvec = cross3(tvec, e1);
+    const float v = dot3(direction, qvec) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    const float t = dot3(e2, qvec) * invDet;
+    if (t < ray.tmin || t > ray.tmax) return false;
+#endif
+
+    info.t = t;
+    info.barycentric[0] = u;
+    info.barycentric[1] = v;
+    info.primID = faceID;
+
+    return true;
+  }
+
  public:
   Triangle(const Polygon* polygon, unsigned int faceID)
       : polygon(polygon), faceID(faceID) {}
 
-  AABB calcAABB() const {
+  // 指定したキーフレームでのAABBを計算する
+  AABB calcAABB(unsigned int keyframe = 0) const {
     const auto indices = polygon->getIndices(faceID);
-    const Vec3 v1 = polygon->getVertex(indices[0]);
-    const Vec3 v2 = polygon->getVertex(indices[1]);
-    const Vec3 v3 = polygon->getVertex(indices[2]);
+    const Vec3 v1 = polygon->getKeyframeVertex(keyframe, indices[0]);
+    const Vec3 v2 = polygon->getKeyframeVertex(keyframe, indices[1]);
+    const Vec3 v3 = polygon->getKeyframeVertex(keyframe, indices[2]);
 
     Vec3 pMin, pMax;
     for (int i = 0; i < 3; ++i) {
@@ -28,58 +197,101 @@ class Triangle {
     return AABB(pMin, pMax);
   }
 
+  // 交差判定を行い, t, barycentric, primIDをinfoにセットする
+  // NOTE: 静止した頂点座標と判定する. キーフレームがある場合は
+  // intersectAtTimeを使う
   bool intersect(const Ray& ray, IntersectInfo& info) const {
     const auto indices = polygon->getIndices(faceID);
-    const Vec3 v1 = polygon->getVertex(indices[0]);
-    const Vec3 v2 = polygon->getVertex(indices[1]);
-    const Vec3 v3 = polygon->getVertex(indices[2]);
-
-    // https://www.tandfonline.com/doi/abs/10.1080/10867651.1997.10487468
-    constexpr float EPS = 1e-8;
-    const Vec3 e1 = v2 - v1;
-    const Vec3 e2 = v3 - v1;
+#ifdef BVH_USE_DOUBLE_PRECISION
+    return intersectVertices(ray, polygon->getVertex(indices[0]),
+                             polygon->getVertex(indices[1]),
+                             polygon->getVertex(indices[2]), info);
+#else
+    return intersectVertices(
+        ray, Float4::load3(polygon->vertices + 3 * indices[0]),
+        Float4::load3(polygon->vertices + 3 * indices[1]),
+        Float4::load3(polygon->vertices + 3 * indices[2]), info);
+#endif
+  }
 
-    const Vec3 pvec = cross(ray.direction, e2);
-    const float det = dot(e1, pvec);
+  // 時刻ray.timeでの三角形と交差判定を行い, t, barycentric, primIDを
+  // infoにセットする
+  // NOTE: キーフレームの頂点座標を補間するので, MotionBVHからだけ使う
+  bool intersectAtTime(const Ray& ray, IntersectInfo& info) const {
+    const auto indices = polygon->getIndices(faceID);
+    const Vec3 v1 = polygon->getVertexAtTime(indices[0], ray.time);
+    const Vec3 v2 = polygon->getVertexAtTime(indices[1], ray.time);
+    const Vec3 v3 = polygon->getVertexAtTime(indices[2], ray.time);
+#ifdef BVH_USE_DOUBLE_PRECISION
+    return intersectVertices(ray, v1, v2, v3, info);
+#else
+    return intersectVertices(ray, Float4::load(v1), Float4::load(v2),
+                             Float4::load(v3), info);
+#endif
+  }
 
-    if (det > -EPS && det < EPS) return false;
-    const float invDet = 1.0f / det;
+  // 点pに最も近い三角形上の点を返し, その点の重心座標をbarycentricにセットする
+  // NOTE: barycentricはintersectと同じく頂点v2, v3の重み
+  Vec3 closestPoint(const Vec3& p, float barycentric[2]) const {
+    const auto indices = polygon->getIndices(faceID);
+    return closestPointOnTriangle(p, polygon->getVertex(indices[0]),
+                                  polygon->getVertex(indices[1]),
+                                  polygon->getVertex(indices[2]), barycentric);
+  }
 
-    const Vec3 tvec = ray.origin - v1;
-    const float u = dot(tvec, pvec) * invDet;
-    if (u < 0.0f || u > 1.0f) return false;
+  // 面法線を返す
+  Vec3 faceNormal() const {
+    const auto indices = polygon->getIndices(faceID);
+    const Vec3 v1 = polygon->getVertex(indices[0]);
+    const Vec3 v2 = polygon->getVertex(indices[1]);
+    const Vec3 v3 = polygon->getVertex(indices[2]);
+    return normalize(cross(v2 - v1, v3 - v1));
+  }
 
-    const Vec3 qvec = cross(tvec, e1);
-    const float v = dot(ray.direction, qvec) * invDet;
-    if (v < 0.0f || u + v > 1.0f) return false;
+  // 交差点の情報(位置, 法線, UV, ジオメトリID)を計算する
+  // NOTE: traverse中は最も近い交差点が確定していないので,
+  // traverseが終わった後に一度だけ呼ぶ
+  void calcSurfaceInfo(const Ray& ray, IntersectInfo& info) const {
+    const auto indices = polygon->getIndices(faceID);
+    const float u = info.barycentric[0];
+    const float v = info.barycentric[1];
+    const float w = 1.0f - u - v;
 
-    const float t = dot(e2, qvec) * invDet;
-    if (t < ray.tmin || t > ray.tmax) return false;
+    // 交差点の位置は重心座標から計算する
+    // NOTE: ray(t)よりも誤差が小さく, offsetRayOriginで正しく面から離せる
+    const Vec3 v1 = polygon->getVertexAtTime(indices[0], ray.time);
+    const Vec3 v2 = polygon->getVertexAtTime(indices[1], ray.time);
+    const Vec3 v3 = polygon->getVertexAtTime(indices[2], ray.time);
+    for (int i = 0; i < 3; ++i) {
+      info.hitPos[i] = Real(w) * v1[i] + Real(u) * v2[i] + Real(v) * v3[i];
+    }
+    info.geomID = polygon->getGeomID(faceID);
 
-    info.t = t;
-    info.hitPos = ray(t);
-    info.barycentric[0] = u;
-    info.barycentric[1] = v;
+    // 面法線(幾何法線)の計算
+    // NOTE: 補間した法線は実際の面と傾いているので, offsetRayOriginには
+    // こちらを使う
+    info.geomNormal = normalize(cross(v2 - v1, v3 - v1));
 
     // 法線の計算
-    const float w = 1.0f - u - v;
     if (polygon->hasNormals()) {
       // 補間した法線を計算
-      const Vec3 n1 = polygon->getNormal(indices[0]);
-      const Vec3 n2 = polygon->getNormal(indices[1]);
-      const Vec3 n3 = polygon->getNormal(indices[2]);
+      const auto normalIndices = polygon->getNormalIndices(faceID);
+      const Vec3 n1 = polygon->getNormal(normalIndices[0]);
+      const Vec3 n2 = polygon->getNormal(normalIndices[1]);
+      const Vec3 n3 = polygon->getNormal(normalIndices[2]);
       info.hitNormal = w * n1 + u * n2 + v * n3;
     } else {
-      // 面法線を計算
-      info.hitNormal = normalize(cross(e1, e2));
+      // 面法線を使う
+      info.hitNormal = info.geomNormal;
     }
 
     // UVの計算
     if (polygon->hasUVs()) {
       // 補間したUVを計算
-      const auto uv1 = polygon->getUV(indices[0]);
-      const auto uv2 = polygon->getUV(indices[1]);
-      const auto uv3 = polygon->getUV(indices[2]);
+      const auto uvIndices = polygon->getUVIndices(faceID);
+      const auto uv1 = polygon->getUV(uvIndices[0]);
+      const auto uv2 = polygon->getUV(uvIndices[1]);
+      const auto uv3 = polygon->getUV(uvIndices[2]);
       info.uv[0] = w * uv1.first + u * uv2.first + v * uv3.first;
       info.uv[1] = w * uv1.second + u * uv2.second + v * uv3.second;
     } else {
@@ -87,8 +299,6 @@ class Triangle {
       info.uv[0] = u;
       info.uv[1] = v;
     }
-
-    return true;
   }
 };
 
@@ -0,0 +1,171 @@
+#ifndef _TRIANGLE4_H
+#define _TRIANGLE4_H
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#include "core/intersect-info.hpp"
+#include "core/polygon.hpp"
+#include "core/ray.hpp"
+#include "core/simd.hpp"
+
+// watertightな三角形の交差判定で使うレイの情報
+// レイの方向が+z軸になるようなshear変換で, kzはレイの方向の成分の絶対値が
+// 最大の軸. https://jcgt.org/published/0002/01/05/
+// NOTE: Triangle4でしか使わないので, PrecomputedRayとは別に
+// Triangle4のtraverseの時だけ計算する
+struct WatertightRayData {
+  Vec3 origin;     // レイの始点
+  int kx, ky, kz;  // 並べ替えた軸
+  float shear[3];  // Sx, Sy, Sz
+
+  explicit WatertightRayData(const Ray& ray) : origin(ray.origin) {
+    const Vec3& d = ray.direction;
+    kz = 0;
+    for (int i = 1; i < 3; ++i) {
+      if (std::abs(d[i]) > std::abs(d[kz])) kz = i;
+    }
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    // 三角形の向きが反転しないように, 負の方向の場合はkxとkyを入れ替える
+    if (d[kz] < 0) std::swap(kx, ky);
+    shear[0] = d[kx] / d[kz];
+    shear[1] = d[ky] / d[kz];
+    shear[2] = 1.0f / d[kz];
+  }
+};
+
+// 最大4個の三角形をSoAでまとめたもの
+// 葉ノードに含まれる三角形を1回のSIMD演算で交差判定する
+class Triangle4 {
+ private:
+  alignas(16) float vertices[3][3][4];  // 頂点座標[頂点][軸][三角形]
+  uint32_t faceIDs[4];                  // 各三角形の面番号
+
+ public:
+  // faceIDsの先頭nFaces個(1~4個)の面をまとめる
+  // NOTE: 4個に満たない場合は最後の面で埋める.
+  // 同じ面は同じtになり, 先頭の面が選ばれるので結果は変わらない
+  Triangle4(const Polygon* polygon, const uint32_t* faceIDs, int nFaces) {
+    assert(nFaces > 0 && nFaces <= 4);
+    for (int i = 0; i < 4; ++i) {
+      const uint32_t faceID = faceIDs[std::min(i, nFaces - 1)];
+      const auto indices = polygon->getIndices(faceID);
+      for (int j = 0; j < 3; ++j) {
+        const Vec3 v = polygon->getVertex(indices[j]);
+        for (int axis = 0; axis < 3; ++axis) {
+          vertices[j][axis][i] = v[axis];
+        }
+      }
+      this->faceIDs[i] = faceID;
+    }
+  }
+
+  // i番目の三角形の面番号を返す
+  uint32_t getFaceID(int i) const { return faceIDs[i]; }
+
+  // 4個の三角形と交差判定を行い, 最も近い交差点のt, barycentric,
+  // primIDをinfoにセットする
+  // https://jcgt.org/published/0002/01/05/
+  // NOTE: 辺上の点は隣接する三角形のどちらかで必ず交差する(watertight)
+  bool intersect(const Ray& ray, const WatertightRayData& rayData,
+                 IntersectInfo& info) const {
+    const int kx = rayData.kx;
+    const int ky = rayData.ky;
+    const int kz = rayData.kz;
+    const Float4 zero(0.0f);
+
+    // 頂点をレイの始点が原点になるように平行移動する
+    const Float4 ox(rayData.origin[kx]);
+    const Float4 oy(rayData.origin[ky]);
+    const Float4 oz(rayData.origin[kz]);
+    const Float4 ax = Float4::load(vertices[0][kx]) - ox;
+    const Float4 ay = Float4::load(vertices[0][ky]) - oy;
+    const Float4 az = Float4::load(vertices[0][kz]) - oz;
+    const Float4 bx = Float4::load(vertices[1][kx]) - ox;
+    const Float4 by = Float4::load(vertices[1][ky]) - oy;
+    const Float4 bz = Float4::load(vertices[1][kz]) - oz;
+    const Float4 cx = Float4::load(vertices[2][kx]) - ox;
+    const Float4 cy = Float4::load(vertices[2][ky]) - oy;
+    const Float4 cz = Float4::load(vertices[2][kz]) - oz;
+
+    // レイの方向が+z軸になるようにshear変換する
+    const Float4 sx(rayData.shear[0]);
+    const Float4 sy(rayData.shear[1]);
+    const Float4 sz(rayData.shear[2]);
+    const Float4 axs = ax - sx * az;
+    const Float4 ays = ay - sy * az;
+    const Float4 bxs = bx - sx * bz;
+    const Float4 bys = by - sy * bz;
+    const Float4 cxs = cx - sx * cz;
+    const Float4 cys = cy - sy * cz;
+
+    // 2次元の符号付き面積(edge function)
+    Float4 u = cxs * bys - cys * bxs;
+    Float4 v = axs * cys - ays * cxs;
+    Float4 w = bxs * ays - bys * axs;
+
+    // 0になった場合は符号が正しく判定できないので, 倍精度で計算し直す
+    if (((u == zero) | (v == zero) | (w == zero)).mask()) {
+      alignas(16) float us[4], vs[4], ws[4];
+      u.store(us);
+      v.store(vs);
+      w.store(ws);
+      for (int i = 0; i < 4; ++i) {
+        if (us[i] != 0 && vs[i] != 0 && ws[i] != 0) continue;
+        const double axd = axs[i], ayd = ays[i];
+        const double bxd = bxs[i], byd = bys[i];
+        const double cxd = cxs[i], cyd = cys[i];
+        us[i] = static_cast<float>(cxd * byd - cyd * bxd);
+        vs[i] = static_cast<float>(axd * cyd - ayd * cxd);
+        ws[i] = static_cast<float>(bxd * ayd - byd * axd);
+      }
+      u = Float4::load(us);
+      v = Float4::load(vs);
+      w = Float4::load(ws);
+    }
+
+    // 符号が揃っていない場合は三角形の外側
+    const Bool4 hasNegative = (u < zero) | (v < zero) | (w < zero);
+    const Bool4 hasPositive = (u > zero) | (v > zero) | (w > zero);
+    const Float4 det = u + v + w;
+
+    // 距離を計算し, detで割る前にレイの範囲に入っているか判定する
+    // NOTE: detの符号に合わせてtの分子の符号を反転させる
+    const Float4 tScaled = sz * (u * az + v * bz + w * cz);
+    const Bool4 detNegative = det < zero;
+    const Float4 detAbs = abs(det);
+    const Float4 tScaledAbs = select(detNegative, -tScaled, tScaled);
+    const Bool4 valid = andNot(hasNegative & hasPositive,
+                               (det != zero) &
+                                   (tScaledAbs >= Float4(ray.tmin) * detAbs) &
+                                   (tScaledAbs <= Float4(ray.tmax) * detAbs));
+    const int mask = valid.mask();
+    if (mask == 0) return false;
+
+    // 交差した中で最も近い三角形を選ぶ
+    const Float4 detInv = Float4(1.0f) / det;
+    alignas(16) float ts[4], vs[4], ws[4];
+    (tScaled * detInv).store(ts);
+    (v * detInv).store(vs);
+    (w * detInv).store(ws);
+    int closest = -1;
+    for (int i = 0; i < 4; ++i) {
+      if (!(mask & (1 << i))) continue;
+      if (closest < 0 || ts[i] < ts[closest]) closest = i;
+    }
+
+    // NOTE: u, v, wはそれぞれ頂点a, b, cの重み.
+    // barycentricはTriangleと同じく頂点b, cの重みにする
+    info.t = ts[closest];
+    info.barycentric[0] = vs[closest];
+    info.barycentric[1] = ws[closest];
+    info.primID = faceIDs[closest];
+
+    return true;
+  }
+};
+
+#endif
@@ -23,6 +23,10 @@ class Vec3 {
     return v[i];
   }
 
+  // 要素の配列へのポインタを返す
+  const float* data() const { return v; }
+  float* data() { return v; }
+
   Vec3 operator-() const { return Vec3(-v[0], -v[1], -v[2]); }
 
   Vec3& operator+=(const Vec3& v) {
@@ -0,0 +1,305 @@
+#ifndef _BINARY_MESH_H
+#define _BINARY_MESH_H
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "core/polygon.hpp"
+
+// バイナリメッシュ形式
+// ヘッダの後に64Byteアラインメントされた各配列が並ぶ
+// | header | vertices | indices | normals | uvs | normalIndices | uvIndices |
+// | geomIDs |
+// NOTE: リトルエンディアンを前提としている
+// 各配列のオフセットはファイル先頭からのバイト数
+struct BinaryMeshHeader {
+  char magic[4];                 // "BVHM"
+  uint32_t version;              // フォーマットのバージョン
+  uint32_t nVertices;            // 頂点数
+  uint32_t nIndices;             // インデックス数(面の数 * 3)
+  uint32_t nNormals;             // 法線の数(存在しない場合は0)
+  uint32_t nUVs;                 // UV座標の数(存在しない場合は0)
+  uint32_t nNormalIndices;       // 法線のインデックス数(0またはnIndices)
+  uint32_t nUVIndices;           // UV座標のインデックス数(0またはnIndices)
+  uint32_t nGeomIDs;             // ジオメトリIDの数(0または面の数)
+  uint32_t reserved;             // 未使用
+  uint64_t verticesOffset;       // 頂点座標配列のオフセット
+  uint64_t indicesOffset;        // インデックス配列のオフセット
+  uint64_t normalsOffset;        // 法線配列のオフセット
+  uint64_t uvsOffset;            // UV座標配列のオフセット
+  uint64_t normalIndicesOffset;  // 法線のインデックス配列のオフセット
+  uint64_t uvIndicesOffset;      // UV座標のインデックス配列のオフセット
+  uint64_t geomIDsOffset;        // ジオメトリID配列のオフセット
+};
+
+constexpr char BINARY_MESH_MAGIC[4] = {'B', 'V', 'H', 'M'};
+constexpr uint32_t BINARY_MESH_VERSION = 2;
+constexpr uint64_t BINARY_MESH_ALIGNMENT = 64;
+
+// offsetをアラインメントの倍数に切り上げる
+inline uint64_t alignBinaryMeshOffset(uint64_t offset) {
+  return (offset + BINARY_MESH_ALIGNMENT - 1) & ~(BINARY_MESH_ALIGNMENT - 1);
+}
+
+// バイナリメッシュ形式でファイルに書き出す
+// vertices, indices以外は空でも良い
+inline bool writeBinaryMesh(
+    const std::string& filename, const std::vector<float>& vertices,
+    const std::vector<unsigned int>& indices, const std::vector<float>& normals,
+    const std::vector<float>& uvs,
+    const std::vector<unsigned int>& normalIndices = {},
+    const std::vector<unsigned int>& uvIndices = {},
+    const std::vector<int>& geomIDs = {}) {
+  BinaryMeshHeader header;
+  std::memcpy(header.magic, BINARY_MESH_MAGIC, sizeof(header.magic));
+  header.version = BINARY_MESH_VERSION;
+  header.nVertices = vertices.size() / 3;
+  header.nIndices = indices.size();
+  header.nNormals = normals.size() / 3;
+  header.nUVs = uvs.size() / 2;
+  header.nNormalIndices = normalIndices.size();
+  header.nUVIndices = uvIndices.size();
+  header.nGeomIDs = geomIDs.size();
+  header.reserved = 0;
+
+  // 各配列のオフセットを計算
+  header.verticesOffset = alignBinaryMeshOffset(sizeof(BinaryMeshHeader));
+  header.indicesOffset = alignBinaryMeshOffset(
+      header.verticesOffset + sizeof(float) * vertices.size());
+  header.normalsOffset = alignBinaryMeshOffset(
+      header.indicesOffset + sizeof(unsigned int) * indices.size());
+  header.uvsOffset = alignBinaryMeshOffset(header.normalsOffset +
+                                           sizeof(float) * normals.size());
+  header.normalIndicesOffset =
+      alignBinaryMeshOffset(header.uvsOffset + sizeof(float) * uvs.size());
+  header.uvIndicesOffset = alignBinaryMeshOffset(
+      header.normalIndicesOffset + sizeof(unsigned int) * normalIndices.size());
+  header.geomIDsOffset = alignBinaryMeshOffset(
+      header.uvIndicesOffset + sizeof(unsigned int) * uvIndices.size());
+  const uint64_t fileSize =
+      header.geomIDsOffset + sizeof(int) * geomIDs.size();
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return false;
+  }
+
+  // パディングを0で埋めながら配列を書き出す
+  uint64_t pos = 0;
+  const auto writeArray = [&](uint64_t offset, const void* data,
+                              uint64_t size) {
+    static const char zeros[BINARY_MESH_ALIGNMENT] = {};
+    file.write(zeros, offset - pos);
+    file.write(reinterpret_cast<const char*>(data), size);
+    pos = offset + size;
+  };
+  writeArray(0, &header, sizeof(BinaryMeshHeader));
+  writeArray(header.verticesOffset, vertices.data(),
+             sizeof(float) * vertices.size());
+  writeArray(header.indicesOffset, indices.data(),
+             sizeof(unsigned int) * indices.size());
+  writeArray(header.normalsOffset, normals.data(),
+             sizeof(float) * normals.size());
+  writeArray(header.uvsOffset, uvs.data(), sizeof(float) * uvs.size());
+  writeArray(header.normalIndicesOffset, normalIndices.data(),
+             sizeof(unsigned int) * normalIndices.size());
+  writeArray(header.uvIndicesOffset, uvIndices.data(),
+             sizeof(unsigned int) * uvIndices.size());
+  writeArray(header.geomIDsOffset, geomIDs.data(),
+             sizeof(int) * geomIDs.size());
+
+  if (!file || pos != fileSize) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// バイナリメッシュをメモリマップして読み込む
+// Polygonはマップされた領域を直接指すのでコピーは発生しない
+// NOTE: 書き込みはプライベートなコピーに対して行われ, ファイルには反映されない
+class BinaryMesh {
+ private:
+  void* data{nullptr};  // マップされた領域の先頭
+  uint64_t size{0};     // マップされた領域のサイズ
+#ifdef _WIN32
+  HANDLE fileHandle{INVALID_HANDLE_VALUE};
+  HANDLE mappingHandle{nullptr};
+#endif
+
+  const BinaryMeshHeader& header() const {
+    return *reinterpret_cast<const BinaryMeshHeader*>(data);
+  }
+
+  // 配列の先頭を返す. 要素数が0の場合はnullptrを返す
+  template <typename T>
+  T* getArray(uint64_t offset, uint32_t n) const {
+    if (n == 0) return nullptr;
+    return reinterpret_cast<T*>(static_cast<char*>(data) + offset);
+  }
+
+  // 配列がファイルの範囲内に収まっているか
+  bool checkArray(uint64_t offset, uint64_t nBytes) const {
+    return offset % BINARY_MESH_ALIGNMENT == 0 && offset <= size &&
+           nBytes <= size - offset;
+  }
+
+  // インデックス配列の全ての値がn未満か
+  // NOTE: 壊れたファイルで構築やtraverseが範囲外を読まないように,
+  // 読み込み時に一度だけ全ての値を調べる
+  bool checkIndices(uint64_t offset, uint32_t nIndices, uint32_t n) const {
+    const unsigned int* indices = getArray<unsigned int>(offset, nIndices);
+    for (uint32_t i = 0; i < nIndices; ++i) {
+      if (indices[i] >= n) return false;
+    }
+    return true;
+  }
+
+  bool validate() const {
+    if (size < sizeof(BinaryMeshHeader)) return false;
+    const BinaryMeshHeader& h = header();
+    if (std::memcmp(h.magic, BINARY_MESH_MAGIC, sizeof(h.magic)) != 0) {
+      return false;
+    }
+    if (h.version != BINARY_MESH_VERSION) return false;
+    if (h.nIndices % 3 != 0) return false;
+    if (h.nNormalIndices != 0 && h.nNormalIndices != h.nIndices) return false;
+    if (h.nUVIndices != 0 && h.nUVIndices != h.nIndices) return false;
+    if (h.nGeomIDs != 0 && h.nGeomIDs != h.nIndices / 3) return false;
+    // インデックス配列が無い場合はverticesと同じインデックスで参照する
+    if (h.nNormals != 0 && h.nNormalIndices == 0 &&
+        h.nNormals != h.nVertices) {
+      return false;
+    }
+    if (h.nUVs != 0 && h.nUVIndices == 0 && h.nUVs != h.nVertices) {
+      return false;
+    }
+    return checkArray(h.verticesOffset, 3 * sizeof(float) * h.nVertices) &&
+           checkArray(h.indicesOffset, sizeof(unsigned int) * h.nIndices) &&
+           checkArray(h.normalsOffset, 3 * sizeof(float) * h.nNormals) &&
+           checkArray(h.uvsOffset, 2 * sizeof(float) * h.nUVs) &&
+           checkArray(h.normalIndicesOffset,
+                      sizeof(unsigned int) * h.nNormalIndices) &&
+           checkArray(h.uvIndicesOffset, sizeof(unsigned int) * h.nUVIndices) &&
+           checkArray(h.geomIDsOffset, sizeof(int) * h.nGeomIDs) &&
+           checkIndices(h.indicesOffset, h.nIndices, h.nVertices) &&
+           (h.nNormals == 0 ||
+            checkIndices(h.normalIndicesOffset, h.nNormalIndices,
+                         h.nNormals)) &&
+           (h.nUVs == 0 ||
+            checkIndices(h.uvIndicesOffset, h.nUVIndices, h.nUVs));
+  }
+
+  void unmap() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap(data, size);
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+ public:
+  BinaryMesh() {}
+  BinaryMesh(const BinaryMesh&) = delete;
+  BinaryMesh& operator=(const BinaryMesh&) = delete;
+  ~BinaryMesh() { unmap(); }
+
+  // ファイルをメモリマップする
+  bool load(const std::string& filename) {
+    unmap();
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                             nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+    LARGE_INTEGER fileSize;
+    if (fileHandle == INVALID_HANDLE_VALUE ||
+        !GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+      std::cerr << "failed to open " << filename << std::endl;
+      unmap();
+      return false;
+    }
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_WRITECOPY, 0,
+                                       0, nullptr);
+    if (mappingHandle) {
+      data = MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+    }
+    size = fileSize.QuadPart;
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+      std::cerr << "failed to open " << filename << std::endl;
+      if (fd >= 0) close(fd);
+      return false;
+    }
+    size = st.st_size;
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) data = nullptr;
+#endif
+
+    if (!data) {
+      std::cerr << "failed to map " << filename << std::endl;
+      unmap();
+      return false;
+    }
+
+    if (!validate()) {
+      std::cerr << "invalid binary mesh: " << filename << std::endl;
+      unmap();
+      return false;
+    }
+
+    return true;
+  }
+
+  // 頂点数を返す
+  unsigned int nVertices() const { return data ? header().nVertices : 0; }
+  // 面の数を返す
+  unsigned int nFaces() const { return data ? header().nIndices / 3 : 0; }
+  // 法線が存在するか
+  bool hasNormals() const { return data && header().nNormals > 0; }
+  // UVが存在するか
+  bool hasUVs() const { return data && header().nUVs > 0; }
+
+  // マップされた領域を指すPolygonを返す
+  // NOTE: PolygonはBinaryMeshより長く生存してはいけない
+  Polygon polygon() const {
+    assert(data);
+    const BinaryMeshHeader& h = header();
+    return Polygon(h.nIndices, getArray<float>(h.verticesOffset, h.nVertices),
+                   getArray<unsigned int>(h.indicesOffset, h.nIndices),
+                   getArray<float>(h.normalsOffset, h.nNormals),
+                   getArray<float>(h.uvsOffset, h.nUVs),
+                   getArray<int>(h.geomIDsOffset, h.nGeomIDs),
+                   getArray<unsigned int>(h.normalIndicesOffset,
+                                          h.nNormalIndices),
+                   getArray<unsigned int>(h.uvIndicesOffset, h.nUVIndices));
+  }
+};
+
+#endif